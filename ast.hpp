@@ -1,9 +1,74 @@
-struct Visitor; struct Ast { int64_t line; int64_t col; virtual void can_dynamic_cast() {} virtual void accept(const std::string&,Visitor&)=0; };
-std::ostream& operator<< (std::ostream& out,const Ast& node) { out << "(Ast)"; }
+struct Visitor; struct Transformer; struct Walker; struct Ast; struct AstIndex; struct AstArena;
+template<class T> void astConstructed(T& node);
+inline void astDestroyed(Ast& node);
+inline void astMoved(Ast& from,Ast& to);
+inline void astCast(bool ok);
+
+// How clone() copies: into an arena (with ASTGEN_ARENA), and collections of at least
+// parallelThreshold items split across threads (0 copies on the calling thread)
+struct CloneOptions {
+  AstArena* arena;
+  std::size_t parallelThreshold;
+  std::size_t threads; // for parallelThreshold, 0 for one per core
+  CloneOptions() : arena(nullptr),parallelThreshold(0),threads(0) {}
+};
+
+struct Ast {
+  int64_t line;
+  int64_t col;
+#ifdef ASTGEN_INDEX
+  // Registration in an AstIndex; copies of a node are not registered
+  struct IndexSlot {
+    AstIndex* index; uint32_t kind; uint32_t slot;
+    IndexSlot() : index(nullptr),kind(0),slot(0) {}
+    IndexSlot(const IndexSlot&) : index(nullptr),kind(0),slot(0) {}
+    IndexSlot& operator=(const IndexSlot&) { return *this; }
+  } indexSlot;
+#endif
+#ifdef ASTGEN_STATS
+  // Kind for AstStats; copies of a node are not counted
+  struct StatsKind {
+    uint32_t value;
+    StatsKind() : value(~0u) {}
+    StatsKind(const StatsKind&) : value(~0u) {}
+    StatsKind& operator=(const StatsKind&) { return *this; }
+  } statsKind;
+#endif
+#ifdef ASTGEN_IDS
+  uint32_t nodeId; // dense per kind, see AstIdSpace
+#endif
+  Ast() : line(0),col(0) {
+#ifdef ASTGEN_IDS
+    nodeId=0;
+#endif
+  }
+  virtual ~Ast() { astDestroyed(*this); }
+  virtual void can_dynamic_cast() {}
+  virtual void accept(const std::string&,Visitor&)=0;
+  virtual Ast* cloneAst(const CloneOptions& options) const=0;
+  virtual std::unique_ptr<Ast> transformWith(Transformer& transformer)=0;
+  virtual bool walk(Walker& walker) const=0;
+  virtual void print(std::ostream& out) const=0;
+#ifdef ASTGEN_ARENA
+  static void* operator new(std::size_t size);
+  static void* operator new(std::size_t size,AstArena& arena);
+  static void operator delete(void* p);
+  static void operator delete(void* p,AstArena& arena);
+  virtual Ast* relocate(AstArena& arena)=0;
+#endif
+};
+inline std::ostream& operator<< (std::ostream& out,const Ast& node) { node.print(out); return out; }
 using std::string;
 
 struct Collection : Ast {
   void accept(const string&, Visitor&) {};
+  Ast* cloneAst(const CloneOptions&) const { return nullptr; }
+  std::unique_ptr<Ast> transformWith(Transformer&) { return nullptr; }
+  bool walk(Walker&) const { return true; }
+  void print(std::ostream&) const {}
+#ifdef ASTGEN_ARENA
+  Ast* relocate(AstArena&) { return nullptr; }
+#endif
   std::vector<std::unique_ptr<Ast>> items; 
   void push_back(std::unique_ptr<Ast>&& item) { items.push_back(std::move(item)); } 
   std::vector<std::unique_ptr<Ast>>& get() { return items; }
@@ -13,6 +78,7 @@ template<class T,class S>
 T tryCast(S s) {
   if (!s) return 0;
   T t=dynamic_cast<T>(s);
+  astCast(t);
   if (!t) {
     std::cerr << "AST type mismatch." << std::endl;
     throw;
@@ -20,13 +86,285 @@ T tryCast(S s) {
   return t;
 }
 
+#include <cstdio>
+
+// Scalars in operator<< dumps: strings are quoted and doubles keep every digit, so that
+// AstReader rebuilds exactly the tree that was printed
+template<class T> void printValue(std::ostream& out,const T& value) { out << value; }
+inline void printValue(std::ostream& out,const int8_t& value) { out << int(value); }
+inline void printValue(std::ostream& out,const uint8_t& value) { out << int(value); }
+inline void printValue(std::ostream& out,const double& value) {
+  char text[32];
+  snprintf(text,sizeof(text),"%.17g",value);
+  out << text;
+}
+inline void printValue(std::ostream& out,const std::string& value) {
+  out << '"';
+  for (char c : value) {
+    if (c=='"'||c=='\\') out << '\\' << c;
+    else if (c=='\n') out << "\\n";
+    else out << c;
+  }
+  out << '"';
+}
+
 // Forward declarations
 struct Id;
 struct Type;
 struct Attribute;
 struct Node;
+struct Enum;
+struct Sum;
 struct Nodes;
 
+// Dense numbering of node kinds
+template<class T> struct KindId;
+template<> struct KindId<Id> { static constexpr uint32_t value=0; };
+template<> struct KindId<Type> { static constexpr uint32_t value=1; };
+template<> struct KindId<Attribute> { static constexpr uint32_t value=2; };
+template<> struct KindId<Node> { static constexpr uint32_t value=3; };
+template<> struct KindId<Enum> { static constexpr uint32_t value=4; };
+template<> struct KindId<Sum> { static constexpr uint32_t value=5; };
+template<> struct KindId<Nodes> { static constexpr uint32_t value=6; };
+static const uint32_t kindCount=7;
+// Size of arrays indexed by kind, which C++ does not allow to be empty
+static const uint32_t kindSlots=7;
+
+inline const char* kindName(uint32_t kind) {
+  static const char* names[kindSlots]={"Id","Type","Attribute","Node","Enum","Sum","Nodes"};
+  return names[kind];
+}
+
+#ifdef ASTGEN_STATS
+#include <atomic>
+#include <chrono>
+#include <ostream>
+
+// Counters per node kind. Relaxed atomics, so clone() and AstBuilder workers may count
+// from several threads; reset() and the dumps expect no concurrent updates.
+struct AstStats {
+  typedef std::atomic<uint64_t> Counter;
+  Counter constructed[kindSlots];
+  Counter destroyed[kindSlots];
+  Counter bytes[kindSlots];
+  Counter visits[kindSlots];
+  Counter visitNanos[kindSlots];
+  Counter casts;
+  Counter castFailures;
+
+  AstStats() { reset(); }
+  static AstStats& get() { static AstStats stats; return stats; }
+
+  static void add(Counter& counter,uint64_t n) { counter.fetch_add(n,std::memory_order_relaxed); }
+  static const char* name(uint32_t kind) { return kindName(kind); }
+
+  void reset() {
+    for (uint32_t kind=0;kind<kindCount;++kind) constructed[kind]=destroyed[kind]=bytes[kind]=visits[kind]=visitNanos[kind]=0;
+    casts=castFailures=0;
+  }
+
+  // Times one visitor callback and charges it to a kind
+  struct Timer {
+    uint32_t kind;
+    std::chrono::steady_clock::time_point start;
+    Timer(uint32_t kind,bool visit) : kind(kind),start(std::chrono::steady_clock::now()) { add(get().visits[kind],visit); }
+    ~Timer() { add(get().visitNanos[kind],std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now()-start).count()); }
+  };
+
+  void dump(std::ostream& out) const {
+    out << "kind constructed destroyed bytes visits visitNanos\n";
+    for (uint32_t kind=0;kind<kindCount;++kind) {
+      out << name(kind) << ' ' << constructed[kind].load() << ' ' << destroyed[kind].load() << ' ' << bytes[kind].load() << ' ' << visits[kind].load() << ' ' << visitNanos[kind].load() << '\n';
+    }
+    out << "casts " << casts.load() << " castFailures " << castFailures.load() << '\n';
+  }
+
+  void dumpJson(std::ostream& out) const {
+    out << "{\"kinds\":{";
+    for (uint32_t kind=0;kind<kindCount;++kind) {
+      out << (kind?",":"") << '"' << name(kind) << "\":{\"constructed\":" << constructed[kind].load() << ",\"destroyed\":" << destroyed[kind].load()
+          << ",\"bytes\":" << bytes[kind].load() << ",\"visits\":" << visits[kind].load() << ",\"visitNanos\":" << visitNanos[kind].load() << '}';
+    }
+    out << "},\"casts\":" << casts.load() << ",\"castFailures\":" << castFailures.load() << '}';
+  }
+};
+
+#define ASTGEN_VISIT(T,visit,call) { AstStats::Timer timer(KindId<T>::value,visit); call; }
+#else
+#define ASTGEN_VISIT(T,visit,call) call
+#endif
+
+#ifdef ASTGEN_POOL
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <ostream>
+
+// Recycles node memory through free lists, one per 16-byte size class. Every thread keeps
+// its own lists and trades batches with a shared depot, so most allocations and frees take
+// no lock and never reach the global allocator. Memory is kept for reuse, not returned.
+struct AstPool {
+  static const std::size_t classes=32; // nodes of up to 512 bytes, larger ones use ::operator new
+  static const std::size_t batch=64;
+  static const std::size_t chunkSize=1<<16;
+
+  struct Block { Block* next; };
+  struct List {
+    Block* head;
+    std::size_t count;
+    List() : head(nullptr),count(0) {}
+    void push(Block* block) { block->next=head; head=block; ++count; }
+    Block* pop() { Block* block=head; head=block->next; --count; return block; }
+  };
+
+  // Written by one thread, read by any
+  struct Counter {
+    std::atomic<uint64_t> value;
+    Counter() : value(0) {}
+    void add() { value.store(value.load(std::memory_order_relaxed)+1,std::memory_order_relaxed); }
+    uint64_t get() const { return value.load(std::memory_order_relaxed); }
+  };
+
+  struct Cache;
+  struct Stats {
+    uint64_t allocations[kindSlots];
+    uint64_t frees[kindSlots];
+    uint64_t large; // allocations too big for a size class
+    uint64_t chunks;
+    uint64_t carved; // blocks cut from chunks; every other pooled allocation reuses one
+    Stats() : large(0),chunks(0),carved(0) { for (uint32_t kind=0;kind<kindCount;++kind) allocations[kind]=frees[kind]=0; }
+  };
+
+  // Blocks given back by threads, the live thread caches, and the counts of exited threads
+  struct Depot {
+    std::mutex mutex;
+    List lists[classes];
+    std::vector<Cache*> caches;
+    Stats retired;
+  };
+  static Depot& depot() { static Depot depot; return depot; }
+
+  struct Cache {
+    List lists[classes];
+    Counter allocations[kindSlots];
+    Counter frees[kindSlots];
+    Counter large;
+    Counter chunks;
+    Counter carved;
+    char* fresh[classes]; // unused part of the last chunk of each class
+    char* freshEnd[classes];
+
+    Cache() {
+      for (std::size_t c=0;c<classes;++c) fresh[c]=freshEnd[c]=nullptr;
+      std::lock_guard<std::mutex> lock(depot().mutex);
+      depot().caches.push_back(this);
+    }
+    ~Cache() {
+      Depot& shared=depot();
+      std::lock_guard<std::mutex> lock(shared.mutex);
+      for (std::size_t c=0;c<classes;++c) {
+        while (lists[c].head) shared.lists[c].push(lists[c].pop());
+        for (;fresh[c]<freshEnd[c];fresh[c]+=(c+1)*16) shared.lists[c].push(reinterpret_cast<Block*>(fresh[c]));
+      }
+      add(shared.retired);
+      shared.caches.erase(std::find(shared.caches.begin(),shared.caches.end(),this));
+    }
+    void add(Stats& stats) const {
+      for (uint32_t kind=0;kind<kindCount;++kind) {
+        stats.allocations[kind]+=allocations[kind].get();
+        stats.frees[kind]+=frees[kind].get();
+      }
+      stats.large+=large.get();
+      stats.chunks+=chunks.get();
+      stats.carved+=carved.get();
+    }
+
+    void* carve(std::size_t c) {
+      std::size_t size=(c+1)*16;
+      if (std::size_t(freshEnd[c]-fresh[c])<size) {
+        fresh[c]=static_cast<char*>(::operator new(chunkSize));
+        freshEnd[c]=fresh[c]+chunkSize/size*size;
+        chunks.add();
+      }
+      carved.add();
+      void* p=fresh[c];
+      fresh[c]+=size;
+      return p;
+    }
+  };
+  static Cache& cache() { static thread_local Cache cache; return cache; }
+
+  // Takes up to a batch of blocks from the depot into an empty list
+  static void refill(List& list,std::size_t c) {
+    Depot& shared=depot();
+    std::lock_guard<std::mutex> lock(shared.mutex);
+    while (list.count<batch&&shared.lists[c].head) list.push(shared.lists[c].pop());
+  }
+
+  static void* take(uint32_t kind,std::size_t size) {
+    Cache& local=cache();
+    local.allocations[kind].add();
+    std::size_t c=(size-1)/16;
+    if (c>=classes) { local.large.add(); return ::operator new(size); }
+    List& list=local.lists[c];
+    if (!list.head) refill(list,c);
+    return list.head?list.pop():local.carve(c);
+  }
+
+  // A thread that frees much more than it allocates passes the surplus on
+  static void give(uint32_t kind,void* p,std::size_t size) {
+    Cache& local=cache();
+    local.frees[kind].add();
+    std::size_t c=(size-1)/16;
+    if (c>=classes) { ::operator delete(p); return; }
+    List& list=local.lists[c];
+    list.push(static_cast<Block*>(p));
+    if (list.count<2*batch) return;
+    std::lock_guard<std::mutex> lock(depot().mutex);
+    while (list.count>batch) depot().lists[c].push(list.pop());
+  }
+
+  // Arena nodes are marked in the 16 bytes before them, see Ast::operator new
+  static void* allocate(uint32_t kind,std::size_t size) {
+#ifdef ASTGEN_ARENA
+    char* p=static_cast<char*>(take(kind,size+16));
+    p[0]=0;
+    return p+16;
+#else
+    return take(kind,size);
+#endif
+  }
+  static void release(uint32_t kind,void* p,std::size_t size) {
+    if (!p) return;
+#ifdef ASTGEN_ARENA
+    if (!static_cast<char*>(p)[-16]) give(kind,static_cast<char*>(p)-16,size+16);
+#else
+    give(kind,p,size);
+#endif
+  }
+
+  // Counters summed over all threads
+  static Stats stats() {
+    Depot& shared=depot();
+    std::lock_guard<std::mutex> lock(shared.mutex);
+    Stats stats=shared.retired;
+    for (auto cache : shared.caches) cache->add(stats);
+    return stats;
+  }
+
+  static void dump(std::ostream& out) {
+    Stats s=stats();
+    uint64_t total=0;
+    out << "kind allocations frees live\n";
+    for (uint32_t kind=0;kind<kindCount;++kind) {
+      out << kindName(kind) << ' ' << s.allocations[kind] << ' ' << s.frees[kind] << ' ' << s.allocations[kind]-s.frees[kind] << '\n';
+      total+=s.allocations[kind];
+    }
+    out << "chunks " << s.chunks << " bytes " << s.chunks*chunkSize << " carved " << s.carved << " reused " << total-s.large-s.carved << " large " << s.large << '\n';
+  }
+};
+#endif
+
 // Visitor base class
 struct Visitor {
   virtual void visitPre(const std::string& name,const Ast&) {}
@@ -35,6 +373,14 @@ struct Visitor {
   virtual void visitPost(const std::string& name,const Collection&) {}
   virtual void visit(const std::string& name,const int64_t&) {}
   virtual void visit(const std::string& name,const std::string&) {}
+  virtual void visit(const std::string& name,const double&) {}
+  virtual void visit(const std::string& name,const bool& v) { visit(name,int64_t(v)); }
+  virtual void visit(const std::string& name,const int8_t& v) { visit(name,int64_t(v)); }
+  virtual void visit(const std::string& name,const int16_t& v) { visit(name,int64_t(v)); }
+  virtual void visit(const std::string& name,const int32_t& v) { visit(name,int64_t(v)); }
+  virtual void visit(const std::string& name,const uint8_t& v) { visit(name,int64_t(v)); }
+  virtual void visit(const std::string& name,const uint16_t& v) { visit(name,int64_t(v)); }
+  virtual void visit(const std::string& name,const uint32_t& v) { visit(name,int64_t(v)); }
   virtual void collectionPre() {}
   virtual void collectionPost() {}
   virtual void emptyElement() {}
@@ -46,62 +392,130 @@ struct Visitor {
   virtual void visitPost(const std::string& name,const Attribute&) {}
   virtual void visitPre(const std::string& name,const Node&) {}
   virtual void visitPost(const std::string& name,const Node&) {}
+  virtual void visitPre(const std::string& name,const Enum&) {}
+  virtual void visitPost(const std::string& name,const Enum&) {}
+  virtual void visitPre(const std::string& name,const Sum&) {}
+  virtual void visitPost(const std::string& name,const Sum&) {}
   virtual void visitPre(const std::string& name,const Nodes&) {}
   virtual void visitPost(const std::string& name,const Nodes&) {}
 };
 
+// Rewrites a tree bottom-up in place: children are transformed before their parent, and
+// a hook returning a node replaces the visited one in its parent (nullptr keeps it)
+struct Transformer {
+  virtual ~Transformer() {}
+  virtual std::unique_ptr<Ast> transform(Id& node) { return nullptr; }
+  virtual std::unique_ptr<Ast> transform(Type& node) { return nullptr; }
+  virtual std::unique_ptr<Ast> transform(Attribute& node) { return nullptr; }
+  virtual std::unique_ptr<Ast> transform(Node& node) { return nullptr; }
+  virtual std::unique_ptr<Ast> transform(Enum& node) { return nullptr; }
+  virtual std::unique_ptr<Ast> transform(Sum& node) { return nullptr; }
+  virtual std::unique_ptr<Ast> transform(Nodes& node) { return nullptr; }
+};
+
 struct Id : public Ast {
   string id;
 
+  Id() : id() { astConstructed(*this); }
   Id(const string& id) {
     this->id=id;
+    astConstructed(*this);
   }
 
   void accept(const std::string& name,Visitor& visitor) {
-    visitor.visitPre(name,*this);
+    ASTGEN_VISIT(Id,true,visitor.visitPre(name,*this));
     visitor.visit("id",this->id);
-    visitor.visitPost(name,*this);
+    ASTGEN_VISIT(Id,false,visitor.visitPost(name,*this));
   }
+
+  Ast* cloneAst(const CloneOptions& options) const;
+  void copyInto(Id& copy,const CloneOptions& options) const;
+  std::unique_ptr<Id> clone(const CloneOptions& options=CloneOptions()) const { return std::unique_ptr<Id>(static_cast<Id*>(cloneAst(options))); }
+  std::unique_ptr<Ast> transformWith(Transformer& transformer);
+  bool walk(Walker& walker) const;
+  void print(std::ostream& out) const;
+#ifdef ASTGEN_ARENA
+  Ast* relocate(AstArena& arena);
+  void relocateChildren(AstArena& arena);
+  void relocated(Id& from);
+#endif
+#ifdef ASTGEN_POOL
+  static void* operator new(std::size_t size) { return AstPool::allocate(KindId<Id>::value,size); }
+  static void operator delete(void* p,std::size_t size) { AstPool::release(KindId<Id>::value,p,size); }
+#ifdef ASTGEN_ARENA
+  static void* operator new(std::size_t size,AstArena& arena) { return Ast::operator new(size,arena); }
+  static void operator delete(void*,AstArena&) {}
+#endif
+#endif
 };
 
 std::ostream& operator<< (std::ostream& out,const Id& node) {
   out << "(Id: ";
-  out << node.id;
-  out << ")";
+  printValue(out,node.id);
+  return out << ")";
 }
+inline void Id::print(std::ostream& out) const { out << *this; }
 
 
 struct Type : public Ast {
   std::unique_ptr<Id> id;
   bool collection;
+  bool inlined;
 
-  Type(std::unique_ptr<Ast>&& id,const bool& collection) {
+  Type() : collection(),inlined() { astConstructed(*this); }
+  Type(std::unique_ptr<Ast>&& id,const bool& collection,const bool& inlined) {
     this->id=std::unique_ptr<Id>(tryCast<Id*>(id.get()));
     id.release();
 
     this->collection=collection;
+    this->inlined=inlined;
+    astConstructed(*this);
   }
 
   void accept(const std::string& name,Visitor& visitor) {
-    visitor.visitPre(name,*this);
+    ASTGEN_VISIT(Type,true,visitor.visitPre(name,*this));
     if (this->id.get()) this->id->accept("id",visitor);
     else visitor.emptyElement();    visitor.visit("collection",this->collection);
-    visitor.visitPost(name,*this);
+    visitor.visit("inlined",this->inlined);
+    ASTGEN_VISIT(Type,false,visitor.visitPost(name,*this));
   }
+
+  Ast* cloneAst(const CloneOptions& options) const;
+  void copyInto(Type& copy,const CloneOptions& options) const;
+  std::unique_ptr<Type> clone(const CloneOptions& options=CloneOptions()) const { return std::unique_ptr<Type>(static_cast<Type*>(cloneAst(options))); }
+  std::unique_ptr<Ast> transformWith(Transformer& transformer);
+  bool walk(Walker& walker) const;
+  void print(std::ostream& out) const;
+#ifdef ASTGEN_ARENA
+  Ast* relocate(AstArena& arena);
+  void relocateChildren(AstArena& arena);
+  void relocated(Type& from);
+#endif
+#ifdef ASTGEN_POOL
+  static void* operator new(std::size_t size) { return AstPool::allocate(KindId<Type>::value,size); }
+  static void operator delete(void* p,std::size_t size) { AstPool::release(KindId<Type>::value,p,size); }
+#ifdef ASTGEN_ARENA
+  static void* operator new(std::size_t size,AstArena& arena) { return Ast::operator new(size,arena); }
+  static void operator delete(void*,AstArena&) {}
+#endif
+#endif
 };
 
 std::ostream& operator<< (std::ostream& out,const Type& node) {
   out << "(Type: ";
-  out << *node.id;
-  out << node.collection;
-  out << ")";
+  if (node.id) out << *node.id; else out << "()";
+  out << ' '; printValue(out,node.collection);
+  out << ' '; printValue(out,node.inlined);
+  return out << ")";
 }
+inline void Type::print(std::ostream& out) const { out << *this; }
 
 
 struct Attribute : public Ast {
   std::unique_ptr<Id> name;
   std::unique_ptr<Type> type;
 
+  Attribute() { astConstructed(*this); }
   Attribute(std::unique_ptr<Ast>&& name,std::unique_ptr<Ast>&& type) {
     this->name=std::unique_ptr<Id>(tryCast<Id*>(name.get()));
     name.release();
@@ -109,29 +523,53 @@ struct Attribute : public Ast {
     this->type=std::unique_ptr<Type>(tryCast<Type*>(type.get()));
     type.release();
 
+    astConstructed(*this);
   }
 
   void accept(const std::string& name,Visitor& visitor) {
-    visitor.visitPre(name,*this);
+    ASTGEN_VISIT(Attribute,true,visitor.visitPre(name,*this));
     if (this->name.get()) this->name->accept("name",visitor);
     else visitor.emptyElement();    if (this->type.get()) this->type->accept("type",visitor);
-    else visitor.emptyElement();    visitor.visitPost(name,*this);
+    else visitor.emptyElement();    ASTGEN_VISIT(Attribute,false,visitor.visitPost(name,*this));
   }
+
+  Ast* cloneAst(const CloneOptions& options) const;
+  void copyInto(Attribute& copy,const CloneOptions& options) const;
+  std::unique_ptr<Attribute> clone(const CloneOptions& options=CloneOptions()) const { return std::unique_ptr<Attribute>(static_cast<Attribute*>(cloneAst(options))); }
+  std::unique_ptr<Ast> transformWith(Transformer& transformer);
+  bool walk(Walker& walker) const;
+  void print(std::ostream& out) const;
+#ifdef ASTGEN_ARENA
+  Ast* relocate(AstArena& arena);
+  void relocateChildren(AstArena& arena);
+  void relocated(Attribute& from);
+#endif
+#ifdef ASTGEN_POOL
+  static void* operator new(std::size_t size) { return AstPool::allocate(KindId<Attribute>::value,size); }
+  static void operator delete(void* p,std::size_t size) { AstPool::release(KindId<Attribute>::value,p,size); }
+#ifdef ASTGEN_ARENA
+  static void* operator new(std::size_t size,AstArena& arena) { return Ast::operator new(size,arena); }
+  static void operator delete(void*,AstArena&) {}
+#endif
+#endif
 };
 
 std::ostream& operator<< (std::ostream& out,const Attribute& node) {
   out << "(Attribute: ";
-  out << *node.name;
-  out << *node.type;
-  out << ")";
+  if (node.name) out << *node.name; else out << "()";
+  if (node.type) out << *node.type; else out << "()";
+  return out << ")";
 }
+inline void Attribute::print(std::ostream& out) const { out << *this; }
 
 
 struct Node : public Ast {
   std::unique_ptr<Id> name;
   std::vector<std::unique_ptr<Attribute>> attributes;
+  std::vector<std::unique_ptr<Attribute>> derived;
 
-  Node(std::unique_ptr<Ast>&& name,std::unique_ptr<Ast>&& attributes) {
+  Node() { astConstructed(*this); }
+  Node(std::unique_ptr<Ast>&& name,std::unique_ptr<Ast>&& attributes,std::unique_ptr<Ast>&& derived) {
     this->name=std::unique_ptr<Id>(tryCast<Id*>(name.get()));
     name.release();
 
@@ -140,64 +578,1878 @@ struct Node : public Ast {
       this->attributes.push_back(std::unique_ptr<Attribute>(tryCast<Attribute*>(item.get())));
       item.release();
     }
+    if (derived.get())
+    for (auto& item : tryCast<Collection*>(derived.get())->get()) {
+      this->derived.push_back(std::unique_ptr<Attribute>(tryCast<Attribute*>(item.get())));
+      item.release();
+    }
+    astConstructed(*this);
   }
 
   void accept(const std::string& name,Visitor& visitor) {
-    visitor.visitPre(name,*this);
+    ASTGEN_VISIT(Node,true,visitor.visitPre(name,*this));
     if (this->name.get()) this->name->accept("name",visitor);
     else visitor.emptyElement();    visitor.collectionPre();
     for (auto& item : attributes) {
       if (item.get()) item->accept("attributes",visitor);
     }
     visitor.collectionPost();
-    visitor.visitPost(name,*this);
+    visitor.collectionPre();
+    for (auto& item : derived) {
+      if (item.get()) item->accept("derived",visitor);
+    }
+    visitor.collectionPost();
+    ASTGEN_VISIT(Node,false,visitor.visitPost(name,*this));
   }
+
+  Ast* cloneAst(const CloneOptions& options) const;
+  void copyInto(Node& copy,const CloneOptions& options) const;
+  std::unique_ptr<Node> clone(const CloneOptions& options=CloneOptions()) const { return std::unique_ptr<Node>(static_cast<Node*>(cloneAst(options))); }
+  std::unique_ptr<Ast> transformWith(Transformer& transformer);
+  bool walk(Walker& walker) const;
+  void print(std::ostream& out) const;
+#ifdef ASTGEN_ARENA
+  Ast* relocate(AstArena& arena);
+  void relocateChildren(AstArena& arena);
+  void relocated(Node& from);
+#endif
+#ifdef ASTGEN_POOL
+  static void* operator new(std::size_t size) { return AstPool::allocate(KindId<Node>::value,size); }
+  static void operator delete(void* p,std::size_t size) { AstPool::release(KindId<Node>::value,p,size); }
+#ifdef ASTGEN_ARENA
+  static void* operator new(std::size_t size,AstArena& arena) { return Ast::operator new(size,arena); }
+  static void operator delete(void*,AstArena&) {}
+#endif
+#endif
 };
 
 std::ostream& operator<< (std::ostream& out,const Node& node) {
   out << "(Node: ";
-  out << *node.name;
+  if (node.name) out << *node.name; else out << "()";
   out << "[";
   for (auto& item : node.attributes) {
-    out << *item;
+    if (item) out << *item; else out << "()";
+  }
+  out << "]";
+  out << "[";
+  for (auto& item : node.derived) {
+    if (item) out << *item; else out << "()";
+  }
+  out << "]";
+  return out << ")";
+}
+inline void Node::print(std::ostream& out) const { out << *this; }
+
+
+struct Enum : public Ast {
+  std::unique_ptr<Id> name;
+  std::vector<std::unique_ptr<Id>> values;
+
+  Enum() { astConstructed(*this); }
+  Enum(std::unique_ptr<Ast>&& name,std::unique_ptr<Ast>&& values) {
+    this->name=std::unique_ptr<Id>(tryCast<Id*>(name.get()));
+    name.release();
+
+    if (values.get())
+    for (auto& item : tryCast<Collection*>(values.get())->get()) {
+      this->values.push_back(std::unique_ptr<Id>(tryCast<Id*>(item.get())));
+      item.release();
+    }
+    astConstructed(*this);
+  }
+
+  void accept(const std::string& name,Visitor& visitor) {
+    ASTGEN_VISIT(Enum,true,visitor.visitPre(name,*this));
+    if (this->name.get()) this->name->accept("name",visitor);
+    else visitor.emptyElement();    visitor.collectionPre();
+    for (auto& item : values) {
+      if (item.get()) item->accept("values",visitor);
+    }
+    visitor.collectionPost();
+    ASTGEN_VISIT(Enum,false,visitor.visitPost(name,*this));
+  }
+
+  Ast* cloneAst(const CloneOptions& options) const;
+  void copyInto(Enum& copy,const CloneOptions& options) const;
+  std::unique_ptr<Enum> clone(const CloneOptions& options=CloneOptions()) const { return std::unique_ptr<Enum>(static_cast<Enum*>(cloneAst(options))); }
+  std::unique_ptr<Ast> transformWith(Transformer& transformer);
+  bool walk(Walker& walker) const;
+  void print(std::ostream& out) const;
+#ifdef ASTGEN_ARENA
+  Ast* relocate(AstArena& arena);
+  void relocateChildren(AstArena& arena);
+  void relocated(Enum& from);
+#endif
+#ifdef ASTGEN_POOL
+  static void* operator new(std::size_t size) { return AstPool::allocate(KindId<Enum>::value,size); }
+  static void operator delete(void* p,std::size_t size) { AstPool::release(KindId<Enum>::value,p,size); }
+#ifdef ASTGEN_ARENA
+  static void* operator new(std::size_t size,AstArena& arena) { return Ast::operator new(size,arena); }
+  static void operator delete(void*,AstArena&) {}
+#endif
+#endif
+};
+
+std::ostream& operator<< (std::ostream& out,const Enum& node) {
+  out << "(Enum: ";
+  if (node.name) out << *node.name; else out << "()";
+  out << "[";
+  for (auto& item : node.values) {
+    if (item) out << *item; else out << "()";
   }
   out << "]";
-  out << ")";
+  return out << ")";
 }
+inline void Enum::print(std::ostream& out) const { out << *this; }
+
+
+struct Sum : public Ast {
+  std::unique_ptr<Id> name;
+  std::vector<std::unique_ptr<Id>> alternatives;
+
+  Sum() { astConstructed(*this); }
+  Sum(std::unique_ptr<Ast>&& name,std::unique_ptr<Ast>&& alternatives) {
+    this->name=std::unique_ptr<Id>(tryCast<Id*>(name.get()));
+    name.release();
+
+    if (alternatives.get())
+    for (auto& item : tryCast<Collection*>(alternatives.get())->get()) {
+      this->alternatives.push_back(std::unique_ptr<Id>(tryCast<Id*>(item.get())));
+      item.release();
+    }
+    astConstructed(*this);
+  }
+
+  void accept(const std::string& name,Visitor& visitor) {
+    ASTGEN_VISIT(Sum,true,visitor.visitPre(name,*this));
+    if (this->name.get()) this->name->accept("name",visitor);
+    else visitor.emptyElement();    visitor.collectionPre();
+    for (auto& item : alternatives) {
+      if (item.get()) item->accept("alternatives",visitor);
+    }
+    visitor.collectionPost();
+    ASTGEN_VISIT(Sum,false,visitor.visitPost(name,*this));
+  }
+
+  Ast* cloneAst(const CloneOptions& options) const;
+  void copyInto(Sum& copy,const CloneOptions& options) const;
+  std::unique_ptr<Sum> clone(const CloneOptions& options=CloneOptions()) const { return std::unique_ptr<Sum>(static_cast<Sum*>(cloneAst(options))); }
+  std::unique_ptr<Ast> transformWith(Transformer& transformer);
+  bool walk(Walker& walker) const;
+  void print(std::ostream& out) const;
+#ifdef ASTGEN_ARENA
+  Ast* relocate(AstArena& arena);
+  void relocateChildren(AstArena& arena);
+  void relocated(Sum& from);
+#endif
+#ifdef ASTGEN_POOL
+  static void* operator new(std::size_t size) { return AstPool::allocate(KindId<Sum>::value,size); }
+  static void operator delete(void* p,std::size_t size) { AstPool::release(KindId<Sum>::value,p,size); }
+#ifdef ASTGEN_ARENA
+  static void* operator new(std::size_t size,AstArena& arena) { return Ast::operator new(size,arena); }
+  static void operator delete(void*,AstArena&) {}
+#endif
+#endif
+};
+
+std::ostream& operator<< (std::ostream& out,const Sum& node) {
+  out << "(Sum: ";
+  if (node.name) out << *node.name; else out << "()";
+  out << "[";
+  for (auto& item : node.alternatives) {
+    if (item) out << *item; else out << "()";
+  }
+  out << "]";
+  return out << ")";
+}
+inline void Sum::print(std::ostream& out) const { out << *this; }
 
 
 struct Nodes : public Ast {
   std::vector<std::unique_ptr<Node>> nodes;
+  std::vector<std::unique_ptr<Enum>> enums;
+  std::vector<std::unique_ptr<Sum>> sums;
 
-  Nodes(std::unique_ptr<Ast>&& nodes) {
+  Nodes() { astConstructed(*this); }
+  Nodes(std::unique_ptr<Ast>&& nodes,std::unique_ptr<Ast>&& enums,std::unique_ptr<Ast>&& sums) {
     if (nodes.get())
     for (auto& item : tryCast<Collection*>(nodes.get())->get()) {
       this->nodes.push_back(std::unique_ptr<Node>(tryCast<Node*>(item.get())));
       item.release();
     }
+    if (enums.get())
+    for (auto& item : tryCast<Collection*>(enums.get())->get()) {
+      this->enums.push_back(std::unique_ptr<Enum>(tryCast<Enum*>(item.get())));
+      item.release();
+    }
+    if (sums.get())
+    for (auto& item : tryCast<Collection*>(sums.get())->get()) {
+      this->sums.push_back(std::unique_ptr<Sum>(tryCast<Sum*>(item.get())));
+      item.release();
+    }
+    astConstructed(*this);
   }
 
   void accept(const std::string& name,Visitor& visitor) {
-    visitor.visitPre(name,*this);
+    ASTGEN_VISIT(Nodes,true,visitor.visitPre(name,*this));
     visitor.collectionPre();
     for (auto& item : nodes) {
       if (item.get()) item->accept("nodes",visitor);
     }
     visitor.collectionPost();
-    visitor.visitPost(name,*this);
+    visitor.collectionPre();
+    for (auto& item : enums) {
+      if (item.get()) item->accept("enums",visitor);
+    }
+    visitor.collectionPost();
+    visitor.collectionPre();
+    for (auto& item : sums) {
+      if (item.get()) item->accept("sums",visitor);
+    }
+    visitor.collectionPost();
+    ASTGEN_VISIT(Nodes,false,visitor.visitPost(name,*this));
   }
+
+  Ast* cloneAst(const CloneOptions& options) const;
+  void copyInto(Nodes& copy,const CloneOptions& options) const;
+  std::unique_ptr<Nodes> clone(const CloneOptions& options=CloneOptions()) const { return std::unique_ptr<Nodes>(static_cast<Nodes*>(cloneAst(options))); }
+  std::unique_ptr<Ast> transformWith(Transformer& transformer);
+  bool walk(Walker& walker) const;
+  void print(std::ostream& out) const;
+#ifdef ASTGEN_ARENA
+  Ast* relocate(AstArena& arena);
+  void relocateChildren(AstArena& arena);
+  void relocated(Nodes& from);
+#endif
+#ifdef ASTGEN_POOL
+  static void* operator new(std::size_t size) { return AstPool::allocate(KindId<Nodes>::value,size); }
+  static void operator delete(void* p,std::size_t size) { AstPool::release(KindId<Nodes>::value,p,size); }
+#ifdef ASTGEN_ARENA
+  static void* operator new(std::size_t size,AstArena& arena) { return Ast::operator new(size,arena); }
+  static void operator delete(void*,AstArena&) {}
+#endif
+#endif
 };
 
 std::ostream& operator<< (std::ostream& out,const Nodes& node) {
   out << "(Nodes: ";
   out << "[";
   for (auto& item : node.nodes) {
-    out << *item;
+    if (item) out << *item; else out << "()";
+  }
+  out << "]";
+  out << "[";
+  for (auto& item : node.enums) {
+    if (item) out << *item; else out << "()";
+  }
+  out << "]";
+  out << "[";
+  for (auto& item : node.sums) {
+    if (item) out << *item; else out << "()";
   }
   out << "]";
-  out << ")";
+  return out << ")";
+}
+inline void Nodes::print(std::ostream& out) const { out << *this; }
+
+
+#ifdef ASTGEN_ARENA
+#include <mutex>
+
+// Bump allocator for cloned trees. Nodes in an arena are destroyed as usual, but their
+// memory is only released with the arena, which must outlive them.
+struct AstArena {
+  std::size_t blockSize;
+  std::vector<std::unique_ptr<char[]>> blocks;
+  char* pos;
+  char* end;
+  std::mutex mutex;
+  std::vector<std::unique_ptr<AstArena>> children;
+
+  explicit AstArena(std::size_t blockSize=1<<20) : blockSize(blockSize),pos(nullptr),end(nullptr) {}
+
+  // Makes the next allocations of up to bytes in total come from one block
+  void reserve(std::size_t bytes) {
+    if (std::size_t(end-pos)>=bytes) return;
+    if (bytes<blockSize) bytes=blockSize;
+    blocks.emplace_back(new char[bytes]);
+    pos=blocks.back().get(); end=pos+bytes;
+  }
+
+  void* allocate(std::size_t size) {
+    size=(size+15)&~std::size_t(15);
+    reserve(size);
+    void* p=pos; pos+=size;
+    return p;
+  }
+
+  // Arena bytes taken by a node of the given size, including its header
+  static std::size_t footprint(std::size_t size) { return (size+16+15)&~std::size_t(15); }
+
+  // An arena for another thread, released together with this one
+  AstArena& child() {
+    std::lock_guard<std::mutex> lock(mutex);
+    children.emplace_back(new AstArena(blockSize));
+    return *children.back();
+  }
+};
+
+// Every node is preceded by 16 bytes whose first one tells whether it lives in an arena
+inline void* Ast::operator new(std::size_t size) {
+  char* p=static_cast<char*>(::operator new(size+16));
+  p[0]=0;
+  return p+16;
+}
+inline void* Ast::operator new(std::size_t size,AstArena& arena) {
+  char* p=static_cast<char*>(arena.allocate(size+16));
+  p[0]=1;
+  return p+16;
+}
+inline void Ast::operator delete(void* p) {
+  if (p&&!static_cast<char*>(p)[-16]) ::operator delete(static_cast<char*>(p)-16);
+}
+inline void Ast::operator delete(void*,AstArena&) {}
+#endif
+
+#include <thread>
+
+template<class T> T* astNew(const CloneOptions& options) {
+#ifdef ASTGEN_ARENA
+  if (options.arena) return new (*options.arena) T();
+#endif
+  return new T();
+}
+
+template<class T> void astCloneItems(const std::vector<std::unique_ptr<T>>& from,std::vector<std::unique_ptr<T>>& to,const CloneOptions& options);
+
+inline Ast* Id::cloneAst(const CloneOptions& options) const {
+  auto copy=astNew<Id>(options);
+  copyInto(*copy,options);
+  return copy;
+}
+inline void Id::copyInto(Id& copy,const CloneOptions& options) const {
+  copy.line=line; copy.col=col;
+  copy.id=id;
+}
+
+inline Ast* Type::cloneAst(const CloneOptions& options) const {
+  auto copy=astNew<Type>(options);
+  copyInto(*copy,options);
+  return copy;
+}
+inline void Type::copyInto(Type& copy,const CloneOptions& options) const {
+  copy.line=line; copy.col=col;
+  if (id) copy.id.reset(static_cast<Id*>(id->cloneAst(options)));
+  copy.collection=collection;
+  copy.inlined=inlined;
+}
+
+inline Ast* Attribute::cloneAst(const CloneOptions& options) const {
+  auto copy=astNew<Attribute>(options);
+  copyInto(*copy,options);
+  return copy;
+}
+inline void Attribute::copyInto(Attribute& copy,const CloneOptions& options) const {
+  copy.line=line; copy.col=col;
+  if (name) copy.name.reset(static_cast<Id*>(name->cloneAst(options)));
+  if (type) copy.type.reset(static_cast<Type*>(type->cloneAst(options)));
+}
+
+inline Ast* Node::cloneAst(const CloneOptions& options) const {
+  auto copy=astNew<Node>(options);
+  copyInto(*copy,options);
+  return copy;
+}
+inline void Node::copyInto(Node& copy,const CloneOptions& options) const {
+  copy.line=line; copy.col=col;
+  if (name) copy.name.reset(static_cast<Id*>(name->cloneAst(options)));
+  astCloneItems(attributes,copy.attributes,options);
+  astCloneItems(derived,copy.derived,options);
+}
+
+inline Ast* Enum::cloneAst(const CloneOptions& options) const {
+  auto copy=astNew<Enum>(options);
+  copyInto(*copy,options);
+  return copy;
+}
+inline void Enum::copyInto(Enum& copy,const CloneOptions& options) const {
+  copy.line=line; copy.col=col;
+  if (name) copy.name.reset(static_cast<Id*>(name->cloneAst(options)));
+  astCloneItems(values,copy.values,options);
+}
+
+inline Ast* Sum::cloneAst(const CloneOptions& options) const {
+  auto copy=astNew<Sum>(options);
+  copyInto(*copy,options);
+  return copy;
+}
+inline void Sum::copyInto(Sum& copy,const CloneOptions& options) const {
+  copy.line=line; copy.col=col;
+  if (name) copy.name.reset(static_cast<Id*>(name->cloneAst(options)));
+  astCloneItems(alternatives,copy.alternatives,options);
+}
+
+inline Ast* Nodes::cloneAst(const CloneOptions& options) const {
+  auto copy=astNew<Nodes>(options);
+  copyInto(*copy,options);
+  return copy;
+}
+inline void Nodes::copyInto(Nodes& copy,const CloneOptions& options) const {
+  copy.line=line; copy.col=col;
+  astCloneItems(nodes,copy.nodes,options);
+  astCloneItems(enums,copy.enums,options);
+  astCloneItems(sums,copy.sums,options);
+}
+
+// Transforms the node in slot and splices in its replacement, which must fit the slot.
+// Returns whether the slot was replaced.
+template<class T> bool transformTree(std::unique_ptr<T>& slot,Transformer& transformer) {
+  if (!slot) return false;
+  auto replacement=slot->transformWith(transformer);
+  if (!replacement) return false;
+  slot.reset(tryCast<T*>(replacement.release()));
+  return true;
+}
+
+inline std::unique_ptr<Ast> Id::transformWith(Transformer& transformer) {
+  return transformer.transform(*this);
+}
+
+inline std::unique_ptr<Ast> Type::transformWith(Transformer& transformer) {
+  transformTree(this->id,transformer);
+  return transformer.transform(*this);
+}
+
+inline std::unique_ptr<Ast> Attribute::transformWith(Transformer& transformer) {
+  transformTree(this->name,transformer);
+  transformTree(this->type,transformer);
+  return transformer.transform(*this);
+}
+
+inline std::unique_ptr<Ast> Node::transformWith(Transformer& transformer) {
+  transformTree(this->name,transformer);
+  for (auto& item : this->attributes) transformTree(item,transformer);
+  for (auto& item : this->derived) transformTree(item,transformer);
+  return transformer.transform(*this);
+}
+
+inline std::unique_ptr<Ast> Enum::transformWith(Transformer& transformer) {
+  transformTree(this->name,transformer);
+  for (auto& item : this->values) transformTree(item,transformer);
+  return transformer.transform(*this);
+}
+
+inline std::unique_ptr<Ast> Sum::transformWith(Transformer& transformer) {
+  transformTree(this->name,transformer);
+  for (auto& item : this->alternatives) transformTree(item,transformer);
+  return transformer.transform(*this);
 }
 
+inline std::unique_ptr<Ast> Nodes::transformWith(Transformer& transformer) {
+  for (auto& item : this->nodes) transformTree(item,transformer);
+  for (auto& item : this->enums) transformTree(item,transformer);
+  for (auto& item : this->sums) transformTree(item,transformer);
+  return transformer.transform(*this);
+}
+
+// What a Walker hook asks the traversal to do next
+enum class Walk : uint8_t { Continue, Skip, Abort };
+
+// Traversal that hooks can steer: Skip in visitPre leaves out the children, Abort stops
+// the walk at once. walk() returns false if it was aborted.
+struct Walker {
+  virtual ~Walker() {}
+  virtual Walk visitPre(const Id& node) { return Walk::Continue; }
+  virtual Walk visitPost(const Id& node) { return Walk::Continue; }
+  virtual Walk visitPre(const Type& node) { return Walk::Continue; }
+  virtual Walk visitPost(const Type& node) { return Walk::Continue; }
+  virtual Walk visitPre(const Attribute& node) { return Walk::Continue; }
+  virtual Walk visitPost(const Attribute& node) { return Walk::Continue; }
+  virtual Walk visitPre(const Node& node) { return Walk::Continue; }
+  virtual Walk visitPost(const Node& node) { return Walk::Continue; }
+  virtual Walk visitPre(const Enum& node) { return Walk::Continue; }
+  virtual Walk visitPost(const Enum& node) { return Walk::Continue; }
+  virtual Walk visitPre(const Sum& node) { return Walk::Continue; }
+  virtual Walk visitPost(const Sum& node) { return Walk::Continue; }
+  virtual Walk visitPre(const Nodes& node) { return Walk::Continue; }
+  virtual Walk visitPost(const Nodes& node) { return Walk::Continue; }
+};
+
+inline bool Id::walk(Walker& walker) const {
+  Walk action=walker.visitPre(*this);
+  if (action==Walk::Abort) return false;
+  return walker.visitPost(*this)!=Walk::Abort;
+}
+
+inline bool Type::walk(Walker& walker) const {
+  Walk action=walker.visitPre(*this);
+  if (action==Walk::Abort) return false;
+  if (action==Walk::Continue) {
+    if (this->id&&!this->id->walk(walker)) return false;
+  }
+  return walker.visitPost(*this)!=Walk::Abort;
+}
+
+inline bool Attribute::walk(Walker& walker) const {
+  Walk action=walker.visitPre(*this);
+  if (action==Walk::Abort) return false;
+  if (action==Walk::Continue) {
+    if (this->name&&!this->name->walk(walker)) return false;
+    if (this->type&&!this->type->walk(walker)) return false;
+  }
+  return walker.visitPost(*this)!=Walk::Abort;
+}
+
+inline bool Node::walk(Walker& walker) const {
+  Walk action=walker.visitPre(*this);
+  if (action==Walk::Abort) return false;
+  if (action==Walk::Continue) {
+    if (this->name&&!this->name->walk(walker)) return false;
+    for (auto& item : this->attributes) if (item&&!item->walk(walker)) return false;
+    for (auto& item : this->derived) if (item&&!item->walk(walker)) return false;
+  }
+  return walker.visitPost(*this)!=Walk::Abort;
+}
+
+inline bool Enum::walk(Walker& walker) const {
+  Walk action=walker.visitPre(*this);
+  if (action==Walk::Abort) return false;
+  if (action==Walk::Continue) {
+    if (this->name&&!this->name->walk(walker)) return false;
+    for (auto& item : this->values) if (item&&!item->walk(walker)) return false;
+  }
+  return walker.visitPost(*this)!=Walk::Abort;
+}
+
+inline bool Sum::walk(Walker& walker) const {
+  Walk action=walker.visitPre(*this);
+  if (action==Walk::Abort) return false;
+  if (action==Walk::Continue) {
+    if (this->name&&!this->name->walk(walker)) return false;
+    for (auto& item : this->alternatives) if (item&&!item->walk(walker)) return false;
+  }
+  return walker.visitPost(*this)!=Walk::Abort;
+}
+
+inline bool Nodes::walk(Walker& walker) const {
+  Walk action=walker.visitPre(*this);
+  if (action==Walk::Abort) return false;
+  if (action==Walk::Continue) {
+    for (auto& item : this->nodes) if (item&&!item->walk(walker)) return false;
+    for (auto& item : this->enums) if (item&&!item->walk(walker)) return false;
+    for (auto& item : this->sums) if (item&&!item->walk(walker)) return false;
+  }
+  return walker.visitPost(*this)!=Walk::Abort;
+}
+
+#ifdef ASTGEN_ARENA
+// Moves the node in slot into the arena, after which its children follow it
+template<class T> void astRelocate(std::unique_ptr<T>& slot,AstArena& arena) {
+  if (!slot) return;
+  std::unique_ptr<T> old(std::move(slot));
+  slot.reset(static_cast<T*>(old->relocate(arena)));
+}
+
+inline Ast* Id::relocate(AstArena& arena) {
+  auto moved=new (arena) Id(std::move(*this));
+  moved->relocated(*this);
+  moved->relocateChildren(arena);
+  return moved;
+}
+inline void Id::relocated(Id& from) {
+  astMoved(from,*this);
+}
+inline void Id::relocateChildren(AstArena& arena) {
+}
+
+inline Ast* Type::relocate(AstArena& arena) {
+  auto moved=new (arena) Type(std::move(*this));
+  moved->relocated(*this);
+  moved->relocateChildren(arena);
+  return moved;
+}
+inline void Type::relocated(Type& from) {
+  astMoved(from,*this);
+}
+inline void Type::relocateChildren(AstArena& arena) {
+  astRelocate(this->id,arena);
+}
+
+inline Ast* Attribute::relocate(AstArena& arena) {
+  auto moved=new (arena) Attribute(std::move(*this));
+  moved->relocated(*this);
+  moved->relocateChildren(arena);
+  return moved;
+}
+inline void Attribute::relocated(Attribute& from) {
+  astMoved(from,*this);
+}
+inline void Attribute::relocateChildren(AstArena& arena) {
+  astRelocate(this->name,arena);
+  astRelocate(this->type,arena);
+}
+
+inline Ast* Node::relocate(AstArena& arena) {
+  auto moved=new (arena) Node(std::move(*this));
+  moved->relocated(*this);
+  moved->relocateChildren(arena);
+  return moved;
+}
+inline void Node::relocated(Node& from) {
+  astMoved(from,*this);
+}
+inline void Node::relocateChildren(AstArena& arena) {
+  astRelocate(this->name,arena);
+  for (auto& item : this->attributes) astRelocate(item,arena);
+  for (auto& item : this->derived) astRelocate(item,arena);
+}
+
+inline Ast* Enum::relocate(AstArena& arena) {
+  auto moved=new (arena) Enum(std::move(*this));
+  moved->relocated(*this);
+  moved->relocateChildren(arena);
+  return moved;
+}
+inline void Enum::relocated(Enum& from) {
+  astMoved(from,*this);
+}
+inline void Enum::relocateChildren(AstArena& arena) {
+  astRelocate(this->name,arena);
+  for (auto& item : this->values) astRelocate(item,arena);
+}
+
+inline Ast* Sum::relocate(AstArena& arena) {
+  auto moved=new (arena) Sum(std::move(*this));
+  moved->relocated(*this);
+  moved->relocateChildren(arena);
+  return moved;
+}
+inline void Sum::relocated(Sum& from) {
+  astMoved(from,*this);
+}
+inline void Sum::relocateChildren(AstArena& arena) {
+  astRelocate(this->name,arena);
+  for (auto& item : this->alternatives) astRelocate(item,arena);
+}
+
+inline Ast* Nodes::relocate(AstArena& arena) {
+  auto moved=new (arena) Nodes(std::move(*this));
+  moved->relocated(*this);
+  moved->relocateChildren(arena);
+  return moved;
+}
+inline void Nodes::relocated(Nodes& from) {
+  astMoved(from,*this);
+}
+inline void Nodes::relocateChildren(AstArena& arena) {
+  for (auto& item : this->nodes) astRelocate(item,arena);
+  for (auto& item : this->enums) astRelocate(item,arena);
+  for (auto& item : this->sums) astRelocate(item,arena);
+}
+
+// Arena bytes needed to hold a tree; inline children are counted on their own as well
+struct AstFootprint : public Walker {
+  std::size_t bytes;
+  AstFootprint() : bytes(0) {}
+  Walk visitPre(const Id&) { bytes+=AstArena::footprint(sizeof(Id)); return Walk::Continue; }
+  Walk visitPre(const Type&) { bytes+=AstArena::footprint(sizeof(Type)); return Walk::Continue; }
+  Walk visitPre(const Attribute&) { bytes+=AstArena::footprint(sizeof(Attribute)); return Walk::Continue; }
+  Walk visitPre(const Node&) { bytes+=AstArena::footprint(sizeof(Node)); return Walk::Continue; }
+  Walk visitPre(const Enum&) { bytes+=AstArena::footprint(sizeof(Enum)); return Walk::Continue; }
+  Walk visitPre(const Sum&) { bytes+=AstArena::footprint(sizeof(Sum)); return Walk::Continue; }
+  Walk visitPre(const Nodes&) { bytes+=AstArena::footprint(sizeof(Nodes)); return Walk::Continue; }
+};
+
+// Moves a tree into a single arena block in preorder, so that traversals read memory
+// sequentially. Returns the new root; the old nodes are freed. Collection fields keep
+// their item arrays on the heap.
+template<class T> std::unique_ptr<T> compact(std::unique_ptr<T> root,AstArena& arena) {
+  if (!root) return root;
+  AstFootprint footprint;
+  root->walk(footprint);
+  arena.reserve(footprint.bytes);
+  astRelocate(root,arena);
+  return root;
+}
+#endif
+
+// Schema reachability: CanReach<From,Target> holds if a From subtree can contain a Target
+static constexpr uint64_t reachBits[kindCount][1]={
+  {0},
+  {0x1},
+  {0x3},
+  {0x7},
+  {0x1},
+  {0x1},
+  {0x3f},
+};
+constexpr bool canReach(uint32_t from,uint32_t target) { return (reachBits[from][target/64]>>(target%64))&1; }
+template<class From,class Target> struct CanReach : std::integral_constant<bool,std::is_same<From,Target>::value||canReach(KindId<From>::value,KindId<Target>::value)> {};
+template<class Target> struct CanReach<Ast,Target> : std::true_type {};
+
+template<class Target,class T,class F> typename std::enable_if<std::is_same<T,Target>::value>::type forEachMatch(const T& node,F& f) { f(node); }
+template<class Target,class T,class F> typename std::enable_if<!std::is_same<T,Target>::value>::type forEachMatch(const T&,F&) {}
+template<class Target,class F> void forEachIn(const Id& node,F& f);
+template<class Target,class F> void forEachIn(const Type& node,F& f);
+template<class Target,class F> void forEachIn(const Attribute& node,F& f);
+template<class Target,class F> void forEachIn(const Node& node,F& f);
+template<class Target,class F> void forEachIn(const Enum& node,F& f);
+template<class Target,class F> void forEachIn(const Sum& node,F& f);
+template<class Target,class F> void forEachIn(const Nodes& node,F& f);
+
+template<class Target,class F> void forEachInAst(const Ast& node,F& f) {
+  if (CanReach<Id,Target>::value) if (auto child=dynamic_cast<const Id*>(&node)) { forEachIn<Target>(*child,f); return; }
+  if (CanReach<Type,Target>::value) if (auto child=dynamic_cast<const Type*>(&node)) { forEachIn<Target>(*child,f); return; }
+  if (CanReach<Attribute,Target>::value) if (auto child=dynamic_cast<const Attribute*>(&node)) { forEachIn<Target>(*child,f); return; }
+  if (CanReach<Node,Target>::value) if (auto child=dynamic_cast<const Node*>(&node)) { forEachIn<Target>(*child,f); return; }
+  if (CanReach<Enum,Target>::value) if (auto child=dynamic_cast<const Enum*>(&node)) { forEachIn<Target>(*child,f); return; }
+  if (CanReach<Sum,Target>::value) if (auto child=dynamic_cast<const Sum*>(&node)) { forEachIn<Target>(*child,f); return; }
+  if (CanReach<Nodes,Target>::value) if (auto child=dynamic_cast<const Nodes*>(&node)) { forEachIn<Target>(*child,f); return; }
+}
+
+template<class Target,class F> struct ForEachAlternative {
+  F& f;
+  template<class T> void operator()(const T& node) const { forEachIn<Target>(node,f); }
+};
+
+template<class Target,class F> void forEachIn(const Id& node,F& f) {
+  forEachMatch<Target>(node,f);
+}
+
+template<class Target,class F> void forEachIn(const Type& node,F& f) {
+  forEachMatch<Target>(node,f);
+  if (CanReach<Id,Target>::value&&node.id) { auto& item=node.id; forEachIn<Target>(*item,f); }
+}
+
+template<class Target,class F> void forEachIn(const Attribute& node,F& f) {
+  forEachMatch<Target>(node,f);
+  if (CanReach<Id,Target>::value&&node.name) { auto& item=node.name; forEachIn<Target>(*item,f); }
+  if (CanReach<Type,Target>::value&&node.type) { auto& item=node.type; forEachIn<Target>(*item,f); }
+}
+
+template<class Target,class F> void forEachIn(const Node& node,F& f) {
+  forEachMatch<Target>(node,f);
+  if (CanReach<Id,Target>::value&&node.name) { auto& item=node.name; forEachIn<Target>(*item,f); }
+  if (CanReach<Attribute,Target>::value) for (auto& item : node.attributes) if (item) forEachIn<Target>(*item,f);
+  if (CanReach<Attribute,Target>::value) for (auto& item : node.derived) if (item) forEachIn<Target>(*item,f);
+}
+
+template<class Target,class F> void forEachIn(const Enum& node,F& f) {
+  forEachMatch<Target>(node,f);
+  if (CanReach<Id,Target>::value&&node.name) { auto& item=node.name; forEachIn<Target>(*item,f); }
+  if (CanReach<Id,Target>::value) for (auto& item : node.values) if (item) forEachIn<Target>(*item,f);
+}
+
+template<class Target,class F> void forEachIn(const Sum& node,F& f) {
+  forEachMatch<Target>(node,f);
+  if (CanReach<Id,Target>::value&&node.name) { auto& item=node.name; forEachIn<Target>(*item,f); }
+  if (CanReach<Id,Target>::value) for (auto& item : node.alternatives) if (item) forEachIn<Target>(*item,f);
+}
+
+template<class Target,class F> void forEachIn(const Nodes& node,F& f) {
+  forEachMatch<Target>(node,f);
+  if (CanReach<Node,Target>::value) for (auto& item : node.nodes) if (item) forEachIn<Target>(*item,f);
+  if (CanReach<Enum,Target>::value) for (auto& item : node.enums) if (item) forEachIn<Target>(*item,f);
+  if (CanReach<Sum,Target>::value) for (auto& item : node.sums) if (item) forEachIn<Target>(*item,f);
+}
+
+// Calls f for every Target node below root, skipping fields whose type can not contain a Target
+template<class Target,class Root,class F> void forEach(const Root& root,F f) { forEachIn<Target>(root,f); }
+
+#ifdef ASTGEN_INDEX
+#include <unordered_map>
+
+// Keys for AstIndex::find
+template<class T> struct IndexKey;
+template<> struct IndexKey<Id> { static const std::string* of(const Id& node) { return &node.id; } };
+template<> struct IndexKey<Type> { static const std::string* of(const Type& node) { return node.id?&node.id->id:nullptr; } };
+template<> struct IndexKey<Attribute> { static const std::string* of(const Attribute& node) { return node.name?&node.name->id:nullptr; } };
+template<> struct IndexKey<Node> { static const std::string* of(const Node& node) { return node.name?&node.name->id:nullptr; } };
+template<> struct IndexKey<Enum> { static const std::string* of(const Enum& node) { return node.name?&node.name->id:nullptr; } };
+template<> struct IndexKey<Sum> { static const std::string* of(const Sum& node) { return node.name?&node.name->id:nullptr; } };
+
+template<class T>
+struct AstIndexRange {
+  struct iterator {
+    Ast* const* pos;
+    T& operator*() const { return *static_cast<T*>(*pos); }
+    iterator& operator++() { ++pos; return *this; }
+    bool operator!=(const iterator& other) const { return pos!=other.pos; }
+  };
+  Ast* const* first;
+  Ast* const* last;
+  iterator begin() const { return iterator{first}; }
+  iterator end() const { return iterator{last}; }
+  std::size_t size() const { return last-first; }
+  T& operator[](std::size_t i) const { return *static_cast<T*>(first[i]); }
+};
+
+// Registers every node constructed while it is active (see Scope) in a contiguous list
+// per kind. Nodes unregister when destroyed; order within a kind is not preserved.
+struct AstIndex {
+  std::vector<Ast*> kinds[kindSlots];
+  std::unordered_multimap<std::string,Ast*> names[kindSlots];
+  bool namesValid[kindSlots];
+
+  AstIndex() { for (auto& valid : namesValid) valid=false; }
+  ~AstIndex() { for (auto& kind : kinds) for (auto node : kind) node->indexSlot.index=nullptr; }
+
+  static AstIndex*& active() { static thread_local AstIndex* index=nullptr; return index; }
+
+  struct Scope {
+    AstIndex* previous;
+    Scope(AstIndex& index) : previous(active()) { active()=&index; }
+    ~Scope() { active()=previous; }
+  };
+
+  template<class T> void add(T& node) {
+    auto& list=kinds[KindId<T>::value];
+    node.indexSlot.index=this; node.indexSlot.kind=KindId<T>::value; node.indexSlot.slot=list.size();
+    list.push_back(&node);
+    namesValid[KindId<T>::value]=false;
+  }
+
+  void remove(Ast& node) {
+    auto& list=kinds[node.indexSlot.kind];
+    list[node.indexSlot.slot]=list.back();
+    list[node.indexSlot.slot]->indexSlot.slot=node.indexSlot.slot;
+    list.pop_back();
+    namesValid[node.indexSlot.kind]=false;
+    node.indexSlot.index=nullptr;
+  }
+
+  // Takes over the registrations of other, e.g. an index filled on another thread
+  void merge(AstIndex& other) {
+    for (uint32_t kind=0;kind<kindSlots;++kind) {
+      for (auto node : other.kinds[kind]) {
+        node->indexSlot.index=this; node->indexSlot.slot=kinds[kind].size();
+        kinds[kind].push_back(node);
+        namesValid[kind]=false;
+      }
+      other.kinds[kind].clear();
+      other.namesValid[kind]=false;
+    }
+  }
+
+  // Hands the registration of from, which is about to be destroyed, to to
+  void transfer(Ast& from,Ast& to) {
+    to.indexSlot.index=this; to.indexSlot.kind=from.indexSlot.kind; to.indexSlot.slot=from.indexSlot.slot;
+    kinds[to.indexSlot.kind][to.indexSlot.slot]=&to;
+    namesValid[to.indexSlot.kind]=false;
+    from.indexSlot.index=nullptr;
+  }
+
+  template<class T> AstIndexRange<T> all() const {
+    auto& list=kinds[KindId<T>::value];
+    return AstIndexRange<T>{list.data(),list.data()+list.size()};
+  }
+
+  // Finds a node by its IndexKey; the name table of a kind is built on first use
+  template<class T> T* find(const std::string& key) {
+    auto& table=names[KindId<T>::value];
+    if (!namesValid[KindId<T>::value]) {
+      table.clear();
+      for (auto& node : all<T>()) if (auto name=IndexKey<T>::of(node)) table.insert(std::make_pair(*name,&node));
+      namesValid[KindId<T>::value]=true;
+    }
+    auto found=table.find(key);
+    return found==table.end()?nullptr:static_cast<T*>(found->second);
+  }
+};
+#endif
+
+#ifdef ASTGEN_IDS
+#include <atomic>
+
+// Hands out node ids, counting from 0 for each kind. Nodes take their id from the active
+// space (see Scope) when constructed, or from a process-wide one.
+struct AstIdSpace {
+  std::atomic<uint32_t> next[kindSlots];
+
+  AstIdSpace() { for (auto& count : next) count=0; }
+  AstIdSpace(const AstIdSpace&)=delete;
+
+  static AstIdSpace*& active() { static thread_local AstIdSpace* space=nullptr; return space; }
+  static AstIdSpace& current() { static AstIdSpace global; return active()?*active():global; }
+
+  struct Scope {
+    AstIdSpace* previous;
+    Scope(AstIdSpace& space) : previous(active()) { active()=&space; }
+    ~Scope() { active()=previous; }
+  };
+
+  uint32_t allocate(uint32_t kind) { return next[kind].fetch_add(1,std::memory_order_relaxed); }
+  template<class T> uint32_t count() const { return next[KindId<T>::value]; }
+};
+
+// Per-node data for one node kind, stored in a vector indexed by node id
+template<class Kind,class T>
+struct SideTable {
+  std::vector<T> values;
+
+  SideTable() {}
+  explicit SideTable(const AstIdSpace& space) : values(space.count<Kind>()) {}
+
+  T& operator[](const Kind& node) {
+    if (node.nodeId>=values.size()) values.resize(node.nodeId+1);
+    return values[node.nodeId];
+  }
+  const T* find(const Kind& node) const { return node.nodeId<values.size()?&values[node.nodeId]:nullptr; }
+};
+#endif
+
+#include <exception>
+
+template<class T> void astCloneItems(const std::vector<std::unique_ptr<T>>& from,std::vector<std::unique_ptr<T>>& to,const CloneOptions& options) {
+  to.resize(from.size());
+  std::size_t threads=options.threads?options.threads:std::thread::hardware_concurrency();
+  if (threads>from.size()) threads=from.size();
+  if (!options.parallelThreshold||from.size()<options.parallelThreshold||threads<2) {
+    for (std::size_t i=0;i<from.size();++i) if (from[i]) to[i].reset(static_cast<T*>(from[i]->cloneAst(options)));
+    return;
+  }
+  // Each thread copies a slice, into its own arena and without nested parallelism. As on
+  // the calling thread, the copies take ids (ASTGEN_IDS) from the caller's AstIdSpace and
+  // join the caller's AstIndex (ASTGEN_INDEX), through an index per thread merged after
+  // the join. The first exception a thread throws is rethrown after the join.
+  std::size_t slice=(from.size()+threads-1)/threads;
+#ifdef ASTGEN_IDS
+  AstIdSpace* space=AstIdSpace::active();
+#endif
+#ifdef ASTGEN_INDEX
+  AstIndex* index=AstIndex::active();
+  std::vector<AstIndex> indexes(index?threads:0);
+#endif
+  std::vector<std::exception_ptr> errors(threads);
+  std::vector<std::thread> workers;
+  for (std::size_t begin=0,worker=0;begin<from.size();begin+=slice,++worker) {
+    CloneOptions local=options;
+    local.parallelThreshold=0;
+#ifdef ASTGEN_ARENA
+    if (options.arena) local.arena=&options.arena->child();
+#endif
+#ifdef ASTGEN_INDEX
+    AstIndex* workerIndex=index?&indexes[worker]:nullptr;
+#endif
+    std::size_t end=begin+slice<from.size()?begin+slice:from.size();
+    std::exception_ptr& error=errors[worker];
+    workers.emplace_back([=,&from,&to,&error]() {
+#ifdef ASTGEN_IDS
+      AstIdSpace::active()=space;
+#endif
+#ifdef ASTGEN_INDEX
+      AstIndex::active()=workerIndex;
+#endif
+      try {
+        for (std::size_t i=begin;i<end;++i) if (from[i]) to[i].reset(static_cast<T*>(from[i]->cloneAst(local)));
+      } catch (...) {
+        error=std::current_exception();
+      }
+    });
+  }
+  for (auto& worker : workers) worker.join();
+#ifdef ASTGEN_INDEX
+  for (auto& workerIndex : indexes) index->merge(workerIndex);
+#endif
+  for (auto& error : errors) if (error) std::rethrow_exception(error);
+}
+
+#ifdef ASTGEN_STATS
+// Inline children were counted when constructed, but their bytes are part of their owner's
+inline void astStatsEmbedded(const Id&) { }
+inline void astStatsEmbedded(const Type&) { }
+inline void astStatsEmbedded(const Attribute&) { }
+inline void astStatsEmbedded(const Node&) { }
+inline void astStatsEmbedded(const Enum&) { }
+inline void astStatsEmbedded(const Sum&) { }
+inline void astStatsEmbedded(const Nodes&) { }
+#endif
+
+// Nodes constructed on a thread while an AstHooksOff is alive there get no id, and are
+// neither indexed nor counted
+struct AstHooksOff {
+  static bool& active() { static thread_local bool off=false; return off; }
+  bool previous;
+  AstHooksOff() : previous(active()) { active()=true; }
+  ~AstHooksOff() { active()=previous; }
+};
+
+// Construction and destruction hooks
+template<class T> void astConstructed(T& node) {
+#if defined(ASTGEN_IDS)||defined(ASTGEN_INDEX)||defined(ASTGEN_STATS)
+  if (AstHooksOff::active()) return;
+#endif
+#ifdef ASTGEN_IDS
+  node.nodeId=AstIdSpace::current().allocate(KindId<T>::value);
+#endif
+#ifdef ASTGEN_INDEX
+  if (AstIndex::active()) AstIndex::active()->add(node);
+#endif
+#ifdef ASTGEN_STATS
+  node.statsKind.value=KindId<T>::value;
+  AstStats::add(AstStats::get().constructed[KindId<T>::value],1);
+  AstStats::add(AstStats::get().bytes[KindId<T>::value],sizeof(T));
+  astStatsEmbedded(node);
+#endif
+}
+
+inline void astDestroyed(Ast& node) {
+#ifdef ASTGEN_INDEX
+  if (node.indexSlot.index) node.indexSlot.index->remove(node);
+#endif
+#ifdef ASTGEN_STATS
+  if (node.statsKind.value<kindCount) AstStats::add(AstStats::get().destroyed[node.statsKind.value],1);
+#endif
+}
+
+// Called when to is move-constructed from from, which is then destroyed
+inline void astMoved(Ast& from,Ast& to) {
+#ifdef ASTGEN_INDEX
+  if (from.indexSlot.index) from.indexSlot.index->transfer(from,to);
+#endif
+#ifdef ASTGEN_STATS
+  to.statsKind.value=from.statsKind.value;
+  from.statsKind.value=~0u;
+#endif
+}
+
+inline void astCast(bool ok) {
+#ifdef ASTGEN_STATS
+  AstStats::add(AstStats::get().casts,1);
+  AstStats::add(AstStats::get().castFailures,!ok);
+#endif
+}
+
+#include <cstdlib>
+#include <cstring>
+#include <limits>
+#include <stdexcept>
+
+// Rebuilds trees from operator<< dumps in one forward pass. Every token is decided by its
+// first character, so the reader never backtracks; malformed input throws std::runtime_error.
+//   AstReader reader(text);
+//   std::unique_ptr<Program> program=reader.read<Program>();
+struct AstReader {
+  const char* begin;
+  const char* pos;
+  const char* end;
+  AstReader(const char* begin,const char* end) : begin(begin),pos(begin),end(end) {}
+  explicit AstReader(const std::string& text) : AstReader(text.data(),text.data()+text.size()) {}
+  explicit AstReader(const char* text) : AstReader(text,text+strlen(text)) {}
+  // Whether only whitespace is left
+  bool done() { skip(); return pos==end; }
+
+  // Reads any node; () reads as a missing child
+  std::unique_ptr<Ast> read() {
+    expect('(');
+    if (peek(')')) { ++pos; return nullptr; }
+    size_t length;
+    const char* name=readName(length);
+    expect(':');
+    switch (length) {
+      case 2:
+        if (!memcmp(name,"Id",2)) return readId();
+        break;
+      case 3:
+        if (!memcmp(name,"Sum",3)) return readSum();
+        break;
+      case 4:
+        if (!memcmp(name,"Type",4)) return readType();
+        if (!memcmp(name,"Node",4)) return readNode();
+        if (!memcmp(name,"Enum",4)) return readEnum();
+        break;
+      case 5:
+        if (!memcmp(name,"Nodes",5)) return readNodes();
+        break;
+      case 9:
+        if (!memcmp(name,"Attribute",9)) return readAttribute();
+        break;
+    }
+    pos=name;
+    fail("node name");
+  }
+  template<class T> std::unique_ptr<T> read() {
+    std::unique_ptr<Ast> node=read();
+    T* t=dynamic_cast<T*>(node.get());
+    if (node&&!t) fail("a node of the requested type");
+    node.release();
+    return std::unique_ptr<T>(t);
+  }
+
+  // Nodes whose opening "(Name:" has been read
+  std::unique_ptr<Id> readId() { std::unique_ptr<Id> node(new Id()); fill(*node); return node; }
+  std::unique_ptr<Type> readType() { std::unique_ptr<Type> node(new Type()); fill(*node); return node; }
+  std::unique_ptr<Attribute> readAttribute() { std::unique_ptr<Attribute> node(new Attribute()); fill(*node); return node; }
+  std::unique_ptr<Node> readNode() { std::unique_ptr<Node> node(new Node()); fill(*node); return node; }
+  std::unique_ptr<Enum> readEnum() { std::unique_ptr<Enum> node(new Enum()); fill(*node); return node; }
+  std::unique_ptr<Sum> readSum() { std::unique_ptr<Sum> node(new Sum()); fill(*node); return node; }
+  std::unique_ptr<Nodes> readNodes() { std::unique_ptr<Nodes> node(new Nodes()); fill(*node); return node; }
+  void fill(Id& node) {
+    readScalar(node.id);
+    expect(')');
+  }
+  void fill(Type& node) {
+    node.id=read<Id>();
+    readScalar(node.collection);
+    readScalar(node.inlined);
+    expect(')');
+  }
+  void fill(Attribute& node) {
+    node.name=read<Id>();
+    node.type=read<Type>();
+    expect(')');
+  }
+  void fill(Node& node) {
+    node.name=read<Id>();
+    expect('[');
+    while (!peek(']')) node.attributes.push_back(read<Attribute>());
+    ++pos;
+    expect('[');
+    while (!peek(']')) node.derived.push_back(read<Attribute>());
+    ++pos;
+    expect(')');
+  }
+  void fill(Enum& node) {
+    node.name=read<Id>();
+    expect('[');
+    while (!peek(']')) node.values.push_back(read<Id>());
+    ++pos;
+    expect(')');
+  }
+  void fill(Sum& node) {
+    node.name=read<Id>();
+    expect('[');
+    while (!peek(']')) node.alternatives.push_back(read<Id>());
+    ++pos;
+    expect(')');
+  }
+  void fill(Nodes& node) {
+    expect('[');
+    while (!peek(']')) node.nodes.push_back(read<Node>());
+    ++pos;
+    expect('[');
+    while (!peek(']')) node.enums.push_back(read<Enum>());
+    ++pos;
+    expect('[');
+    while (!peek(']')) node.sums.push_back(read<Sum>());
+    ++pos;
+    expect(')');
+  }
+
+  void readScalar(int64_t& value) { value=readInteger<int64_t>(); }
+  void readScalar(int8_t& value) { value=readInteger<int8_t>(); }
+  void readScalar(int16_t& value) { value=readInteger<int16_t>(); }
+  void readScalar(int32_t& value) { value=readInteger<int32_t>(); }
+  void readScalar(uint8_t& value) { value=readInteger<uint8_t>(); }
+  void readScalar(uint16_t& value) { value=readInteger<uint16_t>(); }
+  void readScalar(uint32_t& value) { value=readInteger<uint32_t>(); }
+  void readScalar(bool& value) { value=readInteger<int64_t>()!=0; }
+  void readScalar(double& value) {
+    skip();
+    char text[40];
+    size_t length=0;
+    while (pos<end&&length<sizeof(text)-1&&(isalnum(uint8_t(*pos))||*pos=='-'||*pos=='+'||*pos=='.')) text[length++]=*pos++;
+    text[length]=0;
+    char* stop;
+    value=strtod(text,&stop);
+    if (length==0||*stop) { pos-=length; fail("number"); }
+  }
+  void readScalar(std::string& value) {
+    expect('"');
+    value.clear();
+    const char* run=pos;
+    for (;;) {
+      if (pos==end) fail("closing quote");
+      if (*pos=='"') break;
+      if (*pos++!='\\') continue;
+      value.append(run,pos-1);
+      if (pos==end) fail("escaped character");
+      value+=*pos=='n'?'\n':*pos;
+      run=++pos;
+    }
+    value.append(run,pos++);
+  }
+
+  // A decimal integer, which must fit in T
+  template<class T> T readInteger() {
+    skip();
+    const char* start=pos;
+    bool negative=pos<end&&*pos=='-';
+    pos+=negative;
+    if (pos==end||*pos<'0'||*pos>'9') fail("integer");
+    uint64_t limit=negative?0-uint64_t(std::numeric_limits<T>::min()):uint64_t(std::numeric_limits<T>::max());
+    uint64_t value=0;
+    while (pos<end&&*pos>='0'&&*pos<='9') {
+      uint64_t digit=uint64_t(*pos++-'0');
+      if (value>limit/10||(value==limit/10&&digit>limit%10)) { pos=start; fail("integer in range"); }
+      value=value*10+digit;
+    }
+    return T(negative?0-value:value);
+  }
+  const char* readName(size_t& length) {
+    skip();
+    const char* name=pos;
+    while (pos<end&&(isalnum(uint8_t(*pos))||*pos=='_')) ++pos;
+    length=pos-name;
+    if (!length) fail("name");
+    return name;
+  }
+  // Opening of an inline child, whose type is known
+  void header(const char* name,size_t length) {
+    expect('(');
+    skip();
+    if (size_t(end-pos)<length||memcmp(pos,name,length)) fail(name);
+    pos+=length;
+    expect(':');
+  }
+  void skip() { while (pos<end&&(*pos==' '||*pos=='\n'||*pos=='\t'||*pos=='\r')) ++pos; }
+  bool peek(char c) { skip(); return pos<end&&*pos==c; }
+  void expect(char c) { if (!peek(c)) fail(std::string("'")+c+"'"); ++pos; }
+  [[noreturn]] void fail(const std::string& expected) {
+    throw std::runtime_error("AST dump: expected "+expected+" at offset "+std::to_string(pos-begin));
+  }
+};
+
+#include <algorithm>
+
+// Streaming event encoding, one event per Visitor callback. A node's scalar fields follow
+// its BeginNode event, so a reader can pass visitPre a node with its scalars set. Integers
+// are zigzag varints, doubles 8 bytes little-endian, strings a varint length and the bytes.
+enum class AstEvent : uint8_t { BeginNode=1, EndNode, Scalar, BeginCollection, EndCollection, Empty };
+
+// Writes trees as events while they are visited, flushing every 64KB
+//   AstEventWriter writer(std::cout); writer.write(*program);
+struct AstEventWriter : Visitor {
+  std::ostream& out;
+  std::string buffer;
+  explicit AstEventWriter(std::ostream& out) : out(out) { buffer.reserve(1<<16); }
+  ~AstEventWriter() { flush(); }
+  void write(Ast& node) { node.accept("",*this); }
+  void flush() { out.write(buffer.data(),buffer.size()); buffer.clear(); }
+
+  void visitPre(const std::string&,const Id& node) {
+    event(AstEvent::BeginNode);
+    varint(KindId<Id>::value);
+    scalar(node.id);
+  }
+  void visitPost(const std::string&,const Id&) { event(AstEvent::EndNode); }
+  void visitPre(const std::string&,const Type& node) {
+    event(AstEvent::BeginNode);
+    varint(KindId<Type>::value);
+    scalar(node.collection);
+    scalar(node.inlined);
+  }
+  void visitPost(const std::string&,const Type&) { event(AstEvent::EndNode); }
+  void visitPre(const std::string&,const Attribute& node) {
+    event(AstEvent::BeginNode);
+    varint(KindId<Attribute>::value);
+  }
+  void visitPost(const std::string&,const Attribute&) { event(AstEvent::EndNode); }
+  void visitPre(const std::string&,const Node& node) {
+    event(AstEvent::BeginNode);
+    varint(KindId<Node>::value);
+  }
+  void visitPost(const std::string&,const Node&) { event(AstEvent::EndNode); }
+  void visitPre(const std::string&,const Enum& node) {
+    event(AstEvent::BeginNode);
+    varint(KindId<Enum>::value);
+  }
+  void visitPost(const std::string&,const Enum&) { event(AstEvent::EndNode); }
+  void visitPre(const std::string&,const Sum& node) {
+    event(AstEvent::BeginNode);
+    varint(KindId<Sum>::value);
+  }
+  void visitPost(const std::string&,const Sum&) { event(AstEvent::EndNode); }
+  void visitPre(const std::string&,const Nodes& node) {
+    event(AstEvent::BeginNode);
+    varint(KindId<Nodes>::value);
+  }
+  void visitPost(const std::string&,const Nodes&) { event(AstEvent::EndNode); }
+  void collectionPre() { event(AstEvent::BeginCollection); }
+  void collectionPost() { event(AstEvent::EndCollection); }
+  void emptyElement() { event(AstEvent::Empty); }
+
+  void event(AstEvent event) {
+    if (buffer.size()>=1<<16) flush();
+    buffer+=char(event);
+  }
+  void varint(uint64_t value) {
+    for (;value>=128;value>>=7) buffer+=char(value|128);
+    buffer+=char(value);
+  }
+  void scalar(int64_t value) { event(AstEvent::Scalar); varint((uint64_t(value)<<1)^uint64_t(value>>63)); }
+  void scalar(double value) {
+    event(AstEvent::Scalar);
+    uint64_t bits;
+    memcpy(&bits,&value,8);
+    for (int byte=0;byte<8;++byte) buffer+=char(bits>>(byte*8));
+  }
+  void scalar(const std::string& value) { event(AstEvent::Scalar); varint(value.size()); buffer+=value; }
+  void scalar(int8_t value) { scalar(int64_t(value)); }
+  void scalar(int16_t value) { scalar(int64_t(value)); }
+  void scalar(int32_t value) { scalar(int64_t(value)); }
+  void scalar(uint8_t value) { scalar(int64_t(value)); }
+  void scalar(uint16_t value) { scalar(int64_t(value)); }
+  void scalar(uint32_t value) { scalar(int64_t(value)); }
+  void scalar(bool value) { scalar(int64_t(value)); }
+};
+
+// Reads the events of one tree after another from a stream, keeping only 64KB of input.
+// replay() drives a Visitor in the order accept() would; the nodes it passes to visitPre
+// and visitPost carry their scalar fields but no children, so memory stays proportional
+// to the depth of the tree. These stand-ins are reused and made with AstHooksOff, so ids,
+// AstIndex and AstStats never see them. read() builds the tree instead. Both throw
+// std::runtime_error on malformed input.
+//   AstEventReader reader(std::cin); while (reader.replay(visitor)) {}
+struct AstEventReader {
+  std::istream& in;
+  std::vector<char> buffer;
+  size_t pos,size;
+  uint64_t offset; // of the buffer in the stream
+  std::vector<std::unique_ptr<Ast>> standIns[kindSlots]; // per kind, one per nesting level
+  size_t standInsUsed[kindSlots];
+  explicit AstEventReader(std::istream& in) : in(in),buffer(1<<16),pos(0),size(0),offset(0) { std::fill(standInsUsed,standInsUsed+kindSlots,0); }
+
+  // Replays the next tree, false at the end of the stream
+  bool replay(Visitor& visitor,const std::string& name="") {
+    if (pos==size&&!refill()) return false;
+    std::fill(standInsUsed,standInsUsed+kindSlots,0);
+    replayChild(name,visitor);
+    return true;
+  }
+  // Builds the next tree, nullptr at the end of the stream
+  std::unique_ptr<Ast> read() {
+    if (pos==size&&!refill()) return nullptr;
+    return build<Ast>();
+  }
+
+  void replayChild(const std::string& name,Visitor& visitor) {
+    AstEvent event=next();
+    if (event==AstEvent::Empty) { visitor.emptyElement(); return; }
+    if (event!=AstEvent::BeginNode) fail("a node");
+    switch (varint()) {
+      case KindId<Id>::value: replayId(name,visitor); return;
+      case KindId<Type>::value: replayType(name,visitor); return;
+      case KindId<Attribute>::value: replayAttribute(name,visitor); return;
+      case KindId<Node>::value: replayNode(name,visitor); return;
+      case KindId<Enum>::value: replayEnum(name,visitor); return;
+      case KindId<Sum>::value: replaySum(name,visitor); return;
+      case KindId<Nodes>::value: replayNodes(name,visitor); return;
+    }
+    fail("a node kind");
+  }
+  template<class T> T& acquireStandIn() {
+    auto& free=standIns[KindId<T>::value];
+    size_t& used=standInsUsed[KindId<T>::value];
+    if (used==free.size()) {
+      AstHooksOff off;
+      free.emplace_back(new T());
+    }
+    return static_cast<T&>(*free[used++]);
+  }
+  void replayId(const std::string& name,Visitor& visitor) {
+    Id& node=acquireStandIn<Id>();
+    scalars(node);
+    visitor.visitPre(name,node);
+    visitor.visit("id",node.id);
+    expect(AstEvent::EndNode);
+    visitor.visitPost(name,node);
+    --standInsUsed[KindId<Id>::value];
+  }
+  void replayType(const std::string& name,Visitor& visitor) {
+    Type& node=acquireStandIn<Type>();
+    scalars(node);
+    visitor.visitPre(name,node);
+    replayChild("id",visitor);
+    visitor.visit("collection",node.collection);
+    visitor.visit("inlined",node.inlined);
+    expect(AstEvent::EndNode);
+    visitor.visitPost(name,node);
+    --standInsUsed[KindId<Type>::value];
+  }
+  void replayAttribute(const std::string& name,Visitor& visitor) {
+    Attribute& node=acquireStandIn<Attribute>();
+    scalars(node);
+    visitor.visitPre(name,node);
+    replayChild("name",visitor);
+    replayChild("type",visitor);
+    expect(AstEvent::EndNode);
+    visitor.visitPost(name,node);
+    --standInsUsed[KindId<Attribute>::value];
+  }
+  void replayNode(const std::string& name,Visitor& visitor) {
+    Node& node=acquireStandIn<Node>();
+    scalars(node);
+    visitor.visitPre(name,node);
+    replayChild("name",visitor);
+    expect(AstEvent::BeginCollection);
+    visitor.collectionPre();
+    while (!at(AstEvent::EndCollection)) replayChild("attributes",visitor);
+    visitor.collectionPost();
+    expect(AstEvent::BeginCollection);
+    visitor.collectionPre();
+    while (!at(AstEvent::EndCollection)) replayChild("derived",visitor);
+    visitor.collectionPost();
+    expect(AstEvent::EndNode);
+    visitor.visitPost(name,node);
+    --standInsUsed[KindId<Node>::value];
+  }
+  void replayEnum(const std::string& name,Visitor& visitor) {
+    Enum& node=acquireStandIn<Enum>();
+    scalars(node);
+    visitor.visitPre(name,node);
+    replayChild("name",visitor);
+    expect(AstEvent::BeginCollection);
+    visitor.collectionPre();
+    while (!at(AstEvent::EndCollection)) replayChild("values",visitor);
+    visitor.collectionPost();
+    expect(AstEvent::EndNode);
+    visitor.visitPost(name,node);
+    --standInsUsed[KindId<Enum>::value];
+  }
+  void replaySum(const std::string& name,Visitor& visitor) {
+    Sum& node=acquireStandIn<Sum>();
+    scalars(node);
+    visitor.visitPre(name,node);
+    replayChild("name",visitor);
+    expect(AstEvent::BeginCollection);
+    visitor.collectionPre();
+    while (!at(AstEvent::EndCollection)) replayChild("alternatives",visitor);
+    visitor.collectionPost();
+    expect(AstEvent::EndNode);
+    visitor.visitPost(name,node);
+    --standInsUsed[KindId<Sum>::value];
+  }
+  void replayNodes(const std::string& name,Visitor& visitor) {
+    Nodes& node=acquireStandIn<Nodes>();
+    scalars(node);
+    visitor.visitPre(name,node);
+    expect(AstEvent::BeginCollection);
+    visitor.collectionPre();
+    while (!at(AstEvent::EndCollection)) replayChild("nodes",visitor);
+    visitor.collectionPost();
+    expect(AstEvent::BeginCollection);
+    visitor.collectionPre();
+    while (!at(AstEvent::EndCollection)) replayChild("enums",visitor);
+    visitor.collectionPost();
+    expect(AstEvent::BeginCollection);
+    visitor.collectionPre();
+    while (!at(AstEvent::EndCollection)) replayChild("sums",visitor);
+    visitor.collectionPost();
+    expect(AstEvent::EndNode);
+    visitor.visitPost(name,node);
+    --standInsUsed[KindId<Nodes>::value];
+  }
+
+  template<class T> std::unique_ptr<T> build() {
+    AstEvent event=next();
+    if (event==AstEvent::Empty) return nullptr;
+    if (event!=AstEvent::BeginNode) fail("a node");
+    std::unique_ptr<Ast> node;
+    switch (varint()) {
+      case KindId<Id>::value: { Id* created=new Id(); node.reset(created); fill(*created); break; }
+      case KindId<Type>::value: { Type* created=new Type(); node.reset(created); fill(*created); break; }
+      case KindId<Attribute>::value: { Attribute* created=new Attribute(); node.reset(created); fill(*created); break; }
+      case KindId<Node>::value: { Node* created=new Node(); node.reset(created); fill(*created); break; }
+      case KindId<Enum>::value: { Enum* created=new Enum(); node.reset(created); fill(*created); break; }
+      case KindId<Sum>::value: { Sum* created=new Sum(); node.reset(created); fill(*created); break; }
+      case KindId<Nodes>::value: { Nodes* created=new Nodes(); node.reset(created); fill(*created); break; }
+      default: fail("a node kind");
+    }
+    T* t=dynamic_cast<T*>(node.get());
+    if (!t) fail("a node of the requested type");
+    node.release();
+    return std::unique_ptr<T>(t);
+  }
+  void scalars(Id& node) {
+    scalar(node.id);
+  }
+  void fill(Id& node) {
+    scalars(node);
+    expect(AstEvent::EndNode);
+  }
+  void scalars(Type& node) {
+    scalar(node.collection);
+    scalar(node.inlined);
+  }
+  void fill(Type& node) {
+    scalars(node);
+    node.id=build<Id>();
+    expect(AstEvent::EndNode);
+  }
+  void scalars(Attribute& node) {
+  }
+  void fill(Attribute& node) {
+    scalars(node);
+    node.name=build<Id>();
+    node.type=build<Type>();
+    expect(AstEvent::EndNode);
+  }
+  void scalars(Node& node) {
+  }
+  void fill(Node& node) {
+    scalars(node);
+    node.name=build<Id>();
+    expect(AstEvent::BeginCollection);
+    while (!at(AstEvent::EndCollection)) node.attributes.push_back(build<Attribute>());
+    expect(AstEvent::BeginCollection);
+    while (!at(AstEvent::EndCollection)) node.derived.push_back(build<Attribute>());
+    expect(AstEvent::EndNode);
+  }
+  void scalars(Enum& node) {
+  }
+  void fill(Enum& node) {
+    scalars(node);
+    node.name=build<Id>();
+    expect(AstEvent::BeginCollection);
+    while (!at(AstEvent::EndCollection)) node.values.push_back(build<Id>());
+    expect(AstEvent::EndNode);
+  }
+  void scalars(Sum& node) {
+  }
+  void fill(Sum& node) {
+    scalars(node);
+    node.name=build<Id>();
+    expect(AstEvent::BeginCollection);
+    while (!at(AstEvent::EndCollection)) node.alternatives.push_back(build<Id>());
+    expect(AstEvent::EndNode);
+  }
+  void scalars(Nodes& node) {
+  }
+  void fill(Nodes& node) {
+    scalars(node);
+    expect(AstEvent::BeginCollection);
+    while (!at(AstEvent::EndCollection)) node.nodes.push_back(build<Node>());
+    expect(AstEvent::BeginCollection);
+    while (!at(AstEvent::EndCollection)) node.enums.push_back(build<Enum>());
+    expect(AstEvent::BeginCollection);
+    while (!at(AstEvent::EndCollection)) node.sums.push_back(build<Sum>());
+    expect(AstEvent::EndNode);
+  }
+
+  void scalar(int64_t& value) {
+    expect(AstEvent::Scalar);
+    uint64_t bits=varint();
+    value=int64_t(bits>>1)^-int64_t(bits&1);
+  }
+  void scalar(double& value) {
+    expect(AstEvent::Scalar);
+    uint64_t bits=0;
+    for (int byte=0;byte<8;++byte) bits|=uint64_t(uint8_t(next()))<<(byte*8);
+    memcpy(&value,&bits,8);
+  }
+  void scalar(std::string& value) {
+    expect(AstEvent::Scalar);
+    uint64_t length=varint();
+    value.clear();
+    while (length) {
+      if (pos==size&&!refill()) fail("more string bytes");
+      size_t chunk=std::min<uint64_t>(length,size-pos);
+      value.append(&buffer[pos],chunk);
+      pos+=chunk;
+      length-=chunk;
+    }
+  }
+  void scalar(int8_t& value) { int64_t wide; scalar(wide); value=int8_t(wide); }
+  void scalar(int16_t& value) { int64_t wide; scalar(wide); value=int16_t(wide); }
+  void scalar(int32_t& value) { int64_t wide; scalar(wide); value=int32_t(wide); }
+  void scalar(uint8_t& value) { int64_t wide; scalar(wide); value=uint8_t(wide); }
+  void scalar(uint16_t& value) { int64_t wide; scalar(wide); value=uint16_t(wide); }
+  void scalar(uint32_t& value) { int64_t wide; scalar(wide); value=uint32_t(wide); }
+  void scalar(bool& value) { int64_t wide; scalar(wide); value=wide!=0; }
+
+  bool refill() {
+    offset+=size;
+    pos=0;
+    in.read(buffer.data(),buffer.size());
+    size=in.gcount();
+    return size>0;
+  }
+  AstEvent next() {
+    if (pos==size&&!refill()) fail("more events");
+    return AstEvent(buffer[pos++]);
+  }
+  // Consumes the event if it comes next
+  bool at(AstEvent event) {
+    if (pos==size&&!refill()) fail("more events");
+    if (AstEvent(buffer[pos])!=event) return false;
+    ++pos;
+    return true;
+  }
+  void expect(AstEvent event) { if (next()!=event) { --pos; fail("event "+std::to_string(int(event))); } }
+  uint64_t varint() {
+    uint64_t value=0;
+    for (int shift=0;shift<64;shift+=7) {
+      uint8_t byte=uint8_t(next());
+      value|=uint64_t(byte&127)<<shift;
+      if (!(byte&128)) return value;
+    }
+    fail("a shorter varint");
+  }
+  [[noreturn]] void fail(const std::string& expected) {
+    throw std::runtime_error("AST events: expected "+expected+" at offset "+std::to_string(offset+pos));
+  }
+};
+
+#include <exception>
+
+// Builds trees on several threads. make() allocates from the builder's arena (ASTGEN_ARENA),
+// else from the heap or the thread's pool cache (ASTGEN_POOL). buildItems() hands each worker
+// its own builder, on a child arena, and its own slots of the collection, so subtrees are
+// stitched into the parent without locks and without copying a node.
+//   AstBuilder builder(&arena);
+//   auto program=builder.make<Program>();
+//   builder.buildItems(program->blocks,files.size(),[&](std::size_t i,AstBuilder& local) { return parse(files[i],local); });
+struct AstBuilder {
+  AstArena* arena;
+  std::size_t threads; // for buildItems, 0 for one per core
+  explicit AstBuilder(AstArena* arena=nullptr,std::size_t threads=0) : arena(arena),threads(threads) {}
+
+  template<class T,class... Args> std::unique_ptr<T> make(Args&&... args) {
+#ifdef ASTGEN_ARENA
+    if (arena) return std::unique_ptr<T>(new (*arena) T(std::forward<Args>(args)...));
+#endif
+    return std::unique_ptr<T>(new T(std::forward<Args>(args)...));
+  }
+
+  // Appends build(i,builder) for every i<count. Each thread builds one slice; its builder
+  // runs nested buildItems serially. Nodes take ids (ASTGEN_IDS) from the caller's AstIdSpace, but are not
+  // added to its AstIndex. With derived attributes, link() the owner of items afterwards.
+  // If build throws, items is restored and the first exception rethrown after the join.
+  template<class T,class Build> void buildItems(std::vector<std::unique_ptr<T>>& items,std::size_t count,Build build) {
+    std::size_t first=items.size();
+    items.resize(first+count);
+    std::size_t workers=threads?threads:std::thread::hardware_concurrency();
+    if (workers>count) workers=count;
+    if (workers<2) {
+      try {
+        for (std::size_t i=0;i<count;++i) items[first+i]=build(i,*this);
+      } catch (...) {
+        items.resize(first);
+        throw;
+      }
+      return;
+    }
+    std::size_t slice=(count+workers-1)/workers;
+#ifdef ASTGEN_IDS
+    AstIdSpace* space=AstIdSpace::active();
+#endif
+    std::vector<std::exception_ptr> errors(workers);
+    std::vector<std::thread> pool;
+    for (std::size_t begin=0,worker=0;begin<count;begin+=slice,++worker) {
+      AstBuilder local(nullptr,1);
+#ifdef ASTGEN_ARENA
+      if (arena) local.arena=&arena->child();
+#endif
+      std::size_t end=begin+slice<count?begin+slice:count;
+      std::exception_ptr& error=errors[worker];
+      pool.emplace_back([=,&items,&build,&error]() mutable {
+#ifdef ASTGEN_IDS
+        AstIdSpace::active()=space;
+#endif
+        try {
+          for (std::size_t i=begin;i<end;++i) items[first+i]=build(i,local);
+        } catch (...) {
+          error=std::current_exception();
+        }
+      });
+    }
+    for (auto& worker : pool) worker.join();
+    for (auto& error : errors) {
+      if (!error) continue;
+      items.resize(first);
+      std::rethrow_exception(error);
+    }
+  }
+};
+
+
+// Runs several visitors in a single traversal. Every event is forwarded to each
+// sub-visitor in order. A sub-visitor that declares the event's exact overload is called
+// through its own type, so declaring it final lets the compiler devirtualize the call;
+// events it does not declare go through Visitor.
+
+template<class V,class... A> auto astFanVisitPre(V& v,int,A&... args) -> decltype(static_cast<void (V::*)(A&...)>(&V::visitPre),void()) { v.visitPre(args...); }
+template<class V,class... A> void astFanVisitPre(V& v,long,A&... args) { static_cast<Visitor&>(v).visitPre(args...); }
+struct AstFanVisitPre { template<class V,class... A> void operator()(V& v,A&... args) const { astFanVisitPre(v,0,args...); } };
+
+template<class V,class... A> auto astFanVisitPost(V& v,int,A&... args) -> decltype(static_cast<void (V::*)(A&...)>(&V::visitPost),void()) { v.visitPost(args...); }
+template<class V,class... A> void astFanVisitPost(V& v,long,A&... args) { static_cast<Visitor&>(v).visitPost(args...); }
+struct AstFanVisitPost { template<class V,class... A> void operator()(V& v,A&... args) const { astFanVisitPost(v,0,args...); } };
+
+template<class V,class... A> auto astFanVisit(V& v,int,A&... args) -> decltype(static_cast<void (V::*)(A&...)>(&V::visit),void()) { v.visit(args...); }
+template<class V,class... A> void astFanVisit(V& v,long,A&... args) { static_cast<Visitor&>(v).visit(args...); }
+struct AstFanVisit { template<class V,class... A> void operator()(V& v,A&... args) const { astFanVisit(v,0,args...); } };
+
+template<class V,class... A> auto astFanCollectionPre(V& v,int,A&... args) -> decltype(static_cast<void (V::*)(A&...)>(&V::collectionPre),void()) { v.collectionPre(args...); }
+template<class V,class... A> void astFanCollectionPre(V& v,long,A&... args) { static_cast<Visitor&>(v).collectionPre(args...); }
+struct AstFanCollectionPre { template<class V,class... A> void operator()(V& v,A&... args) const { astFanCollectionPre(v,0,args...); } };
+
+template<class V,class... A> auto astFanCollectionPost(V& v,int,A&... args) -> decltype(static_cast<void (V::*)(A&...)>(&V::collectionPost),void()) { v.collectionPost(args...); }
+template<class V,class... A> void astFanCollectionPost(V& v,long,A&... args) { static_cast<Visitor&>(v).collectionPost(args...); }
+struct AstFanCollectionPost { template<class V,class... A> void operator()(V& v,A&... args) const { astFanCollectionPost(v,0,args...); } };
+
+template<class V,class... A> auto astFanEmptyElement(V& v,int,A&... args) -> decltype(static_cast<void (V::*)(A&...)>(&V::emptyElement),void()) { v.emptyElement(args...); }
+template<class V,class... A> void astFanEmptyElement(V& v,long,A&... args) { static_cast<Visitor&>(v).emptyElement(args...); }
+struct AstFanEmptyElement { template<class V,class... A> void operator()(V& v,A&... args) const { astFanEmptyElement(v,0,args...); } };
+
+
+template<class... V>
+struct FusedVisitor : public Visitor {
+  std::tuple<V&...> visitors;
+
+  FusedVisitor(V&... visitors) : visitors(visitors...) {}
+
+  template<class F,class... A> void fan(const F& f,A&... args) { fanFrom<0>(f,args...); }
+  template<std::size_t I,class F,class... A> typename std::enable_if<I==sizeof...(V)>::type fanFrom(const F&,A&...) {}
+  template<std::size_t I,class F,class... A> typename std::enable_if<(I<sizeof...(V))>::type fanFrom(const F& f,A&... args) {
+    f(std::get<I>(visitors),args...);
+    fanFrom<I+1>(f,args...);
+  }
+
+  void visitPre(const std::string& name,const Ast& node) { fan(AstFanVisitPre(),name,node); }
+  void visitPost(const std::string& name,const Ast& node) { fan(AstFanVisitPost(),name,node); }
+  void visitPre(const std::string& name,const Collection& node) { fan(AstFanVisitPre(),name,node); }
+  void visitPost(const std::string& name,const Collection& node) { fan(AstFanVisitPost(),name,node); }
+  void visitPre(const std::string& name,const Id& node) { fan(AstFanVisitPre(),name,node); }
+  void visitPost(const std::string& name,const Id& node) { fan(AstFanVisitPost(),name,node); }
+  void visitPre(const std::string& name,const Type& node) { fan(AstFanVisitPre(),name,node); }
+  void visitPost(const std::string& name,const Type& node) { fan(AstFanVisitPost(),name,node); }
+  void visitPre(const std::string& name,const Attribute& node) { fan(AstFanVisitPre(),name,node); }
+  void visitPost(const std::string& name,const Attribute& node) { fan(AstFanVisitPost(),name,node); }
+  void visitPre(const std::string& name,const Node& node) { fan(AstFanVisitPre(),name,node); }
+  void visitPost(const std::string& name,const Node& node) { fan(AstFanVisitPost(),name,node); }
+  void visitPre(const std::string& name,const Enum& node) { fan(AstFanVisitPre(),name,node); }
+  void visitPost(const std::string& name,const Enum& node) { fan(AstFanVisitPost(),name,node); }
+  void visitPre(const std::string& name,const Sum& node) { fan(AstFanVisitPre(),name,node); }
+  void visitPost(const std::string& name,const Sum& node) { fan(AstFanVisitPost(),name,node); }
+  void visitPre(const std::string& name,const Nodes& node) { fan(AstFanVisitPre(),name,node); }
+  void visitPost(const std::string& name,const Nodes& node) { fan(AstFanVisitPost(),name,node); }
+  void visit(const std::string& name,const int64_t& value) { fan(AstFanVisit(),name,value); }
+  void visit(const std::string& name,const std::string& value) { fan(AstFanVisit(),name,value); }
+  void visit(const std::string& name,const double& value) { fan(AstFanVisit(),name,value); }
+  void visit(const std::string& name,const bool& value) { fan(AstFanVisit(),name,value); }
+  void visit(const std::string& name,const int8_t& value) { fan(AstFanVisit(),name,value); }
+  void visit(const std::string& name,const int16_t& value) { fan(AstFanVisit(),name,value); }
+  void visit(const std::string& name,const int32_t& value) { fan(AstFanVisit(),name,value); }
+  void visit(const std::string& name,const uint8_t& value) { fan(AstFanVisit(),name,value); }
+  void visit(const std::string& name,const uint16_t& value) { fan(AstFanVisit(),name,value); }
+  void visit(const std::string& name,const uint32_t& value) { fan(AstFanVisit(),name,value); }
+  void collectionPre() { fan(AstFanCollectionPre()); }
+  void collectionPost() { fan(AstFanCollectionPost()); }
+  void emptyElement() { fan(AstFanEmptyElement()); }
+};
+
+template<class... V> FusedVisitor<V...> fuse(V&... visitors) { return FusedVisitor<V...>(visitors...); }
+
+// Compile-time reflection
+enum class FieldKind { Scalar, Child, Collection };
+
+template<class Owner,class Value,Value Owner::*Member,FieldKind Kind,class Child>
+struct Field {
+  typedef Owner owner_type;
+  typedef Value value_type;
+  typedef Child child_type;
+  static constexpr FieldKind kind=Kind;
+  static constexpr Value Owner::*member() { return Member; }
+  static const Value& get(const Owner& owner) { return owner.*Member; }
+  static Value& get(Owner& owner) { return owner.*Member; }
+};
+
+template<class T> struct Reflect;
+
+template<class T,class F,std::size_t I=0>
+typename std::enable_if<I==std::tuple_size<typename Reflect<T>::fields>::value>::type forEachField(const T&,F&) {}
+
+template<class T,class F,std::size_t I=0>
+typename std::enable_if<(I<std::tuple_size<typename Reflect<T>::fields>::value)>::type forEachField(const T& node,F& f) {
+  typedef typename std::tuple_element<I,typename Reflect<T>::fields>::type field;
+  f(field(),field::get(node));
+  forEachField<T,F,I+1>(node,f);
+}
+
+template<> struct Reflect<Id> {
+  static constexpr const char* name() { return "Id"; }
+  struct id_field : Field<Id,string,&Id::id,FieldKind::Scalar,void> {
+    static constexpr const char* name() { return "id"; }
+  };
+  typedef std::tuple<id_field> fields;
+};
+
+template<> struct Reflect<Type> {
+  static constexpr const char* name() { return "Type"; }
+  struct id_field : Field<Type,std::unique_ptr<Id>,&Type::id,FieldKind::Child,Id> {
+    static constexpr const char* name() { return "id"; }
+  };
+  struct collection_field : Field<Type,bool,&Type::collection,FieldKind::Scalar,void> {
+    static constexpr const char* name() { return "collection"; }
+  };
+  struct inlined_field : Field<Type,bool,&Type::inlined,FieldKind::Scalar,void> {
+    static constexpr const char* name() { return "inlined"; }
+  };
+  typedef std::tuple<id_field,collection_field,inlined_field> fields;
+};
+
+template<> struct Reflect<Attribute> {
+  static constexpr const char* name() { return "Attribute"; }
+  struct name_field : Field<Attribute,std::unique_ptr<Id>,&Attribute::name,FieldKind::Child,Id> {
+    static constexpr const char* name() { return "name"; }
+  };
+  struct type_field : Field<Attribute,std::unique_ptr<Type>,&Attribute::type,FieldKind::Child,Type> {
+    static constexpr const char* name() { return "type"; }
+  };
+  typedef std::tuple<name_field,type_field> fields;
+};
+
+template<> struct Reflect<Node> {
+  static constexpr const char* name() { return "Node"; }
+  struct name_field : Field<Node,std::unique_ptr<Id>,&Node::name,FieldKind::Child,Id> {
+    static constexpr const char* name() { return "name"; }
+  };
+  struct attributes_field : Field<Node,std::vector<std::unique_ptr<Attribute>>,&Node::attributes,FieldKind::Collection,Attribute> {
+    static constexpr const char* name() { return "attributes"; }
+  };
+  struct derived_field : Field<Node,std::vector<std::unique_ptr<Attribute>>,&Node::derived,FieldKind::Collection,Attribute> {
+    static constexpr const char* name() { return "derived"; }
+  };
+  typedef std::tuple<name_field,attributes_field,derived_field> fields;
+};
+
+template<> struct Reflect<Enum> {
+  static constexpr const char* name() { return "Enum"; }
+  struct name_field : Field<Enum,std::unique_ptr<Id>,&Enum::name,FieldKind::Child,Id> {
+    static constexpr const char* name() { return "name"; }
+  };
+  struct values_field : Field<Enum,std::vector<std::unique_ptr<Id>>,&Enum::values,FieldKind::Collection,Id> {
+    static constexpr const char* name() { return "values"; }
+  };
+  typedef std::tuple<name_field,values_field> fields;
+};
+
+template<> struct Reflect<Sum> {
+  static constexpr const char* name() { return "Sum"; }
+  struct name_field : Field<Sum,std::unique_ptr<Id>,&Sum::name,FieldKind::Child,Id> {
+    static constexpr const char* name() { return "name"; }
+  };
+  struct alternatives_field : Field<Sum,std::vector<std::unique_ptr<Id>>,&Sum::alternatives,FieldKind::Collection,Id> {
+    static constexpr const char* name() { return "alternatives"; }
+  };
+  typedef std::tuple<name_field,alternatives_field> fields;
+};
+
+template<> struct Reflect<Nodes> {
+  static constexpr const char* name() { return "Nodes"; }
+  struct nodes_field : Field<Nodes,std::vector<std::unique_ptr<Node>>,&Nodes::nodes,FieldKind::Collection,Node> {
+    static constexpr const char* name() { return "nodes"; }
+  };
+  struct enums_field : Field<Nodes,std::vector<std::unique_ptr<Enum>>,&Nodes::enums,FieldKind::Collection,Enum> {
+    static constexpr const char* name() { return "enums"; }
+  };
+  struct sums_field : Field<Nodes,std::vector<std::unique_ptr<Sum>>,&Nodes::sums,FieldKind::Collection,Sum> {
+    static constexpr const char* name() { return "sums"; }
+  };
+  typedef std::tuple<nodes_field,enums_field,sums_field> fields;
+};
 
 
 struct PrettyPrintVisitor : public Visitor {
@@ -285,6 +2537,32 @@ struct PrettyPrintVisitor : public Visitor {
     applyNl(); 
   }  
   
+  virtual void visitPre(const std::string& name,const Enum& n) { 
+    applyIndent(); 
+    std::cerr << "(" << "Enum " << name << "="; 
+    pushScope();
+  }
+  
+  virtual void visitPost(const std::string& name,const Enum& n) { 
+    applyIndent();
+    popScope();
+    std::cerr << ")"; 
+    applyNl(); 
+  }  
+  
+  virtual void visitPre(const std::string& name,const Sum& n) { 
+    applyIndent(); 
+    std::cerr << "(" << "Sum " << name << "="; 
+    pushScope();
+  }
+  
+  virtual void visitPost(const std::string& name,const Sum& n) { 
+    applyIndent();
+    popScope();
+    std::cerr << ")"; 
+    applyNl(); 
+  }  
+  
   virtual void visitPre(const std::string& name,const Nodes& n) { 
     applyIndent(); 
     std::cerr << "(" << "Nodes " << name << "="; 
@@ -300,6 +2578,7 @@ struct PrettyPrintVisitor : public Visitor {
   
   
   virtual void visit(const std::string& name,const int64_t& v) { std::cerr << "(" << name << "=" << "\"" << v << "\")"; }
+  virtual void visit(const std::string& name,const double& v) { std::cerr << "(" << name << "=" << "\"" << v << "\")"; }
   virtual void visit(const std::string& name,const std::string& v) { std::cerr << "(" << name << "=" << "\"" << v << "\")"; }
 };
 
@@ -312,10 +2591,12 @@ struct RubyAstVisitor : public Visitor {
 	std::string getDefinition() const {
 		return R"(
 			class Id < RenderStruct.new(:id); end
-class Type < RenderStruct.new(:id,:collection); end
+class Type < RenderStruct.new(:id,:collection,:inlined); end
 class Attribute < RenderStruct.new(:name,:type); end
-class Node < RenderStruct.new(:name,:attributes); end
-class Nodes < RenderStruct.new(:nodes); end
+class Node < RenderStruct.new(:name,:attributes,:derived); end
+class Enum < RenderStruct.new(:name,:values); end
+class Sum < RenderStruct.new(:name,:alternatives); end
+class Nodes < RenderStruct.new(:nodes,:enums,:sums); end
 
 		)";
 	}
@@ -339,7 +2620,7 @@ class Nodes < RenderStruct.new(:nodes); end
   }  
   
   void emptyElement() {
-	  std::cerr << "nil,";
+	  std::cerr << ",nil";
   }
   
   
@@ -359,7 +2640,7 @@ class Nodes < RenderStruct.new(:nodes); end
   }
   
   virtual void visitPost(const std::string& name,const Type& n) { 
-    std::cerr << ").line_col(0,0)";
+    std::cerr << ").line_col(1,0)";
 		doComma=true;
   }  
   
@@ -369,7 +2650,7 @@ class Nodes < RenderStruct.new(:nodes); end
   }
   
   virtual void visitPost(const std::string& name,const Attribute& n) { 
-    std::cerr << ").line_col(0,0)";
+    std::cerr << ").line_col(2,0)";
 		doComma=true;
   }  
   
@@ -379,7 +2660,27 @@ class Nodes < RenderStruct.new(:nodes); end
   }
   
   virtual void visitPost(const std::string& name,const Node& n) { 
-    std::cerr << ").line_col(0,0)";
+    std::cerr << ").line_col(3,0)";
+		doComma=true;
+  }  
+  
+  virtual void visitPre(const std::string& name,const Enum& n) { 
+		tryComma();
+    std::cerr << "Enum.new(";
+  }
+  
+  virtual void visitPost(const std::string& name,const Enum& n) { 
+    std::cerr << ").line_col(4,0)";
+		doComma=true;
+  }  
+  
+  virtual void visitPre(const std::string& name,const Sum& n) { 
+		tryComma();
+    std::cerr << "Sum.new(";
+  }
+  
+  virtual void visitPost(const std::string& name,const Sum& n) { 
+    std::cerr << ").line_col(5,0)";
 		doComma=true;
   }  
   
@@ -389,12 +2690,13 @@ class Nodes < RenderStruct.new(:nodes); end
   }
   
   virtual void visitPost(const std::string& name,const Nodes& n) { 
-    std::cerr << ").line_col(0,0)";
+    std::cerr << ").line_col(6,0)";
 		doComma=true;
   }  
   
   
   virtual void visit(const std::string& name,const int64_t& v) { tryComma(); std::cerr << v; }
+  virtual void visit(const std::string& name,const double& v) { tryComma(); std::cerr << v; }
   virtual void visit(const std::string& name,const std::string& v) { tryComma(); std::cerr << "\"" << v << "\""; }
 };
 
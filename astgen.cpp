@@ -8,15 +8,22 @@
 #include <unordered_map>
 #include <stack>
 struct GREG;
-#define YYRULECOUNT 9
+#define YYRULECOUNT 11
 
+#include <chrono>
+#include <cstdint>
 #include <cstdio>
 #include <iostream>
 #include <ostream>
 #include <memory>
 #include <vector>
 #include <string>
+#include <tuple>
+#include <map>
+#include <set>
 #include <ctemplate/template.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 template<typename T, typename ...Args>
 std::unique_ptr<T> make_unique( Args&& ...args )
@@ -32,39 +39,391 @@ auto& out = cout;
 #define YYSTYPE std::unique_ptr<Ast>
 #define YY_CTYPE Collection
 #define YY_CTYPE_DEFINITION() ;
+// Read the schema in blocks rather than a character at a time, so runs can be scanned at once
+#define YY_INPUT(buf,result,max_size,D,G) { result=fread(buf,1,max_size,stdin); }
+
+// Builds a node at the position of its name, an Id at the position of its text
+template<class T,class... Args> YYSTYPE located(YYSTYPE& name,Args&&... args) {
+  int64_t line=name->line,col=name->col;
+  YYSTYPE node=make_unique<T>(std::move(name),std::forward<Args>(args)...);
+  node->line=line; node->col=col;
+  return node;
+}
+
+// Command line options
+struct Options {
+  bool values; // --values: value-semantic nodes instead of unique_ptr trees
+  bool persistent; // --persistent: immutable shared nodes with path-copying updaters
+  bool timing; // --timing: report parse and generation time on stderr
+  Options() : values(false),persistent(false),timing(false) {}
+} options;
+
+// Value mode: attributes that would make a by-value cycle and are stored in a Box instead
+static std::set<const Attribute*> boxedAttributes;
+
+// Names of the enums declared in the schema
+static std::set<std::string> enumTypes;
+
+// Sum types declared in the schema, and the sum each alternative belongs to
+static std::map<std::string,Sum*> sumTypes;
+static std::map<std::string,Sum*> sumOf;
+
+// Whether any node declares derived attributes ('=> (...)'); nodes then know their parent
+static bool derivedAttributes;
+static std::map<std::string,const Node*> nodeTypes;
+
+// Derived attributes that every alternative of a sum declares with the same type
+static std::vector<const Attribute*> sharedDerived(const Sum& sum) {
+  std::vector<const Attribute*> shared;
+  for (auto& d : nodeTypes[sum.alternatives.front()->id]->derived) {
+    bool everywhere=true;
+    for (auto& alt : sum.alternatives) {
+      bool found=false;
+      for (auto& other : nodeTypes[alt->id]->derived) {
+        found|=other->name->id==d->name->id&&other->type->id->id==d->type->id->id;
+      }
+      everywhere&=found;
+    }
+    if (everywhere) shared.push_back(d.get());
+  }
+  return shared;
+}
+
+static const char* integerTypes[]={"int8_t","int16_t","int32_t","uint8_t","uint16_t","uint32_t"};
 
 static bool simpleType(std::string tn) {
-  return (tn=="bool"||tn=="string"||tn=="int64_t");
+  for (auto integer : integerTypes) if (tn==integer) return true;
+  return (tn=="bool"||tn=="string"||tn=="int64_t"||tn=="double"||enumTypes.count(tn));
+}
+
+// int8_t and uint8_t would be printed as characters
+static bool byteType(std::string tn) {
+  return (tn=="int8_t"||tn=="uint8_t");
+}
+
+static std::string childType(const Attribute& a) {
+  if (options.values&&a.type->id->id=="Ast") return "AnyNode";
+  return a.type->id->id;
+}
+
+// Value mode: alternatives without node children are stored inline in the sum's variant
+static bool leafNode(const Node& node) {
+  for (auto& a : node.attributes) {
+    if (!simpleType(a->type->id->id)&&!a->type->collection) return false;
+  }
+  return true;
+}
+
+static std::string memberType(const Attribute& a) {
+  if (simpleType(a.type->id->id)) return a.type->id->id;
+  if (options.values) {
+    if (a.type->collection) return "std::vector<"+childType(a)+">";
+    if (boxedAttributes.count(&a)) return "Box<"+childType(a)+">";
+    return childType(a);
+  }
+  if (a.type->collection) return "std::vector<std::unique_ptr<"+a.type->id->id+">>";
+  if (a.type->inlined) return a.type->id->id;
+  return "std::unique_ptr<"+a.type->id->id+">";
+}
+
+// Whether a node can be copied member-wise: all its children are inline and copyable too
+static bool copyable(const Node& node) {
+  for (auto& a : node.attributes) {
+    if (simpleType(a->type->id->id)) continue;
+    if (a->type->collection||!a->type->inlined||!nodeTypes.count(a->type->id->id)) return false;
+    if (!copyable(*nodeTypes[a->type->id->id])) return false;
+  }
+  return true;
+}
+
+// Whether the member holds its child by value, requiring the child to be defined first
+static bool embedded(const Attribute& a) {
+  if (simpleType(a.type->id->id)||a.type->collection) return false;
+  return options.values||a.type->inlined;
 }
 
 void generateForwards(const std::vector<std::unique_ptr<Node>>& nodes) {
-  cout << "// Forward declarations" << endl;
+  cout << "// Forward declarations" << '\n';
+  if (!options.values) {
+    for (auto& sum : sumTypes) out << "struct " << sum.first << ";" << '\n';
+  }
   for (auto& nodePtr : nodes) {
     Node& node=*reinterpret_cast<Node*>(nodePtr.get());    
-    out << "struct "<<node.name->id<<";" << endl;
-  }
-  cout << endl;
-}
-
-void generateVisitor(const std::vector<std::unique_ptr<Node>>& nodes) {
-  out << "// Visitor base class" << endl;
-  out << "struct Visitor {" << endl;
-  out << "  virtual void visitPre(const std::string& name,const Ast&) {}" << endl;
-  out << "  virtual void visitPost(const std::string& name,const Ast&) {}" << endl;
-  out << "  virtual void visitPre(const std::string& name,const Collection&) {}" << endl;
-  out << "  virtual void visitPost(const std::string& name,const Collection&) {}" << endl;
-  out << "  virtual void visit(const std::string& name,const int64_t&) {}" << endl;
-  out << "  virtual void visit(const std::string& name,const std::string&) {}" << endl;
-  out << "  virtual void collectionPre() {}" << endl;
-  out << "  virtual void collectionPost() {}" << endl;
-  out << "  virtual void emptyElement() {}" << endl;
+    out << "struct "<<node.name->id<<";" << '\n';
+  }
+  cout << '\n';
+}
+
+void generateSums(const std::vector<std::unique_ptr<Sum>>& sums) {
+  if (sums.empty()) return;
+  out << "// Sum types" << '\n';
+  for (auto& sum : sums) {
+    auto& alts=sum->alternatives;
+    out << "struct " << sum->name->id << " : public Ast {" << '\n';
+    out << "  enum class Kind : uint8_t { ";
+    bool first=true;
+    for (auto& alt : alts) {
+      if (!first) out << ", ";
+      first=false;
+      out << alt->id;
+    }
+    out << " };" << '\n';
+    out << "  Kind kind;" << '\n' << '\n';
+    out << "  explicit " << sum->name->id << "(Kind kind) : kind(kind) {}" << '\n' << '\n';
+    out << "  // Calls f with the concrete alternative; f must accept every alternative" << '\n';
+    out << "  template<class F> auto visit(F&& f) -> decltype(f(std::declval<" << alts.front()->id << "&>()));" << '\n';
+    out << "  template<class F> auto visit(F&& f) const -> decltype(f(std::declval<const " << alts.front()->id << "&>()));" << '\n';
+    auto shared=sharedDerived(*sum);
+    if (!shared.empty()) out << "  // Derived attributes of every alternative" << '\n';
+    for (auto d : shared) out << "  const " << d->type->id->id << "& " << d->name->id << "() const;" << '\n';
+    out << "};" << '\n' << '\n';
+  }
+}
+
+void generateSumDispatch(const std::vector<std::unique_ptr<Sum>>& sums) {
+  for (auto& sum : sums) {
+    auto& alts=sum->alternatives;
+    for (std::string qualifier : {"","const "}) {
+      out << "template<class F> auto " << sum->name->id << "::visit(F&& f) " << qualifier << "-> decltype(f(std::declval<" << qualifier << alts.front()->id << "&>())) {" << '\n';
+      out << "  switch (kind) {" << '\n';
+      for (auto& alt : alts) {
+        if (alt==alts.back()) out << "    case Kind::" << alt->id << ": break;" << '\n';
+        else out << "    case Kind::" << alt->id << ": return f(static_cast<" << qualifier << alt->id << "&>(*this));" << '\n';
+      }
+      out << "  }" << '\n';
+      out << "  return f(static_cast<" << qualifier << alts.back()->id << "&>(*this));" << '\n';
+      out << "}" << '\n' << '\n';
+    }
+    for (auto d : sharedDerived(*sum)) {
+      out << "inline const " << d->type->id->id << "& " << sum->name->id << "::" << d->name->id << "() const {" << '\n';
+      out << "  switch (kind) {" << '\n';
+      for (auto& alt : alts) {
+        if (alt==alts.back()) out << "    case Kind::" << alt->id << ": break;" << '\n';
+        else out << "    case Kind::" << alt->id << ": return static_cast<const " << alt->id << "&>(*this)." << d->name->id << "();" << '\n';
+      }
+      out << "  }" << '\n';
+      out << "  return static_cast<const " << alts.back()->id << "&>(*this)." << d->name->id << "();" << '\n';
+      out << "}" << '\n' << '\n';
+    }
+  }
+}
+
+void generateEnums(const std::vector<std::unique_ptr<Enum>>& enums) {
+  if (enums.empty()) return;
+  out << "// Enums" << '\n';
+  for (auto& e : enums) {
+    out << "enum class " << e->name->id << " : uint8_t { ";
+    bool first=true;
+    for (auto& v : e->values) {
+      if (!first) out << ", ";
+      first=false;
+      out << v->id;
+    }
+    out << " };" << '\n';
+    out << "inline const char* toString(" << e->name->id << " value) {" << '\n';
+    out << "  switch (value) {" << '\n';
+    for (auto& v : e->values) {
+      out << "    case " << e->name->id << "::" << v->id << ": return \"" << v->id << "\";" << '\n';
+    }
+    out << "  }" << '\n';
+    out << "  return \"\";" << '\n';
+    out << "}" << '\n';
+    out << "inline std::ostream& operator<< (std::ostream& out," << e->name->id << " value) { return out << toString(value); }" << '\n' << '\n';
+  }
+}
+
+void generateVisitor(const std::vector<std::unique_ptr<Node>>& nodes,const std::vector<std::unique_ptr<Enum>>& enums) {
+  out << "// Visitor base class" << '\n';
+  out << "struct Visitor {" << '\n';
+  if (!options.values&&!options.persistent) {
+    out << "  virtual void visitPre(const std::string& name,const Ast&) {}" << '\n';
+    out << "  virtual void visitPost(const std::string& name,const Ast&) {}" << '\n';
+    out << "  virtual void visitPre(const std::string& name,const Collection&) {}" << '\n';
+    out << "  virtual void visitPost(const std::string& name,const Collection&) {}" << '\n';
+  }
+  out << "  virtual void visit(const std::string& name,const int64_t&) {}" << '\n';
+  out << "  virtual void visit(const std::string& name,const std::string&) {}" << '\n';
+  out << "  virtual void visit(const std::string& name,const double&) {}" << '\n';
+  out << "  virtual void visit(const std::string& name,const bool& v) { visit(name,int64_t(v)); }" << '\n';
+  for (auto integer : integerTypes) {
+    out << "  virtual void visit(const std::string& name,const " << integer << "& v) { visit(name,int64_t(v)); }" << '\n';
+  }
+  for (auto& e : enums) {
+    out << "  virtual void visit(const std::string& name,const " << e->name->id << "& v) { visit(name,std::string(toString(v))); }" << '\n';
+  }
+  out << "  virtual void collectionPre() {}" << '\n';
+  out << "  virtual void collectionPost() {}" << '\n';
+  out << "  virtual void emptyElement() {}" << '\n';
   for (auto& nodePtr : nodes) {
     Node& node=*reinterpret_cast<Node*>(nodePtr.get());
     
-    out << "  virtual void visitPre(const std::string& name,const "<<node.name->id<<"&) {}" << endl;
-    out << "  virtual void visitPost(const std::string& name,const "<<node.name->id<<"&) {}" << endl;
+    out << "  virtual void visitPre(const std::string& name,const "<<node.name->id<<"&) {}" << '\n';
+    out << "  virtual void visitPost(const std::string& name,const "<<node.name->id<<"&) {}" << '\n';
+  }
+  out << "};" << '\n' << '\n';
+}
+
+void generateReflection(const std::vector<std::unique_ptr<Node>>& nodes) {
+  out << "// Compile-time reflection" << '\n';
+  out << "enum class FieldKind { Scalar, Child, Collection };" << '\n' << '\n';
+  out << "template<class Owner,class Value,Value Owner::*Member,FieldKind Kind,class Child>" << '\n';
+  out << "struct Field {" << '\n';
+  out << "  typedef Owner owner_type;" << '\n';
+  out << "  typedef Value value_type;" << '\n';
+  out << "  typedef Child child_type;" << '\n';
+  out << "  static constexpr FieldKind kind=Kind;" << '\n';
+  out << "  static constexpr Value Owner::*member() { return Member; }" << '\n';
+  out << "  static const Value& get(const Owner& owner) { return owner.*Member; }" << '\n';
+  out << "  static Value& get(Owner& owner) { return owner.*Member; }" << '\n';
+  out << "};" << '\n' << '\n';
+  out << "template<class T> struct Reflect;" << '\n' << '\n';
+  out << "template<class T,class F,std::size_t I=0>" << '\n';
+  out << "typename std::enable_if<I==std::tuple_size<typename Reflect<T>::fields>::value>::type forEachField(const T&,F&) {}" << '\n' << '\n';
+  out << "template<class T,class F,std::size_t I=0>" << '\n';
+  out << "typename std::enable_if<(I<std::tuple_size<typename Reflect<T>::fields>::value)>::type forEachField(const T& node,F& f) {" << '\n';
+  out << "  typedef typename std::tuple_element<I,typename Reflect<T>::fields>::type field;" << '\n';
+  out << "  f(field(),field::get(node));" << '\n';
+  out << "  forEachField<T,F,I+1>(node,f);" << '\n';
+  out << "}" << '\n' << '\n';
+  for (auto& nodePtr : nodes) {
+    Node& node=*reinterpret_cast<Node*>(nodePtr.get());
+
+    out << "template<> struct Reflect<" << node.name->id << "> {" << '\n';
+    out << "  static constexpr const char* name() { return \"" << node.name->id << "\"; }" << '\n';
+    for (auto& a : node.attributes) {
+      std::string kind,child;
+      if (simpleType(a->type->id->id)) {
+        kind="Scalar"; child="void";
+      } else if (a->type->collection) {
+        kind="Collection"; child=childType(*a);
+      } else {
+        kind="Child"; child=childType(*a);
+      }
+      out << "  struct " << a->name->id << "_field : Field<" << node.name->id << "," << memberType(*a) << ",&" << node.name->id << "::" << a->name->id << ",FieldKind::" << kind << "," << child << "> {" << '\n';
+      out << "    static constexpr const char* name() { return \"" << a->name->id << "\"; }" << '\n';
+      out << "  };" << '\n';
+    }
+    out << "  typedef std::tuple<";
+    bool first=true;
+    for (auto& a : node.attributes) {
+      if (!first) out << ",";
+      first=false;
+      out << a->name->id << "_field";
+    }
+    out << "> fields;" << '\n';
+    out << "};" << '\n' << '\n';
+  }
+}
+
+// Kinds a subtree of each node kind can contain, following children, collections,
+// sum alternatives and Ast (which can be anything), as one bit row per kind in KindId order
+static std::vector<std::vector<uint64_t>> reachableKinds(const std::vector<std::unique_ptr<Node>>& nodes) {
+  std::map<std::string,size_t> index;
+  for (size_t kind=0;kind<nodes.size();++kind) index[nodes[kind]->name->id]=kind;
+  size_t words=(nodes.size()+63)/64;
+  std::vector<std::vector<uint64_t>> rows(nodes.size(),std::vector<uint64_t>(words,0));
+  std::vector<std::vector<size_t>> children(nodes.size());
+  for (size_t kind=0;kind<nodes.size();++kind) {
+    for (auto& a : nodes[kind]->attributes) {
+      std::string type=a->type->id->id;
+      if (type=="Ast") {
+        for (size_t target=0;target<nodes.size();++target) rows[kind][target/64]|=uint64_t(1)<<(target%64);
+      } else if (sumTypes.count(type)) {
+        for (auto& alt : sumTypes[type]->alternatives) children[kind].push_back(index[alt->id]);
+      } else if (index.count(type)) {
+        children[kind].push_back(index[type]);
+      }
+    }
+  }
+  // Children are usually declared first, so this settles after a pass or two
+  for (bool changed=true;changed;) {
+    changed=false;
+    for (size_t kind=0;kind<nodes.size();++kind) {
+      auto& row=rows[kind];
+      for (auto child : children[kind]) {
+        for (size_t word=0;word<words;++word) {
+          uint64_t bits=row[word]|rows[child][word]|(word==child/64?uint64_t(1)<<(child%64):0);
+          changed|=bits!=row[word];
+          row[word]=bits;
+        }
+      }
+    }
+  }
+  return rows;
+}
+
+void generateReachability(const std::vector<std::unique_ptr<Node>>& nodes) {
+  // Without node kinds there is nothing to traverse, and the tables would be empty arrays
+  if (nodes.empty()) return;
+  auto rows=reachableKinds(nodes);
+
+  out << "// Schema reachability: CanReach<From,Target> holds if a From subtree can contain a Target" << '\n';
+  out << "static constexpr uint64_t reachBits[kindCount][" << (nodes.size()+63)/64 << "]={" << '\n';
+  for (auto& row : rows) {
+    out << "  {";
+    for (size_t word=0;word<row.size();++word) {
+      out << (word?",":"");
+      if (row[word]) out << "0x" << std::hex << row[word] << std::dec;
+      else out << "0";
+    }
+    out << "}," << '\n';
+  }
+  out << "};" << '\n';
+  out << "constexpr bool canReach(uint32_t from,uint32_t target) { return (reachBits[from][target/64]>>(target%64))&1; }" << '\n';
+  out << "template<class From,class Target> struct CanReach : std::integral_constant<bool,std::is_same<From,Target>::value||canReach(KindId<From>::value,KindId<Target>::value)> {};" << '\n';
+  out << "template<class Target> struct CanReach<Ast,Target> : std::true_type {};" << '\n';
+  for (auto& sum : sumTypes) {
+    out << "template<class Target> struct CanReach<" << sum.first << ",Target> : std::integral_constant<bool,";
+    bool first=true;
+    for (auto& alt : sum.second->alternatives) {
+      out << (first?"":"||") << "CanReach<" << alt->id << ",Target>::value"; first=false;
+    }
+    out << "> {};" << '\n';
+  }
+  out << '\n';
+
+  out << "template<class Target,class T,class F> typename std::enable_if<std::is_same<T,Target>::value>::type forEachMatch(const T& node,F& f) { f(node); }" << '\n';
+  out << "template<class Target,class T,class F> typename std::enable_if<!std::is_same<T,Target>::value>::type forEachMatch(const T&,F&) {}" << '\n';
+  for (auto& nodePtr : nodes) {
+    out << "template<class Target,class F> void forEachIn(const " << nodePtr->name->id << "& node,F& f);" << '\n';
+  }
+  out << '\n';
+  out << "template<class Target,class F> void forEachInAst(const Ast& node,F& f) {" << '\n';
+  for (auto& nodePtr : nodes) {
+    auto& kind=nodePtr->name->id;
+    out << "  if (CanReach<" << kind << ",Target>::value) if (auto child=dynamic_cast<const " << kind << "*>(&node)) { forEachIn<Target>(*child,f); return; }" << '\n';
+  }
+  out << "}" << '\n' << '\n';
+  out << "template<class Target,class F> struct ForEachAlternative {" << '\n';
+  out << "  F& f;" << '\n';
+  out << "  template<class T> void operator()(const T& node) const { forEachIn<Target>(node,f); }" << '\n';
+  out << "};" << '\n' << '\n';
+
+  for (auto& nodePtr : nodes) {
+    Node& node=*nodePtr;
+    out << "template<class Target,class F> void forEachIn(const " << node.name->id << "& node,F& f) {" << '\n';
+    out << "  forEachMatch<Target>(node,f);" << '\n';
+    for (auto& a : node.attributes) {
+      std::string type=a->type->id->id;
+      if (simpleType(type)) continue;
+      std::string reaches="CanReach<"+type+",Target>::value";
+      std::string descend;
+      if (type=="Ast") descend="forEachInAst<Target>(*item,f);";
+      else if (sumTypes.count(type)) descend="item->visit(ForEachAlternative<Target,F>{f});";
+      else descend="forEachIn<Target>(*item,f);";
+      if (a->type->collection) {
+        out << "  if (" << reaches << ") for (auto& item : node." << a->name->id << ") if (item) " << descend << '\n';
+      } else if (a->type->inlined) {
+        out << "  if (" << reaches << ") forEachIn<Target>(node." << a->name->id << ",f);" << '\n';
+      } else {
+        out << "  if (" << reaches << "&&node." << a->name->id << ") { auto& item=node." << a->name->id << "; " << descend << " }" << '\n';
+      }
+    }
+    out << "}" << '\n' << '\n';
   }
-  out << "};" << endl << endl;
+
+  out << "// Calls f for every Target node below root, skipping fields whose type can not contain a Target" << '\n';
+  out << "template<class Target,class Root,class F> void forEach(const Root& root,F f) { forEachIn<Target>(root,f); }" << '\n' << '\n';
 }
 
 static std::string rubyDefinitionTemplate = R"tpl(
@@ -147,6 +506,7 @@ struct RubyAstVisitor : public Visitor {
   {{/NODES}}
   
   virtual void visit(const std::string& name,const int64_t& v) { tryComma(); std::cerr << v; }
+  virtual void visit(const std::string& name,const double& v) { tryComma(); std::cerr << v; }
   virtual void visit(const std::string& name,const std::string& v) { tryComma(); std::cerr << "\"" << v << "\""; }
 };
 )tpl"; //"
@@ -172,7 +532,7 @@ void generateRubyAstVisitor(const std::vector<std::unique_ptr<Node>>& nodes) {
   
   string output;
   ctemplate::ExpandTemplate("ast_ruby_ast",ctemplate::DO_NOT_STRIP,&dict,&output);
-  out << output << endl;
+  out << output << '\n';
 }
 
 
@@ -225,153 +585,2635 @@ struct PrettyPrintVisitor : public Visitor {
   {{/NODE_VISITORS}}
   
   virtual void visit(const std::string& name,const int64_t& v) { std::cerr << "(" << name << "=" << "\"" << v << "\")"; }
+  virtual void visit(const std::string& name,const double& v) { std::cerr << "(" << name << "=" << "\"" << v << "\")"; }
   virtual void visit(const std::string& name,const std::string& v) { std::cerr << "(" << name << "=" << "\"" << v << "\")"; }
 };
 )tpl"; //"
 
-void generatePrettyPrintVisitor(const std::vector<std::unique_ptr<Node>>& nodes) {
-  ctemplate::StringToTemplateCache("ast_pretty_print",prettyPrinterTemplate.c_str(),ctemplate::DO_NOT_STRIP);
-  
-  ctemplate::TemplateDictionary dict("pretty printer");
-  for (auto& nodePtr : nodes) {
-    Node& node=*reinterpret_cast<Node*>(nodePtr.get());
-    
-    auto nodeDict=dict.AddSectionDictionary("NODE_VISITORS");
-    nodeDict->SetValue("NODE_NAME",node.name->id);
-  }
-  
-  string output;
-  ctemplate::ExpandTemplate("ast_pretty_print",ctemplate::DO_NOT_STRIP,&dict,&output);
-  out << output << endl;
+void generatePrettyPrintVisitor(const std::vector<std::unique_ptr<Node>>& nodes) {
+  ctemplate::StringToTemplateCache("ast_pretty_print",prettyPrinterTemplate.c_str(),ctemplate::DO_NOT_STRIP);
+  
+  ctemplate::TemplateDictionary dict("pretty printer");
+  for (auto& nodePtr : nodes) {
+    Node& node=*reinterpret_cast<Node*>(nodePtr.get());
+    
+    auto nodeDict=dict.AddSectionDictionary("NODE_VISITORS");
+    nodeDict->SetValue("NODE_NAME",node.name->id);
+  }
+  
+  string output;
+  ctemplate::ExpandTemplate("ast_pretty_print",ctemplate::DO_NOT_STRIP,&dict,&output);
+  out << output << '\n';
+}
+
+// The attribute naming a node for AstIndex::find: the first string attribute, or the first
+// child whose own first attribute is a string (like name:Id)
+static std::string indexKey(Node& node,std::map<std::string,Node*>& byName) {
+  for (auto& a : node.attributes) {
+    if (a->type->id->id=="string") return "&node."+a->name->id;
+  }
+  for (auto& a : node.attributes) {
+    auto child=byName.find(a->type->id->id);
+    if (a->type->collection||child==byName.end()||child->second->attributes.empty()) continue;
+    auto& key=child->second->attributes.front();
+    if (key->type->id->id!="string") continue;
+    if (a->type->inlined) return "&node."+a->name->id+"."+key->name->id;
+    return "node."+a->name->id+"?&node."+a->name->id+"->"+key->name->id+":nullptr";
+  }
+  return "";
+}
+
+void generateKindIds(const std::vector<std::unique_ptr<Node>>& nodes) {
+  out << "// Dense numbering of node kinds" << '\n';
+  out << "template<class T> struct KindId;" << '\n';
+  uint64_t kind=0;
+  for (auto& nodePtr : nodes) {
+    out << "template<> struct KindId<" << nodePtr->name->id << "> { static constexpr uint32_t value=" << kind++ << "; };" << '\n';
+  }
+  out << "static const uint32_t kindCount=" << kind << ";" << '\n';
+  out << "// Size of arrays indexed by kind, which C++ does not allow to be empty" << '\n';
+  out << "static const uint32_t kindSlots=" << (kind?kind:1) << ";" << '\n' << '\n';
+  out << "inline const char* kindName(uint32_t kind) {" << '\n';
+  out << "  static const char* names[kindSlots]={";
+  bool first=true;
+  for (auto& nodePtr : nodes) {
+    out << (first?"":",") << "\"" << nodePtr->name->id << "\"";
+    first=false;
+  }
+  out << "};" << '\n';
+  out << "  return names[kind];" << '\n';
+  out << "}" << '\n' << '\n';
+}
+
+void generateIndex(const std::vector<std::unique_ptr<Node>>& nodes) {
+  std::map<std::string,Node*> byName;
+  for (auto& nodePtr : nodes) byName[nodePtr->name->id]=nodePtr.get();
+
+  out << "#ifdef ASTGEN_INDEX" << '\n';
+  out << "#include <unordered_map>" << '\n' << '\n';
+  out << "// Keys for AstIndex::find" << '\n';
+  out << "template<class T> struct IndexKey;" << '\n';
+  for (auto& nodePtr : nodes) {
+    std::string key=indexKey(*nodePtr,byName);
+    if (key.empty()) continue;
+    out << "template<> struct IndexKey<" << nodePtr->name->id << "> { static const std::string* of(const " << nodePtr->name->id << "& node) { return " << key << "; } };" << '\n';
+  }
+  out << '\n';
+  out << "template<class T>" << '\n';
+  out << "struct AstIndexRange {" << '\n';
+  out << "  struct iterator {" << '\n';
+  out << "    Ast* const* pos;" << '\n';
+  out << "    T& operator*() const { return *static_cast<T*>(*pos); }" << '\n';
+  out << "    iterator& operator++() { ++pos; return *this; }" << '\n';
+  out << "    bool operator!=(const iterator& other) const { return pos!=other.pos; }" << '\n';
+  out << "  };" << '\n';
+  out << "  Ast* const* first;" << '\n';
+  out << "  Ast* const* last;" << '\n';
+  out << "  iterator begin() const { return iterator{first}; }" << '\n';
+  out << "  iterator end() const { return iterator{last}; }" << '\n';
+  out << "  std::size_t size() const { return last-first; }" << '\n';
+  out << "  T& operator[](std::size_t i) const { return *static_cast<T*>(first[i]); }" << '\n';
+  out << "};" << '\n' << '\n';
+  out << "// Registers every node constructed while it is active (see Scope) in a contiguous list" << '\n';
+  out << "// per kind. Nodes unregister when destroyed; order within a kind is not preserved." << '\n';
+  out << "struct AstIndex {" << '\n';
+  out << "  std::vector<Ast*> kinds[kindSlots];" << '\n';
+  out << "  std::unordered_multimap<std::string,Ast*> names[kindSlots];" << '\n';
+  out << "  bool namesValid[kindSlots];" << '\n' << '\n';
+  out << "  AstIndex() { for (auto& valid : namesValid) valid=false; }" << '\n';
+  out << "  ~AstIndex() { for (auto& kind : kinds) for (auto node : kind) node->indexSlot.index=nullptr; }" << '\n' << '\n';
+  out << "  static AstIndex*& active() { static thread_local AstIndex* index=nullptr; return index; }" << '\n' << '\n';
+  out << "  struct Scope {" << '\n';
+  out << "    AstIndex* previous;" << '\n';
+  out << "    Scope(AstIndex& index) : previous(active()) { active()=&index; }" << '\n';
+  out << "    ~Scope() { active()=previous; }" << '\n';
+  out << "  };" << '\n' << '\n';
+  out << "  template<class T> void add(T& node) {" << '\n';
+  out << "    auto& list=kinds[KindId<T>::value];" << '\n';
+  out << "    node.indexSlot.index=this; node.indexSlot.kind=KindId<T>::value; node.indexSlot.slot=list.size();" << '\n';
+  out << "    list.push_back(&node);" << '\n';
+  out << "    namesValid[KindId<T>::value]=false;" << '\n';
+  out << "  }" << '\n' << '\n';
+  out << "  void remove(Ast& node) {" << '\n';
+  out << "    auto& list=kinds[node.indexSlot.kind];" << '\n';
+  out << "    list[node.indexSlot.slot]=list.back();" << '\n';
+  out << "    list[node.indexSlot.slot]->indexSlot.slot=node.indexSlot.slot;" << '\n';
+  out << "    list.pop_back();" << '\n';
+  out << "    namesValid[node.indexSlot.kind]=false;" << '\n';
+  out << "    node.indexSlot.index=nullptr;" << '\n';
+  out << "  }" << '\n' << '\n';
+  out << "  // Takes over the registrations of other, e.g. an index filled on another thread" << '\n';
+  out << "  void merge(AstIndex& other) {" << '\n';
+  out << "    for (uint32_t kind=0;kind<kindSlots;++kind) {" << '\n';
+  out << "      for (auto node : other.kinds[kind]) {" << '\n';
+  out << "        node->indexSlot.index=this; node->indexSlot.slot=kinds[kind].size();" << '\n';
+  out << "        kinds[kind].push_back(node);" << '\n';
+  out << "        namesValid[kind]=false;" << '\n';
+  out << "      }" << '\n';
+  out << "      other.kinds[kind].clear();" << '\n';
+  out << "      other.namesValid[kind]=false;" << '\n';
+  out << "    }" << '\n';
+  out << "  }" << '\n' << '\n';
+  out << "  // Hands the registration of from, which is about to be destroyed, to to" << '\n';
+  out << "  void transfer(Ast& from,Ast& to) {" << '\n';
+  out << "    to.indexSlot.index=this; to.indexSlot.kind=from.indexSlot.kind; to.indexSlot.slot=from.indexSlot.slot;" << '\n';
+  out << "    kinds[to.indexSlot.kind][to.indexSlot.slot]=&to;" << '\n';
+  out << "    namesValid[to.indexSlot.kind]=false;" << '\n';
+  out << "    from.indexSlot.index=nullptr;" << '\n';
+  out << "  }" << '\n' << '\n';
+  out << "  template<class T> AstIndexRange<T> all() const {" << '\n';
+  out << "    auto& list=kinds[KindId<T>::value];" << '\n';
+  out << "    return AstIndexRange<T>{list.data(),list.data()+list.size()};" << '\n';
+  out << "  }" << '\n' << '\n';
+  out << "  // Finds a node by its IndexKey; the name table of a kind is built on first use" << '\n';
+  out << "  template<class T> T* find(const std::string& key) {" << '\n';
+  out << "    auto& table=names[KindId<T>::value];" << '\n';
+  out << "    if (!namesValid[KindId<T>::value]) {" << '\n';
+  out << "      table.clear();" << '\n';
+  out << "      for (auto& node : all<T>()) if (auto name=IndexKey<T>::of(node)) table.insert(std::make_pair(*name,&node));" << '\n';
+  out << "      namesValid[KindId<T>::value]=true;" << '\n';
+  out << "    }" << '\n';
+  out << "    auto found=table.find(key);" << '\n';
+  out << "    return found==table.end()?nullptr:static_cast<T*>(found->second);" << '\n';
+  out << "  }" << '\n';
+  out << "};" << '\n';
+  out << "#endif" << '\n' << '\n';
+}
+
+void generateStats(const std::vector<std::unique_ptr<Node>>& nodes) {
+  out << "#ifdef ASTGEN_STATS" << '\n';
+  out << "#include <atomic>" << '\n';
+  out << "#include <chrono>" << '\n';
+  out << "#include <ostream>" << '\n' << '\n';
+  out << "// Counters per node kind. Relaxed atomics, so clone() and AstBuilder workers may count" << '\n';
+  out << "// from several threads; reset() and the dumps expect no concurrent updates." << '\n';
+  out << "struct AstStats {" << '\n';
+  out << "  typedef std::atomic<uint64_t> Counter;" << '\n';
+  out << "  Counter constructed[kindSlots];" << '\n';
+  out << "  Counter destroyed[kindSlots];" << '\n';
+  out << "  Counter bytes[kindSlots];" << '\n';
+  out << "  Counter visits[kindSlots];" << '\n';
+  out << "  Counter visitNanos[kindSlots];" << '\n';
+  out << "  Counter casts;" << '\n';
+  out << "  Counter castFailures;" << '\n' << '\n';
+  out << "  AstStats() { reset(); }" << '\n';
+  out << "  static AstStats& get() { static AstStats stats; return stats; }" << '\n' << '\n';
+  out << "  static void add(Counter& counter,uint64_t n) { counter.fetch_add(n,std::memory_order_relaxed); }" << '\n';
+  out << "  static const char* name(uint32_t kind) { return kindName(kind); }" << '\n' << '\n';
+  out << "  void reset() {" << '\n';
+  out << "    for (uint32_t kind=0;kind<kindCount;++kind) constructed[kind]=destroyed[kind]=bytes[kind]=visits[kind]=visitNanos[kind]=0;" << '\n';
+  out << "    casts=castFailures=0;" << '\n';
+  out << "  }" << '\n' << '\n';
+  out << "  // Times one visitor callback and charges it to a kind" << '\n';
+  out << "  struct Timer {" << '\n';
+  out << "    uint32_t kind;" << '\n';
+  out << "    std::chrono::steady_clock::time_point start;" << '\n';
+  out << "    Timer(uint32_t kind,bool visit) : kind(kind),start(std::chrono::steady_clock::now()) { add(get().visits[kind],visit); }" << '\n';
+  out << "    ~Timer() { add(get().visitNanos[kind],std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now()-start).count()); }" << '\n';
+  out << "  };" << '\n' << '\n';
+  out << "  void dump(std::ostream& out) const {" << '\n';
+  out << "    out << \"kind constructed destroyed bytes visits visitNanos\\n\";" << '\n';
+  out << "    for (uint32_t kind=0;kind<kindCount;++kind) {" << '\n';
+  out << "      out << name(kind) << ' ' << constructed[kind].load() << ' ' << destroyed[kind].load() << ' ' << bytes[kind].load() << ' ' << visits[kind].load() << ' ' << visitNanos[kind].load() << '\\n';" << '\n';
+  out << "    }" << '\n';
+  out << "    out << \"casts \" << casts.load() << \" castFailures \" << castFailures.load() << '\\n';" << '\n';
+  out << "  }" << '\n' << '\n';
+  out << "  void dumpJson(std::ostream& out) const {" << '\n';
+  out << "    out << \"{\\\"kinds\\\":{\";" << '\n';
+  out << "    for (uint32_t kind=0;kind<kindCount;++kind) {" << '\n';
+  out << "      out << (kind?\",\":\"\") << '\"' << name(kind) << \"\\\":{\\\"constructed\\\":\" << constructed[kind].load() << \",\\\"destroyed\\\":\" << destroyed[kind].load()" << '\n';
+  out << "          << \",\\\"bytes\\\":\" << bytes[kind].load() << \",\\\"visits\\\":\" << visits[kind].load() << \",\\\"visitNanos\\\":\" << visitNanos[kind].load() << '}';" << '\n';
+  out << "    }" << '\n';
+  out << "    out << \"},\\\"casts\\\":\" << casts.load() << \",\\\"castFailures\\\":\" << castFailures.load() << '}';" << '\n';
+  out << "  }" << '\n';
+  out << "};" << '\n' << '\n';
+  out << "#define ASTGEN_VISIT(T,visit,call) { AstStats::Timer timer(KindId<T>::value,visit); call; }" << '\n';
+  out << "#else" << '\n';
+  out << "#define ASTGEN_VISIT(T,visit,call) call" << '\n';
+  out << "#endif" << '\n' << '\n';
+}
+
+void generatePool() {
+  out << "#ifdef ASTGEN_POOL" << '\n';
+  out << "#include <algorithm>" << '\n';
+  out << "#include <atomic>" << '\n';
+  out << "#include <mutex>" << '\n';
+  out << "#include <ostream>" << '\n' << '\n';
+  out << "// Recycles node memory through free lists, one per 16-byte size class. Every thread keeps" << '\n';
+  out << "// its own lists and trades batches with a shared depot, so most allocations and frees take" << '\n';
+  out << "// no lock and never reach the global allocator. Memory is kept for reuse, not returned." << '\n';
+  out << "struct AstPool {" << '\n';
+  out << "  static const std::size_t classes=32; // nodes of up to 512 bytes, larger ones use ::operator new" << '\n';
+  out << "  static const std::size_t batch=64;" << '\n';
+  out << "  static const std::size_t chunkSize=1<<16;" << '\n' << '\n';
+  out << "  struct Block { Block* next; };" << '\n';
+  out << "  struct List {" << '\n';
+  out << "    Block* head;" << '\n';
+  out << "    std::size_t count;" << '\n';
+  out << "    List() : head(nullptr),count(0) {}" << '\n';
+  out << "    void push(Block* block) { block->next=head; head=block; ++count; }" << '\n';
+  out << "    Block* pop() { Block* block=head; head=block->next; --count; return block; }" << '\n';
+  out << "  };" << '\n' << '\n';
+  out << "  // Written by one thread, read by any" << '\n';
+  out << "  struct Counter {" << '\n';
+  out << "    std::atomic<uint64_t> value;" << '\n';
+  out << "    Counter() : value(0) {}" << '\n';
+  out << "    void add() { value.store(value.load(std::memory_order_relaxed)+1,std::memory_order_relaxed); }" << '\n';
+  out << "    uint64_t get() const { return value.load(std::memory_order_relaxed); }" << '\n';
+  out << "  };" << '\n' << '\n';
+  out << "  struct Cache;" << '\n';
+  out << "  struct Stats {" << '\n';
+  out << "    uint64_t allocations[kindSlots];" << '\n';
+  out << "    uint64_t frees[kindSlots];" << '\n';
+  out << "    uint64_t large; // allocations too big for a size class" << '\n';
+  out << "    uint64_t chunks;" << '\n';
+  out << "    uint64_t carved; // blocks cut from chunks; every other pooled allocation reuses one" << '\n';
+  out << "    Stats() : large(0),chunks(0),carved(0) { for (uint32_t kind=0;kind<kindCount;++kind) allocations[kind]=frees[kind]=0; }" << '\n';
+  out << "  };" << '\n' << '\n';
+  out << "  // Blocks given back by threads, the live thread caches, and the counts of exited threads" << '\n';
+  out << "  struct Depot {" << '\n';
+  out << "    std::mutex mutex;" << '\n';
+  out << "    List lists[classes];" << '\n';
+  out << "    std::vector<Cache*> caches;" << '\n';
+  out << "    Stats retired;" << '\n';
+  out << "  };" << '\n';
+  out << "  static Depot& depot() { static Depot depot; return depot; }" << '\n' << '\n';
+  out << "  struct Cache {" << '\n';
+  out << "    List lists[classes];" << '\n';
+  out << "    Counter allocations[kindSlots];" << '\n';
+  out << "    Counter frees[kindSlots];" << '\n';
+  out << "    Counter large;" << '\n';
+  out << "    Counter chunks;" << '\n';
+  out << "    Counter carved;" << '\n';
+  out << "    char* fresh[classes]; // unused part of the last chunk of each class" << '\n';
+  out << "    char* freshEnd[classes];" << '\n' << '\n';
+  out << "    Cache() {" << '\n';
+  out << "      for (std::size_t c=0;c<classes;++c) fresh[c]=freshEnd[c]=nullptr;" << '\n';
+  out << "      std::lock_guard<std::mutex> lock(depot().mutex);" << '\n';
+  out << "      depot().caches.push_back(this);" << '\n';
+  out << "    }" << '\n';
+  out << "    ~Cache() {" << '\n';
+  out << "      Depot& shared=depot();" << '\n';
+  out << "      std::lock_guard<std::mutex> lock(shared.mutex);" << '\n';
+  out << "      for (std::size_t c=0;c<classes;++c) {" << '\n';
+  out << "        while (lists[c].head) shared.lists[c].push(lists[c].pop());" << '\n';
+  out << "        for (;fresh[c]<freshEnd[c];fresh[c]+=(c+1)*16) shared.lists[c].push(reinterpret_cast<Block*>(fresh[c]));" << '\n';
+  out << "      }" << '\n';
+  out << "      add(shared.retired);" << '\n';
+  out << "      shared.caches.erase(std::find(shared.caches.begin(),shared.caches.end(),this));" << '\n';
+  out << "    }" << '\n';
+  out << "    void add(Stats& stats) const {" << '\n';
+  out << "      for (uint32_t kind=0;kind<kindCount;++kind) {" << '\n';
+  out << "        stats.allocations[kind]+=allocations[kind].get();" << '\n';
+  out << "        stats.frees[kind]+=frees[kind].get();" << '\n';
+  out << "      }" << '\n';
+  out << "      stats.large+=large.get();" << '\n';
+  out << "      stats.chunks+=chunks.get();" << '\n';
+  out << "      stats.carved+=carved.get();" << '\n';
+  out << "    }" << '\n' << '\n';
+  out << "    void* carve(std::size_t c) {" << '\n';
+  out << "      std::size_t size=(c+1)*16;" << '\n';
+  out << "      if (std::size_t(freshEnd[c]-fresh[c])<size) {" << '\n';
+  out << "        fresh[c]=static_cast<char*>(::operator new(chunkSize));" << '\n';
+  out << "        freshEnd[c]=fresh[c]+chunkSize/size*size;" << '\n';
+  out << "        chunks.add();" << '\n';
+  out << "      }" << '\n';
+  out << "      carved.add();" << '\n';
+  out << "      void* p=fresh[c];" << '\n';
+  out << "      fresh[c]+=size;" << '\n';
+  out << "      return p;" << '\n';
+  out << "    }" << '\n';
+  out << "  };" << '\n';
+  out << "  static Cache& cache() { static thread_local Cache cache; return cache; }" << '\n' << '\n';
+  out << "  // Takes up to a batch of blocks from the depot into an empty list" << '\n';
+  out << "  static void refill(List& list,std::size_t c) {" << '\n';
+  out << "    Depot& shared=depot();" << '\n';
+  out << "    std::lock_guard<std::mutex> lock(shared.mutex);" << '\n';
+  out << "    while (list.count<batch&&shared.lists[c].head) list.push(shared.lists[c].pop());" << '\n';
+  out << "  }" << '\n' << '\n';
+  out << "  static void* take(uint32_t kind,std::size_t size) {" << '\n';
+  out << "    Cache& local=cache();" << '\n';
+  out << "    local.allocations[kind].add();" << '\n';
+  out << "    std::size_t c=(size-1)/16;" << '\n';
+  out << "    if (c>=classes) { local.large.add(); return ::operator new(size); }" << '\n';
+  out << "    List& list=local.lists[c];" << '\n';
+  out << "    if (!list.head) refill(list,c);" << '\n';
+  out << "    return list.head?list.pop():local.carve(c);" << '\n';
+  out << "  }" << '\n' << '\n';
+  out << "  // A thread that frees much more than it allocates passes the surplus on" << '\n';
+  out << "  static void give(uint32_t kind,void* p,std::size_t size) {" << '\n';
+  out << "    Cache& local=cache();" << '\n';
+  out << "    local.frees[kind].add();" << '\n';
+  out << "    std::size_t c=(size-1)/16;" << '\n';
+  out << "    if (c>=classes) { ::operator delete(p); return; }" << '\n';
+  out << "    List& list=local.lists[c];" << '\n';
+  out << "    list.push(static_cast<Block*>(p));" << '\n';
+  out << "    if (list.count<2*batch) return;" << '\n';
+  out << "    std::lock_guard<std::mutex> lock(depot().mutex);" << '\n';
+  out << "    while (list.count>batch) depot().lists[c].push(list.pop());" << '\n';
+  out << "  }" << '\n' << '\n';
+  out << "  // Arena nodes are marked in the 16 bytes before them, see Ast::operator new" << '\n';
+  out << "  static void* allocate(uint32_t kind,std::size_t size) {" << '\n';
+  out << "#ifdef ASTGEN_ARENA" << '\n';
+  out << "    char* p=static_cast<char*>(take(kind,size+16));" << '\n';
+  out << "    p[0]=0;" << '\n';
+  out << "    return p+16;" << '\n';
+  out << "#else" << '\n';
+  out << "    return take(kind,size);" << '\n';
+  out << "#endif" << '\n';
+  out << "  }" << '\n';
+  out << "  static void release(uint32_t kind,void* p,std::size_t size) {" << '\n';
+  out << "    if (!p) return;" << '\n';
+  out << "#ifdef ASTGEN_ARENA" << '\n';
+  out << "    if (!static_cast<char*>(p)[-16]) give(kind,static_cast<char*>(p)-16,size+16);" << '\n';
+  out << "#else" << '\n';
+  out << "    give(kind,p,size);" << '\n';
+  out << "#endif" << '\n';
+  out << "  }" << '\n' << '\n';
+  out << "  // Counters summed over all threads" << '\n';
+  out << "  static Stats stats() {" << '\n';
+  out << "    Depot& shared=depot();" << '\n';
+  out << "    std::lock_guard<std::mutex> lock(shared.mutex);" << '\n';
+  out << "    Stats stats=shared.retired;" << '\n';
+  out << "    for (auto cache : shared.caches) cache->add(stats);" << '\n';
+  out << "    return stats;" << '\n';
+  out << "  }" << '\n' << '\n';
+  out << "  static void dump(std::ostream& out) {" << '\n';
+  out << "    Stats s=stats();" << '\n';
+  out << "    uint64_t total=0;" << '\n';
+  out << "    out << \"kind allocations frees live\\n\";" << '\n';
+  out << "    for (uint32_t kind=0;kind<kindCount;++kind) {" << '\n';
+  out << "      out << kindName(kind) << ' ' << s.allocations[kind] << ' ' << s.frees[kind] << ' ' << s.allocations[kind]-s.frees[kind] << '\\n';" << '\n';
+  out << "      total+=s.allocations[kind];" << '\n';
+  out << "    }" << '\n';
+  out << "    out << \"chunks \" << s.chunks << \" bytes \" << s.chunks*chunkSize << \" carved \" << s.carved << \" reused \" << total-s.large-s.carved << \" large \" << s.large << '\\n';" << '\n';
+  out << "  }" << '\n';
+  out << "};" << '\n';
+  out << "#endif" << '\n' << '\n';
+}
+
+void generateIds() {
+  out << "#ifdef ASTGEN_IDS" << '\n';
+  out << "#include <atomic>" << '\n' << '\n';
+  out << "// Hands out node ids, counting from 0 for each kind. Nodes take their id from the active" << '\n';
+  out << "// space (see Scope) when constructed, or from a process-wide one." << '\n';
+  out << "struct AstIdSpace {" << '\n';
+  out << "  std::atomic<uint32_t> next[kindSlots];" << '\n' << '\n';
+  out << "  AstIdSpace() { for (auto& count : next) count=0; }" << '\n';
+  out << "  AstIdSpace(const AstIdSpace&)=delete;" << '\n' << '\n';
+  out << "  static AstIdSpace*& active() { static thread_local AstIdSpace* space=nullptr; return space; }" << '\n';
+  out << "  static AstIdSpace& current() { static AstIdSpace global; return active()?*active():global; }" << '\n' << '\n';
+  out << "  struct Scope {" << '\n';
+  out << "    AstIdSpace* previous;" << '\n';
+  out << "    Scope(AstIdSpace& space) : previous(active()) { active()=&space; }" << '\n';
+  out << "    ~Scope() { active()=previous; }" << '\n';
+  out << "  };" << '\n' << '\n';
+  out << "  uint32_t allocate(uint32_t kind) { return next[kind].fetch_add(1,std::memory_order_relaxed); }" << '\n';
+  out << "  template<class T> uint32_t count() const { return next[KindId<T>::value]; }" << '\n';
+  out << "};" << '\n' << '\n';
+  out << "// Per-node data for one node kind, stored in a vector indexed by node id" << '\n';
+  out << "template<class Kind,class T>" << '\n';
+  out << "struct SideTable {" << '\n';
+  out << "  std::vector<T> values;" << '\n' << '\n';
+  out << "  SideTable() {}" << '\n';
+  out << "  explicit SideTable(const AstIdSpace& space) : values(space.count<Kind>()) {}" << '\n' << '\n';
+  out << "  T& operator[](const Kind& node) {" << '\n';
+  out << "    if (node.nodeId>=values.size()) values.resize(node.nodeId+1);" << '\n';
+  out << "    return values[node.nodeId];" << '\n';
+  out << "  }" << '\n';
+  out << "  const T* find(const Kind& node) const { return node.nodeId<values.size()?&values[node.nodeId]:nullptr; }" << '\n';
+  out << "};" << '\n';
+  out << "#endif" << '\n' << '\n';
+}
+
+void generateHooks(const std::vector<std::unique_ptr<Node>>& nodes) {
+  out << "#ifdef ASTGEN_STATS" << '\n';
+  out << "// Inline children were counted when constructed, but their bytes are part of their owner's" << '\n';
+  for (auto& nodePtr : nodes) {
+    out << "inline void astStatsEmbedded(const " << nodePtr->name->id << "&) {";
+    for (auto& a : nodePtr->attributes) {
+      if (embedded(*a)) out << " AstStats::add(AstStats::get().bytes[KindId<" << a->type->id->id << ">::value],0-uint64_t(sizeof(" << a->type->id->id << ")));";
+    }
+    out << " }" << '\n';
+  }
+  out << "#endif" << '\n' << '\n';
+  out << "// Nodes constructed on a thread while an AstHooksOff is alive there get no id, and are" << '\n';
+  out << "// neither indexed nor counted" << '\n';
+  out << "struct AstHooksOff {" << '\n';
+  out << "  static bool& active() { static thread_local bool off=false; return off; }" << '\n';
+  out << "  bool previous;" << '\n';
+  out << "  AstHooksOff() : previous(active()) { active()=true; }" << '\n';
+  out << "  ~AstHooksOff() { active()=previous; }" << '\n';
+  out << "};" << '\n' << '\n';
+  out << "// Construction and destruction hooks" << '\n';
+  out << "template<class T> void astConstructed(T& node) {" << '\n';
+  out << "#if defined(ASTGEN_IDS)||defined(ASTGEN_INDEX)||defined(ASTGEN_STATS)" << '\n';
+  out << "  if (AstHooksOff::active()) return;" << '\n';
+  out << "#endif" << '\n';
+  out << "#ifdef ASTGEN_IDS" << '\n';
+  out << "  node.nodeId=AstIdSpace::current().allocate(KindId<T>::value);" << '\n';
+  out << "#endif" << '\n';
+  out << "#ifdef ASTGEN_INDEX" << '\n';
+  out << "  if (AstIndex::active()) AstIndex::active()->add(node);" << '\n';
+  out << "#endif" << '\n';
+  out << "#ifdef ASTGEN_STATS" << '\n';
+  out << "  node.statsKind.value=KindId<T>::value;" << '\n';
+  out << "  AstStats::add(AstStats::get().constructed[KindId<T>::value],1);" << '\n';
+  out << "  AstStats::add(AstStats::get().bytes[KindId<T>::value],sizeof(T));" << '\n';
+  out << "  astStatsEmbedded(node);" << '\n';
+  out << "#endif" << '\n';
+  out << "}" << '\n' << '\n';
+  out << "inline void astDestroyed(Ast& node) {" << '\n';
+  out << "#ifdef ASTGEN_INDEX" << '\n';
+  out << "  if (node.indexSlot.index) node.indexSlot.index->remove(node);" << '\n';
+  out << "#endif" << '\n';
+  out << "#ifdef ASTGEN_STATS" << '\n';
+  out << "  if (node.statsKind.value<kindCount) AstStats::add(AstStats::get().destroyed[node.statsKind.value],1);" << '\n';
+  out << "#endif" << '\n';
+  out << "}" << '\n' << '\n';
+  out << "// Called when to is move-constructed from from, which is then destroyed" << '\n';
+  out << "inline void astMoved(Ast& from,Ast& to) {" << '\n';
+  out << "#ifdef ASTGEN_INDEX" << '\n';
+  out << "  if (from.indexSlot.index) from.indexSlot.index->transfer(from,to);" << '\n';
+  out << "#endif" << '\n';
+  out << "#ifdef ASTGEN_STATS" << '\n';
+  out << "  to.statsKind.value=from.statsKind.value;" << '\n';
+  out << "  from.statsKind.value=~0u;" << '\n';
+  out << "#endif" << '\n';
+  out << "}" << '\n' << '\n';
+  out << "inline void astCast(bool ok) {" << '\n';
+  out << "#ifdef ASTGEN_STATS" << '\n';
+  out << "  AstStats::add(AstStats::get().casts,1);" << '\n';
+  out << "  AstStats::add(AstStats::get().castFailures,!ok);" << '\n';
+  out << "#endif" << '\n';
+  out << "}" << '\n' << '\n';
+}
+
+// Names are matched by length first, so a kind or enum value costs at most a few memcmps
+static void generateNameSwitch(const std::vector<std::pair<std::string,std::string>>& cases,const std::string& indent) {
+  std::map<size_t,std::vector<const std::pair<std::string,std::string>*>> byLength;
+  for (auto& c : cases) byLength[c.first.size()].push_back(&c);
+  out << indent << "switch (length) {" << '\n';
+  for (auto& group : byLength) {
+    out << indent << "  case " << group.first << ":" << '\n';
+    for (auto c : group.second) {
+      out << indent << "    if (!memcmp(name,\"" << c->first << "\"," << group.first << ")) " << c->second << '\n';
+    }
+    out << indent << "    break;" << '\n';
+  }
+  out << indent << "}" << '\n';
+}
+
+void generateReader(const std::vector<std::unique_ptr<Node>>& nodes,const std::vector<std::unique_ptr<Enum>>& enums) {
+  out << "#include <cstdlib>" << '\n';
+  out << "#include <cstring>" << '\n';
+  out << "#include <limits>" << '\n';
+  out << "#include <stdexcept>" << '\n' << '\n';
+  out << "// Rebuilds trees from operator<< dumps in one forward pass. Every token is decided by its" << '\n';
+  out << "// first character, so the reader never backtracks; malformed input throws std::runtime_error." << '\n';
+  out << "//   AstReader reader(text);" << '\n';
+  out << "//   std::unique_ptr<Program> program=reader.read<Program>();" << '\n';
+  out << "struct AstReader {" << '\n';
+  out << "  const char* begin;" << '\n';
+  out << "  const char* pos;" << '\n';
+  out << "  const char* end;" << '\n';
+  out << "  AstReader(const char* begin,const char* end) : begin(begin),pos(begin),end(end) {}" << '\n';
+  out << "  explicit AstReader(const std::string& text) : AstReader(text.data(),text.data()+text.size()) {}" << '\n';
+  out << "  explicit AstReader(const char* text) : AstReader(text,text+strlen(text)) {}" << '\n';
+  out << "  // Whether only whitespace is left" << '\n';
+  out << "  bool done() { skip(); return pos==end; }" << '\n' << '\n';
+  out << "  // Reads any node; () reads as a missing child" << '\n';
+  out << "  std::unique_ptr<Ast> read() {" << '\n';
+  out << "    expect('(');" << '\n';
+  out << "    if (peek(')')) { ++pos; return nullptr; }" << '\n';
+  out << "    size_t length;" << '\n';
+  out << "    const char* name=readName(length);" << '\n';
+  out << "    expect(':');" << '\n';
+  std::vector<std::pair<std::string,std::string>> kinds;
+  for (auto& node : nodes) kinds.push_back({node->name->id,"return read"+node->name->id+"();"});
+  generateNameSwitch(kinds,"    ");
+  out << "    pos=name;" << '\n';
+  out << "    fail(\"node name\");" << '\n';
+  out << "  }" << '\n';
+  out << "  template<class T> std::unique_ptr<T> read() {" << '\n';
+  out << "    std::unique_ptr<Ast> node=read();" << '\n';
+  out << "    T* t=dynamic_cast<T*>(node.get());" << '\n';
+  out << "    if (node&&!t) fail(\"a node of the requested type\");" << '\n';
+  out << "    node.release();" << '\n';
+  out << "    return std::unique_ptr<T>(t);" << '\n';
+  out << "  }" << '\n' << '\n';
+
+  out << "  // Nodes whose opening \"(Name:\" has been read" << '\n';
+  for (auto& node : nodes) {
+    std::string name=node->name->id;
+    out << "  std::unique_ptr<" << name << "> read" << name << "() { std::unique_ptr<" << name << "> node(new " << name << "()); fill(*node); return node; }" << '\n';
+  }
+  for (auto& node : nodes) {
+    out << "  void fill(" << node->name->id << "& node) {" << '\n';
+    for (auto& a : node->attributes) {
+      std::string field="node."+a->name->id,type=a->type->id->id;
+      if (a->type->collection) {
+        out << "    expect('[');" << '\n';
+        out << "    while (!peek(']')) " << field << ".push_back(read<" << type << ">());" << '\n';
+        out << "    ++pos;" << '\n';
+      } else if (simpleType(type)) {
+        out << "    readScalar(" << field << ");" << '\n';
+      } else if (a->type->inlined) {
+        out << "    header(\"" << type << "\"," << type.size() << ");" << '\n';
+        out << "    fill(" << field << ");" << '\n';
+      } else {
+        out << "    " << field << "=read<" << type << ">();" << '\n';
+      }
+    }
+    out << "    expect(')');" << '\n';
+    if (derivedAttributes) out << "    node.adopt();" << '\n';
+    out << "  }" << '\n';
+  }
+  out << '\n';
+
+  out << "  void readScalar(int64_t& value) { value=readInteger<int64_t>(); }" << '\n';
+  for (auto integer : integerTypes) {
+    out << "  void readScalar(" << integer << "& value) { value=readInteger<" << integer << ">(); }" << '\n';
+  }
+  out << "  void readScalar(bool& value) { value=readInteger<int64_t>()!=0; }" << '\n';
+  out << "  void readScalar(double& value) {" << '\n';
+  out << "    skip();" << '\n';
+  out << "    char text[40];" << '\n';
+  out << "    size_t length=0;" << '\n';
+  out << "    while (pos<end&&length<sizeof(text)-1&&(isalnum(uint8_t(*pos))||*pos=='-'||*pos=='+'||*pos=='.')) text[length++]=*pos++;" << '\n';
+  out << "    text[length]=0;" << '\n';
+  out << "    char* stop;" << '\n';
+  out << "    value=strtod(text,&stop);" << '\n';
+  out << "    if (length==0||*stop) { pos-=length; fail(\"number\"); }" << '\n';
+  out << "  }" << '\n';
+  out << "  void readScalar(std::string& value) {" << '\n';
+  out << "    expect('\"');" << '\n';
+  out << "    value.clear();" << '\n';
+  out << "    const char* run=pos;" << '\n';
+  out << "    for (;;) {" << '\n';
+  out << "      if (pos==end) fail(\"closing quote\");" << '\n';
+  out << "      if (*pos=='\"') break;" << '\n';
+  out << "      if (*pos++!='\\\\') continue;" << '\n';
+  out << "      value.append(run,pos-1);" << '\n';
+  out << "      if (pos==end) fail(\"escaped character\");" << '\n';
+  out << "      value+=*pos=='n'?'\\n':*pos;" << '\n';
+  out << "      run=++pos;" << '\n';
+  out << "    }" << '\n';
+  out << "    value.append(run,pos++);" << '\n';
+  out << "  }" << '\n';
+  for (auto& e : enums) {
+    out << "  void readScalar(" << e->name->id << "& value) {" << '\n';
+    out << "    size_t length;" << '\n';
+    out << "    const char* name=readName(length);" << '\n';
+    std::vector<std::pair<std::string,std::string>> values;
+    for (auto& v : e->values) values.push_back({v->id,"{ value="+e->name->id+"::"+v->id+"; return; }"});
+    generateNameSwitch(values,"    ");
+    out << "    pos=name;" << '\n';
+    out << "    fail(\"" << e->name->id << " value\");" << '\n';
+    out << "  }" << '\n';
+  }
+  out << '\n';
+
+  out << "  // A decimal integer, which must fit in T" << '\n';
+  out << "  template<class T> T readInteger() {" << '\n';
+  out << "    skip();" << '\n';
+  out << "    const char* start=pos;" << '\n';
+  out << "    bool negative=pos<end&&*pos=='-';" << '\n';
+  out << "    pos+=negative;" << '\n';
+  out << "    if (pos==end||*pos<'0'||*pos>'9') fail(\"integer\");" << '\n';
+  out << "    uint64_t limit=negative?0-uint64_t(std::numeric_limits<T>::min()):uint64_t(std::numeric_limits<T>::max());" << '\n';
+  out << "    uint64_t value=0;" << '\n';
+  out << "    while (pos<end&&*pos>='0'&&*pos<='9') {" << '\n';
+  out << "      uint64_t digit=uint64_t(*pos++-'0');" << '\n';
+  out << "      if (value>limit/10||(value==limit/10&&digit>limit%10)) { pos=start; fail(\"integer in range\"); }" << '\n';
+  out << "      value=value*10+digit;" << '\n';
+  out << "    }" << '\n';
+  out << "    return T(negative?0-value:value);" << '\n';
+  out << "  }" << '\n';
+  out << "  const char* readName(size_t& length) {" << '\n';
+  out << "    skip();" << '\n';
+  out << "    const char* name=pos;" << '\n';
+  out << "    while (pos<end&&(isalnum(uint8_t(*pos))||*pos=='_')) ++pos;" << '\n';
+  out << "    length=pos-name;" << '\n';
+  out << "    if (!length) fail(\"name\");" << '\n';
+  out << "    return name;" << '\n';
+  out << "  }" << '\n';
+  out << "  // Opening of an inline child, whose type is known" << '\n';
+  out << "  void header(const char* name,size_t length) {" << '\n';
+  out << "    expect('(');" << '\n';
+  out << "    skip();" << '\n';
+  out << "    if (size_t(end-pos)<length||memcmp(pos,name,length)) fail(name);" << '\n';
+  out << "    pos+=length;" << '\n';
+  out << "    expect(':');" << '\n';
+  out << "  }" << '\n';
+  out << "  void skip() { while (pos<end&&(*pos==' '||*pos=='\\n'||*pos=='\\t'||*pos=='\\r')) ++pos; }" << '\n';
+  out << "  bool peek(char c) { skip(); return pos<end&&*pos==c; }" << '\n';
+  out << "  void expect(char c) { if (!peek(c)) fail(std::string(\"'\")+c+\"'\"); ++pos; }" << '\n';
+  out << "  [[noreturn]] void fail(const std::string& expected) {" << '\n';
+  out << "    throw std::runtime_error(\"AST dump: expected \"+expected+\" at offset \"+std::to_string(pos-begin));" << '\n';
+  out << "  }" << '\n';
+  out << "};" << '\n' << '\n';
+}
+
+void generateEventStream(const std::vector<std::unique_ptr<Node>>& nodes,const std::vector<std::unique_ptr<Enum>>& enums) {
+  out << "#include <algorithm>" << '\n' << '\n';
+  out << "// Streaming event encoding, one event per Visitor callback. A node's scalar fields follow" << '\n';
+  out << "// its BeginNode event, so a reader can pass visitPre a node with its scalars set. Integers" << '\n';
+  out << "// are zigzag varints, doubles 8 bytes little-endian, strings a varint length and the bytes." << '\n';
+  out << "enum class AstEvent : uint8_t { BeginNode=1, EndNode, Scalar, BeginCollection, EndCollection, Empty };" << '\n' << '\n';
+
+  out << "// Writes trees as events while they are visited, flushing every 64KB" << '\n';
+  out << "//   AstEventWriter writer(std::cout); writer.write(*program);" << '\n';
+  out << "struct AstEventWriter : Visitor {" << '\n';
+  out << "  std::ostream& out;" << '\n';
+  out << "  std::string buffer;" << '\n';
+  out << "  explicit AstEventWriter(std::ostream& out) : out(out) { buffer.reserve(1<<16); }" << '\n';
+  out << "  ~AstEventWriter() { flush(); }" << '\n';
+  out << "  void write(Ast& node) { node.accept(\"\",*this); }" << '\n';
+  out << "  void flush() { out.write(buffer.data(),buffer.size()); buffer.clear(); }" << '\n' << '\n';
+  for (auto& node : nodes) {
+    std::string name=node->name->id;
+    out << "  void visitPre(const std::string&,const " << name << "& node) {" << '\n';
+    out << "    event(AstEvent::BeginNode);" << '\n';
+    out << "    varint(KindId<" << name << ">::value);" << '\n';
+    for (auto& a : node->attributes) {
+      if (simpleType(a->type->id->id)) out << "    scalar(node." << a->name->id << ");" << '\n';
+    }
+    out << "  }" << '\n';
+    out << "  void visitPost(const std::string&,const " << name << "&) { event(AstEvent::EndNode); }" << '\n';
+  }
+  out << "  void collectionPre() { event(AstEvent::BeginCollection); }" << '\n';
+  out << "  void collectionPost() { event(AstEvent::EndCollection); }" << '\n';
+  out << "  void emptyElement() { event(AstEvent::Empty); }" << '\n' << '\n';
+  out << "  void event(AstEvent event) {" << '\n';
+  out << "    if (buffer.size()>=1<<16) flush();" << '\n';
+  out << "    buffer+=char(event);" << '\n';
+  out << "  }" << '\n';
+  out << "  void varint(uint64_t value) {" << '\n';
+  out << "    for (;value>=128;value>>=7) buffer+=char(value|128);" << '\n';
+  out << "    buffer+=char(value);" << '\n';
+  out << "  }" << '\n';
+  out << "  void scalar(int64_t value) { event(AstEvent::Scalar); varint((uint64_t(value)<<1)^uint64_t(value>>63)); }" << '\n';
+  out << "  void scalar(double value) {" << '\n';
+  out << "    event(AstEvent::Scalar);" << '\n';
+  out << "    uint64_t bits;" << '\n';
+  out << "    memcpy(&bits,&value,8);" << '\n';
+  out << "    for (int byte=0;byte<8;++byte) buffer+=char(bits>>(byte*8));" << '\n';
+  out << "  }" << '\n';
+  out << "  void scalar(const std::string& value) { event(AstEvent::Scalar); varint(value.size()); buffer+=value; }" << '\n';
+  for (auto integer : integerTypes) {
+    out << "  void scalar(" << integer << " value) { scalar(int64_t(value)); }" << '\n';
+  }
+  out << "  void scalar(bool value) { scalar(int64_t(value)); }" << '\n';
+  for (auto& e : enums) {
+    out << "  void scalar(" << e->name->id << " value) { scalar(int64_t(value)); }" << '\n';
+  }
+  out << "};" << '\n' << '\n';
+
+  out << "// Reads the events of one tree after another from a stream, keeping only 64KB of input." << '\n';
+  out << "// replay() drives a Visitor in the order accept() would; the nodes it passes to visitPre" << '\n';
+  out << "// and visitPost carry their scalar fields but no children, so memory stays proportional" << '\n';
+  out << "// to the depth of the tree. These stand-ins are reused and made with AstHooksOff, so ids," << '\n';
+  out << "// AstIndex and AstStats never see them. read() builds the tree instead. Both throw" << '\n';
+  out << "// std::runtime_error on malformed input." << '\n';
+  out << "//   AstEventReader reader(std::cin); while (reader.replay(visitor)) {}" << '\n';
+  out << "struct AstEventReader {" << '\n';
+  out << "  std::istream& in;" << '\n';
+  out << "  std::vector<char> buffer;" << '\n';
+  out << "  size_t pos,size;" << '\n';
+  out << "  uint64_t offset; // of the buffer in the stream" << '\n';
+  out << "  std::vector<std::unique_ptr<Ast>> standIns[kindSlots]; // per kind, one per nesting level" << '\n';
+  out << "  size_t standInsUsed[kindSlots];" << '\n';
+  out << "  explicit AstEventReader(std::istream& in) : in(in),buffer(1<<16),pos(0),size(0),offset(0) { std::fill(standInsUsed,standInsUsed+kindSlots,0); }" << '\n' << '\n';
+  out << "  // Replays the next tree, false at the end of the stream" << '\n';
+  out << "  bool replay(Visitor& visitor,const std::string& name=\"\") {" << '\n';
+  out << "    if (pos==size&&!refill()) return false;" << '\n';
+  out << "    std::fill(standInsUsed,standInsUsed+kindSlots,0);" << '\n';
+  out << "    replayChild(name,visitor);" << '\n';
+  out << "    return true;" << '\n';
+  out << "  }" << '\n';
+  out << "  // Builds the next tree, nullptr at the end of the stream" << '\n';
+  out << "  std::unique_ptr<Ast> read() {" << '\n';
+  out << "    if (pos==size&&!refill()) return nullptr;" << '\n';
+  out << "    return build<Ast>();" << '\n';
+  out << "  }" << '\n' << '\n';
+
+  out << "  void replayChild(const std::string& name,Visitor& visitor) {" << '\n';
+  out << "    AstEvent event=next();" << '\n';
+  out << "    if (event==AstEvent::Empty) { visitor.emptyElement(); return; }" << '\n';
+  out << "    if (event!=AstEvent::BeginNode) fail(\"a node\");" << '\n';
+  out << "    switch (varint()) {" << '\n';
+  for (auto& node : nodes) {
+    std::string name=node->name->id;
+    out << "      case KindId<" << name << ">::value: replay" << name << "(name,visitor); return;" << '\n';
+  }
+  out << "    }" << '\n';
+  out << "    fail(\"a node kind\");" << '\n';
+  out << "  }" << '\n';
+  out << "  template<class T> T& acquireStandIn() {" << '\n';
+  out << "    auto& free=standIns[KindId<T>::value];" << '\n';
+  out << "    size_t& used=standInsUsed[KindId<T>::value];" << '\n';
+  out << "    if (used==free.size()) {" << '\n';
+  out << "      AstHooksOff off;" << '\n';
+  out << "      free.emplace_back(new T());" << '\n';
+  out << "    }" << '\n';
+  out << "    return static_cast<T&>(*free[used++]);" << '\n';
+  out << "  }" << '\n';
+  for (auto& node : nodes) {
+    std::string name=node->name->id;
+    out << "  void replay" << name << "(const std::string& name,Visitor& visitor) {" << '\n';
+    out << "    " << name << "& node=acquireStandIn<" << name << ">();" << '\n';
+    out << "    scalars(node);" << '\n';
+    if (derivedAttributes) out << "    node.invalidate();" << '\n';
+    out << "    visitor.visitPre(name,node);" << '\n';
+    for (auto& a : node->attributes) {
+      std::string field=a->name->id;
+      if (simpleType(a->type->id->id)) {
+        out << "    visitor.visit(\"" << field << "\",node." << field << ");" << '\n';
+      } else if (a->type->collection) {
+        out << "    expect(AstEvent::BeginCollection);" << '\n';
+        out << "    visitor.collectionPre();" << '\n';
+        out << "    while (!at(AstEvent::EndCollection)) replayChild(\"" << field << "\",visitor);" << '\n';
+        out << "    visitor.collectionPost();" << '\n';
+      } else {
+        out << "    replayChild(\"" << field << "\",visitor);" << '\n';
+      }
+    }
+    out << "    expect(AstEvent::EndNode);" << '\n';
+    out << "    visitor.visitPost(name,node);" << '\n';
+    out << "    --standInsUsed[KindId<" << name << ">::value];" << '\n';
+    out << "  }" << '\n';
+  }
+  out << '\n';
+
+  out << "  template<class T> std::unique_ptr<T> build() {" << '\n';
+  out << "    AstEvent event=next();" << '\n';
+  out << "    if (event==AstEvent::Empty) return nullptr;" << '\n';
+  out << "    if (event!=AstEvent::BeginNode) fail(\"a node\");" << '\n';
+  out << "    std::unique_ptr<Ast> node;" << '\n';
+  out << "    switch (varint()) {" << '\n';
+  for (auto& node : nodes) {
+    std::string name=node->name->id;
+    out << "      case KindId<" << name << ">::value: { " << name << "* created=new " << name << "(); node.reset(created); fill(*created); break; }" << '\n';
+  }
+  out << "      default: fail(\"a node kind\");" << '\n';
+  out << "    }" << '\n';
+  out << "    T* t=dynamic_cast<T*>(node.get());" << '\n';
+  out << "    if (!t) fail(\"a node of the requested type\");" << '\n';
+  out << "    node.release();" << '\n';
+  out << "    return std::unique_ptr<T>(t);" << '\n';
+  out << "  }" << '\n';
+  for (auto& node : nodes) {
+    out << "  void scalars(" << node->name->id << "& node) {" << '\n';
+    for (auto& a : node->attributes) {
+      if (simpleType(a->type->id->id)) out << "    scalar(node." << a->name->id << ");" << '\n';
+    }
+    out << "  }" << '\n';
+    out << "  void fill(" << node->name->id << "& node) {" << '\n';
+    out << "    scalars(node);" << '\n';
+    for (auto& a : node->attributes) {
+      std::string field="node."+a->name->id,type=a->type->id->id;
+      if (simpleType(type)) continue;
+      if (a->type->collection) {
+        out << "    expect(AstEvent::BeginCollection);" << '\n';
+        out << "    while (!at(AstEvent::EndCollection)) " << field << ".push_back(build<" << type << ">());" << '\n';
+      } else if (a->type->inlined) {
+        out << "    expect(AstEvent::BeginNode);" << '\n';
+        out << "    if (varint()!=KindId<" << type << ">::value) fail(\"a " << type << "\");" << '\n';
+        out << "    fill(" << field << ");" << '\n';
+      } else {
+        out << "    " << field << "=build<" << type << ">();" << '\n';
+      }
+    }
+    out << "    expect(AstEvent::EndNode);" << '\n';
+    if (derivedAttributes) out << "    node.adopt();" << '\n';
+    out << "  }" << '\n';
+  }
+  out << '\n';
+
+  out << "  void scalar(int64_t& value) {" << '\n';
+  out << "    expect(AstEvent::Scalar);" << '\n';
+  out << "    uint64_t bits=varint();" << '\n';
+  out << "    value=int64_t(bits>>1)^-int64_t(bits&1);" << '\n';
+  out << "  }" << '\n';
+  out << "  void scalar(double& value) {" << '\n';
+  out << "    expect(AstEvent::Scalar);" << '\n';
+  out << "    uint64_t bits=0;" << '\n';
+  out << "    for (int byte=0;byte<8;++byte) bits|=uint64_t(uint8_t(next()))<<(byte*8);" << '\n';
+  out << "    memcpy(&value,&bits,8);" << '\n';
+  out << "  }" << '\n';
+  out << "  void scalar(std::string& value) {" << '\n';
+  out << "    expect(AstEvent::Scalar);" << '\n';
+  out << "    uint64_t length=varint();" << '\n';
+  out << "    value.clear();" << '\n';
+  out << "    while (length) {" << '\n';
+  out << "      if (pos==size&&!refill()) fail(\"more string bytes\");" << '\n';
+  out << "      size_t chunk=std::min<uint64_t>(length,size-pos);" << '\n';
+  out << "      value.append(&buffer[pos],chunk);" << '\n';
+  out << "      pos+=chunk;" << '\n';
+  out << "      length-=chunk;" << '\n';
+  out << "    }" << '\n';
+  out << "  }" << '\n';
+  for (auto integer : integerTypes) {
+    out << "  void scalar(" << integer << "& value) { int64_t wide; scalar(wide); value=" << integer << "(wide); }" << '\n';
+  }
+  out << "  void scalar(bool& value) { int64_t wide; scalar(wide); value=wide!=0; }" << '\n';
+  for (auto& e : enums) {
+    out << "  void scalar(" << e->name->id << "& value) {" << '\n';
+    out << "    int64_t wide;" << '\n';
+    out << "    scalar(wide);" << '\n';
+    out << "    if (uint64_t(wide)>=" << e->values.size() << ") fail(\"a " << e->name->id << " value\");" << '\n';
+    out << "    value=" << e->name->id << "(wide);" << '\n';
+    out << "  }" << '\n';
+  }
+  out << '\n';
+
+  out << "  bool refill() {" << '\n';
+  out << "    offset+=size;" << '\n';
+  out << "    pos=0;" << '\n';
+  out << "    in.read(buffer.data(),buffer.size());" << '\n';
+  out << "    size=in.gcount();" << '\n';
+  out << "    return size>0;" << '\n';
+  out << "  }" << '\n';
+  out << "  AstEvent next() {" << '\n';
+  out << "    if (pos==size&&!refill()) fail(\"more events\");" << '\n';
+  out << "    return AstEvent(buffer[pos++]);" << '\n';
+  out << "  }" << '\n';
+  out << "  // Consumes the event if it comes next" << '\n';
+  out << "  bool at(AstEvent event) {" << '\n';
+  out << "    if (pos==size&&!refill()) fail(\"more events\");" << '\n';
+  out << "    if (AstEvent(buffer[pos])!=event) return false;" << '\n';
+  out << "    ++pos;" << '\n';
+  out << "    return true;" << '\n';
+  out << "  }" << '\n';
+  out << "  void expect(AstEvent event) { if (next()!=event) { --pos; fail(\"event \"+std::to_string(int(event))); } }" << '\n';
+  out << "  uint64_t varint() {" << '\n';
+  out << "    uint64_t value=0;" << '\n';
+  out << "    for (int shift=0;shift<64;shift+=7) {" << '\n';
+  out << "      uint8_t byte=uint8_t(next());" << '\n';
+  out << "      value|=uint64_t(byte&127)<<shift;" << '\n';
+  out << "      if (!(byte&128)) return value;" << '\n';
+  out << "    }" << '\n';
+  out << "    fail(\"a shorter varint\");" << '\n';
+  out << "  }" << '\n';
+  out << "  [[noreturn]] void fail(const std::string& expected) {" << '\n';
+  out << "    throw std::runtime_error(\"AST events: expected \"+expected+\" at offset \"+std::to_string(offset+pos));" << '\n';
+  out << "  }" << '\n';
+  out << "};" << '\n' << '\n';
+}
+
+void generateBuilder() {
+  out << "#include <exception>" << '\n' << '\n';
+  out << "// Builds trees on several threads. make() allocates from the builder's arena (ASTGEN_ARENA)," << '\n';
+  out << "// else from the heap or the thread's pool cache (ASTGEN_POOL). buildItems() hands each worker" << '\n';
+  out << "// its own builder, on a child arena, and its own slots of the collection, so subtrees are" << '\n';
+  out << "// stitched into the parent without locks and without copying a node." << '\n';
+  out << "//   AstBuilder builder(&arena);" << '\n';
+  out << "//   auto program=builder.make<Program>();" << '\n';
+  out << "//   builder.buildItems(program->blocks,files.size(),[&](std::size_t i,AstBuilder& local) { return parse(files[i],local); });" << '\n';
+  out << "struct AstBuilder {" << '\n';
+  out << "  AstArena* arena;" << '\n';
+  out << "  std::size_t threads; // for buildItems, 0 for one per core" << '\n';
+  out << "  explicit AstBuilder(AstArena* arena=nullptr,std::size_t threads=0) : arena(arena),threads(threads) {}" << '\n' << '\n';
+  out << "  template<class T,class... Args> std::unique_ptr<T> make(Args&&... args) {" << '\n';
+  out << "#ifdef ASTGEN_ARENA" << '\n';
+  out << "    if (arena) return std::unique_ptr<T>(new (*arena) T(std::forward<Args>(args)...));" << '\n';
+  out << "#endif" << '\n';
+  out << "    return std::unique_ptr<T>(new T(std::forward<Args>(args)...));" << '\n';
+  out << "  }" << '\n' << '\n';
+  out << "  // Appends build(i,builder) for every i<count. Each thread builds one slice; its builder" << '\n';
+  out << "  // runs nested buildItems serially. Nodes take ids (ASTGEN_IDS) from the caller's AstIdSpace, but are not" << '\n';
+  out << "  // added to its AstIndex. With derived attributes, link() the owner of items afterwards." << '\n';
+  out << "  // If build throws, items is restored and the first exception rethrown after the join." << '\n';
+  out << "  template<class T,class Build> void buildItems(std::vector<std::unique_ptr<T>>& items,std::size_t count,Build build) {" << '\n';
+  out << "    std::size_t first=items.size();" << '\n';
+  out << "    items.resize(first+count);" << '\n';
+  out << "    std::size_t workers=threads?threads:std::thread::hardware_concurrency();" << '\n';
+  out << "    if (workers>count) workers=count;" << '\n';
+  out << "    if (workers<2) {" << '\n';
+  out << "      try {" << '\n';
+  out << "        for (std::size_t i=0;i<count;++i) items[first+i]=build(i,*this);" << '\n';
+  out << "      } catch (...) {" << '\n';
+  out << "        items.resize(first);" << '\n';
+  out << "        throw;" << '\n';
+  out << "      }" << '\n';
+  out << "      return;" << '\n';
+  out << "    }" << '\n';
+  out << "    std::size_t slice=(count+workers-1)/workers;" << '\n';
+  out << "#ifdef ASTGEN_IDS" << '\n';
+  out << "    AstIdSpace* space=AstIdSpace::active();" << '\n';
+  out << "#endif" << '\n';
+  out << "    std::vector<std::exception_ptr> errors(workers);" << '\n';
+  out << "    std::vector<std::thread> pool;" << '\n';
+  out << "    for (std::size_t begin=0,worker=0;begin<count;begin+=slice,++worker) {" << '\n';
+  out << "      AstBuilder local(nullptr,1);" << '\n';
+  out << "#ifdef ASTGEN_ARENA" << '\n';
+  out << "      if (arena) local.arena=&arena->child();" << '\n';
+  out << "#endif" << '\n';
+  out << "      std::size_t end=begin+slice<count?begin+slice:count;" << '\n';
+  out << "      std::exception_ptr& error=errors[worker];" << '\n';
+  out << "      pool.emplace_back([=,&items,&build,&error]() mutable {" << '\n';
+  out << "#ifdef ASTGEN_IDS" << '\n';
+  out << "        AstIdSpace::active()=space;" << '\n';
+  out << "#endif" << '\n';
+  out << "        try {" << '\n';
+  out << "          for (std::size_t i=begin;i<end;++i) items[first+i]=build(i,local);" << '\n';
+  out << "        } catch (...) {" << '\n';
+  out << "          error=std::current_exception();" << '\n';
+  out << "        }" << '\n';
+  out << "      });" << '\n';
+  out << "    }" << '\n';
+  out << "    for (auto& worker : pool) worker.join();" << '\n';
+  out << "    for (auto& error : errors) {" << '\n';
+  out << "      if (!error) continue;" << '\n';
+  out << "      items.resize(first);" << '\n';
+  out << "      std::rethrow_exception(error);" << '\n';
+  out << "    }" << '\n';
+  out << "  }" << '\n';
+  out << "};" << '\n' << '\n';
+}
+
+void generateClone(const std::vector<std::unique_ptr<Node>>& nodes) {
+  out << "#ifdef ASTGEN_ARENA" << '\n';
+  out << "#include <mutex>" << '\n' << '\n';
+  out << "// Bump allocator for cloned trees. Nodes in an arena are destroyed as usual, but their" << '\n';
+  out << "// memory is only released with the arena, which must outlive them." << '\n';
+  out << "struct AstArena {" << '\n';
+  out << "  std::size_t blockSize;" << '\n';
+  out << "  std::vector<std::unique_ptr<char[]>> blocks;" << '\n';
+  out << "  char* pos;" << '\n';
+  out << "  char* end;" << '\n';
+  out << "  std::mutex mutex;" << '\n';
+  out << "  std::vector<std::unique_ptr<AstArena>> children;" << '\n' << '\n';
+  out << "  explicit AstArena(std::size_t blockSize=1<<20) : blockSize(blockSize),pos(nullptr),end(nullptr) {}" << '\n' << '\n';
+  out << "  // Makes the next allocations of up to bytes in total come from one block" << '\n';
+  out << "  void reserve(std::size_t bytes) {" << '\n';
+  out << "    if (std::size_t(end-pos)>=bytes) return;" << '\n';
+  out << "    if (bytes<blockSize) bytes=blockSize;" << '\n';
+  out << "    blocks.emplace_back(new char[bytes]);" << '\n';
+  out << "    pos=blocks.back().get(); end=pos+bytes;" << '\n';
+  out << "  }" << '\n' << '\n';
+  out << "  void* allocate(std::size_t size) {" << '\n';
+  out << "    size=(size+15)&~std::size_t(15);" << '\n';
+  out << "    reserve(size);" << '\n';
+  out << "    void* p=pos; pos+=size;" << '\n';
+  out << "    return p;" << '\n';
+  out << "  }" << '\n' << '\n';
+  out << "  // Arena bytes taken by a node of the given size, including its header" << '\n';
+  out << "  static std::size_t footprint(std::size_t size) { return (size+16+15)&~std::size_t(15); }" << '\n' << '\n';
+  out << "  // An arena for another thread, released together with this one" << '\n';
+  out << "  AstArena& child() {" << '\n';
+  out << "    std::lock_guard<std::mutex> lock(mutex);" << '\n';
+  out << "    children.emplace_back(new AstArena(blockSize));" << '\n';
+  out << "    return *children.back();" << '\n';
+  out << "  }" << '\n';
+  out << "};" << '\n' << '\n';
+  out << "// Every node is preceded by 16 bytes whose first one tells whether it lives in an arena" << '\n';
+  out << "inline void* Ast::operator new(std::size_t size) {" << '\n';
+  out << "  char* p=static_cast<char*>(::operator new(size+16));" << '\n';
+  out << "  p[0]=0;" << '\n';
+  out << "  return p+16;" << '\n';
+  out << "}" << '\n';
+  out << "inline void* Ast::operator new(std::size_t size,AstArena& arena) {" << '\n';
+  out << "  char* p=static_cast<char*>(arena.allocate(size+16));" << '\n';
+  out << "  p[0]=1;" << '\n';
+  out << "  return p+16;" << '\n';
+  out << "}" << '\n';
+  out << "inline void Ast::operator delete(void* p) {" << '\n';
+  out << "  if (p&&!static_cast<char*>(p)[-16]) ::operator delete(static_cast<char*>(p)-16);" << '\n';
+  out << "}" << '\n';
+  out << "inline void Ast::operator delete(void*,AstArena&) {}" << '\n';
+  out << "#endif" << '\n' << '\n';
+
+  out << "#include <thread>" << '\n' << '\n';
+  out << "template<class T> T* astNew(const CloneOptions& options) {" << '\n';
+  out << "#ifdef ASTGEN_ARENA" << '\n';
+  out << "  if (options.arena) return new (*options.arena) T();" << '\n';
+  out << "#endif" << '\n';
+  out << "  return new T();" << '\n';
+  out << "}" << '\n' << '\n';
+  out << "template<class T> void astCloneItems(const std::vector<std::unique_ptr<T>>& from,std::vector<std::unique_ptr<T>>& to,const CloneOptions& options);" << '\n' << '\n';
+
+  for (auto& nodePtr : nodes) {
+    Node& node=*nodePtr;
+    auto& name=node.name->id;
+    out << "inline Ast* " << name << "::cloneAst(const CloneOptions& options) const {" << '\n';
+    out << "  auto copy=astNew<" << name << ">(options);" << '\n';
+    out << "  copyInto(*copy,options);" << '\n';
+    out << "  return copy;" << '\n';
+    out << "}" << '\n';
+    out << "inline void " << name << "::copyInto(" << name << "& copy,const CloneOptions& options) const {" << '\n';
+    out << "  copy.line=line; copy.col=col;" << '\n';
+    for (auto& a : node.attributes) {
+      auto& field=a->name->id;
+      if (simpleType(a->type->id->id)) {
+        out << "  copy." << field << "=" << field << ";" << '\n';
+      } else if (a->type->collection) {
+        out << "  astCloneItems(" << field << ",copy." << field << ",options);" << '\n';
+      } else if (a->type->inlined) {
+        out << "  " << field << ".copyInto(copy." << field << ",options);" << '\n';
+      } else {
+        out << "  if (" << field << ") copy." << field << ".reset(static_cast<" << a->type->id->id << "*>(" << field << "->cloneAst(options)));" << '\n';
+      }
+    }
+    if (derivedAttributes) out << "  copy.adopt();" << '\n';
+    out << "}" << '\n' << '\n';
+  }
+}
+
+// Copies collections for clone(), on several threads from options.parallelThreshold items.
+// Defined after the index and ids, which the threads share with the caller.
+void generateCloneItems() {
+  out << "#include <exception>" << '\n' << '\n';
+  out << "template<class T> void astCloneItems(const std::vector<std::unique_ptr<T>>& from,std::vector<std::unique_ptr<T>>& to,const CloneOptions& options) {" << '\n';
+  out << "  to.resize(from.size());" << '\n';
+  out << "  std::size_t threads=options.threads?options.threads:std::thread::hardware_concurrency();" << '\n';
+  out << "  if (threads>from.size()) threads=from.size();" << '\n';
+  out << "  if (!options.parallelThreshold||from.size()<options.parallelThreshold||threads<2) {" << '\n';
+  out << "    for (std::size_t i=0;i<from.size();++i) if (from[i]) to[i].reset(static_cast<T*>(from[i]->cloneAst(options)));" << '\n';
+  out << "    return;" << '\n';
+  out << "  }" << '\n';
+  out << "  // Each thread copies a slice, into its own arena and without nested parallelism. As on" << '\n';
+  out << "  // the calling thread, the copies take ids (ASTGEN_IDS) from the caller's AstIdSpace and" << '\n';
+  out << "  // join the caller's AstIndex (ASTGEN_INDEX), through an index per thread merged after" << '\n';
+  out << "  // the join. The first exception a thread throws is rethrown after the join." << '\n';
+  out << "  std::size_t slice=(from.size()+threads-1)/threads;" << '\n';
+  out << "#ifdef ASTGEN_IDS" << '\n';
+  out << "  AstIdSpace* space=AstIdSpace::active();" << '\n';
+  out << "#endif" << '\n';
+  out << "#ifdef ASTGEN_INDEX" << '\n';
+  out << "  AstIndex* index=AstIndex::active();" << '\n';
+  out << "  std::vector<AstIndex> indexes(index?threads:0);" << '\n';
+  out << "#endif" << '\n';
+  out << "  std::vector<std::exception_ptr> errors(threads);" << '\n';
+  out << "  std::vector<std::thread> workers;" << '\n';
+  out << "  for (std::size_t begin=0,worker=0;begin<from.size();begin+=slice,++worker) {" << '\n';
+  out << "    CloneOptions local=options;" << '\n';
+  out << "    local.parallelThreshold=0;" << '\n';
+  out << "#ifdef ASTGEN_ARENA" << '\n';
+  out << "    if (options.arena) local.arena=&options.arena->child();" << '\n';
+  out << "#endif" << '\n';
+  out << "#ifdef ASTGEN_INDEX" << '\n';
+  out << "    AstIndex* workerIndex=index?&indexes[worker]:nullptr;" << '\n';
+  out << "#endif" << '\n';
+  out << "    std::size_t end=begin+slice<from.size()?begin+slice:from.size();" << '\n';
+  out << "    std::exception_ptr& error=errors[worker];" << '\n';
+  out << "    workers.emplace_back([=,&from,&to,&error]() {" << '\n';
+  out << "#ifdef ASTGEN_IDS" << '\n';
+  out << "      AstIdSpace::active()=space;" << '\n';
+  out << "#endif" << '\n';
+  out << "#ifdef ASTGEN_INDEX" << '\n';
+  out << "      AstIndex::active()=workerIndex;" << '\n';
+  out << "#endif" << '\n';
+  out << "      try {" << '\n';
+  out << "        for (std::size_t i=begin;i<end;++i) if (from[i]) to[i].reset(static_cast<T*>(from[i]->cloneAst(local)));" << '\n';
+  out << "      } catch (...) {" << '\n';
+  out << "        error=std::current_exception();" << '\n';
+  out << "      }" << '\n';
+  out << "    });" << '\n';
+  out << "  }" << '\n';
+  out << "  for (auto& worker : workers) worker.join();" << '\n';
+  out << "#ifdef ASTGEN_INDEX" << '\n';
+  out << "  for (auto& workerIndex : indexes) index->merge(workerIndex);" << '\n';
+  out << "#endif" << '\n';
+  out << "  for (auto& error : errors) if (error) std::rethrow_exception(error);" << '\n';
+  out << "}" << '\n' << '\n';
+}
+
+void generateTransformerBase(const std::vector<std::unique_ptr<Node>>& nodes) {
+  out << "// Rewrites a tree bottom-up in place: children are transformed before their parent, and" << '\n';
+  out << "// a hook returning a node replaces the visited one in its parent (nullptr keeps it)" << '\n';
+  out << "struct Transformer {" << '\n';
+  out << "  virtual ~Transformer() {}" << '\n';
+  for (auto& nodePtr : nodes) {
+    out << "  virtual std::unique_ptr<Ast> transform(" << nodePtr->name->id << "& node) { return nullptr; }" << '\n';
+  }
+  out << "};" << '\n' << '\n';
+}
+
+void generateTransformer(const std::vector<std::unique_ptr<Node>>& nodes) {
+  out << "// Transforms the node in slot and splices in its replacement, which must fit the slot." << '\n';
+  out << "// Returns whether the slot was replaced." << '\n';
+  out << "template<class T> bool transformTree(std::unique_ptr<T>& slot,Transformer& transformer) {" << '\n';
+  out << "  if (!slot) return false;" << '\n';
+  out << "  auto replacement=slot->transformWith(transformer);" << '\n';
+  out << "  if (!replacement) return false;" << '\n';
+  out << "  slot.reset(tryCast<T*>(replacement.release()));" << '\n';
+  out << "  return true;" << '\n';
+  out << "}" << '\n' << '\n';
+  for (auto& nodePtr : nodes) {
+    Node& node=*nodePtr;
+    out << "inline std::unique_ptr<Ast> " << node.name->id << "::transformWith(Transformer& transformer) {" << '\n';
+    // With derived attributes, a node whose children were replaced adopts them and is invalidated
+    bool children=false;
+    for (auto& a : node.attributes) children|=!simpleType(a->type->id->id);
+    bool track=derivedAttributes&&children;
+    if (track) out << "  bool replaced=false;" << '\n';
+    for (auto& a : node.attributes) {
+      auto& field=a->name->id;
+      if (simpleType(a->type->id->id)) continue;
+      if (a->type->collection) {
+        out << "  for (auto& item : this->" << field << ") " << (track?"replaced|=":"") << "transformTree(item,transformer);" << '\n';
+      } else if (a->type->inlined) {
+        out << "  if (auto replacement=this->" << field << ".transformWith(transformer)) { this->" << field << "=std::move(*tryCast<" << a->type->id->id << "*>(replacement.get()));" << (track?" replaced=true;":"") << " }" << '\n';
+      } else {
+        out << "  " << (track?"replaced|=":"") << "transformTree(this->" << field << ",transformer);" << '\n';
+      }
+    }
+    if (track) out << "  if (replaced) { adopt(); invalidate(); }" << '\n';
+    out << "  return transformer.transform(*this);" << '\n';
+    out << "}" << '\n' << '\n';
+  }
+}
+
+void generateWalker(const std::vector<std::unique_ptr<Node>>& nodes) {
+  out << "// What a Walker hook asks the traversal to do next" << '\n';
+  out << "enum class Walk : uint8_t { Continue, Skip, Abort };" << '\n' << '\n';
+  out << "// Traversal that hooks can steer: Skip in visitPre leaves out the children, Abort stops" << '\n';
+  out << "// the walk at once. walk() returns false if it was aborted." << '\n';
+  out << "struct Walker {" << '\n';
+  out << "  virtual ~Walker() {}" << '\n';
+  for (auto& nodePtr : nodes) {
+    out << "  virtual Walk visitPre(const " << nodePtr->name->id << "& node) { return Walk::Continue; }" << '\n';
+    out << "  virtual Walk visitPost(const " << nodePtr->name->id << "& node) { return Walk::Continue; }" << '\n';
+  }
+  out << "};" << '\n' << '\n';
+  for (auto& nodePtr : nodes) {
+    Node& node=*nodePtr;
+    out << "inline bool " << node.name->id << "::walk(Walker& walker) const {" << '\n';
+    out << "  Walk action=walker.visitPre(*this);" << '\n';
+    out << "  if (action==Walk::Abort) return false;" << '\n';
+    bool children=false;
+    for (auto& a : node.attributes) children|=!simpleType(a->type->id->id);
+    if (children) {
+      out << "  if (action==Walk::Continue) {" << '\n';
+      for (auto& a : node.attributes) {
+        auto& field=a->name->id;
+        if (simpleType(a->type->id->id)) continue;
+        if (a->type->collection) {
+          out << "    for (auto& item : this->" << field << ") if (item&&!item->walk(walker)) return false;" << '\n';
+        } else if (a->type->inlined) {
+          out << "    if (!this->" << field << ".walk(walker)) return false;" << '\n';
+        } else {
+          out << "    if (this->" << field << "&&!this->" << field << "->walk(walker)) return false;" << '\n';
+        }
+      }
+      out << "  }" << '\n';
+    }
+    out << "  return walker.visitPost(*this)!=Walk::Abort;" << '\n';
+    out << "}" << '\n' << '\n';
+  }
+}
+
+void generateDerived(const std::vector<std::unique_ptr<Node>>& nodes) {
+  out << "// Parent links: adopt() makes a node the parent of its children, link() does so for the" << '\n';
+  out << "// whole subtree. Setters of child fields adopt the new children and invalidate." << '\n';
+  for (auto& nodePtr : nodes) {
+    Node& node=*nodePtr;
+    auto& name=node.name->id;
+    out << "inline void " << name << "::adopt() {" << '\n';
+    for (auto& a : node.attributes) {
+      auto& field=a->name->id;
+      if (simpleType(a->type->id->id)) continue;
+      if (a->type->collection) {
+        out << "  for (auto& item : this->" << field << ") if (item) item->parent=this;" << '\n';
+      } else if (a->type->inlined) {
+        out << "  this->" << field << ".parent=this;" << '\n';
+        out << "  this->" << field << ".adopt();" << '\n';
+      } else {
+        out << "  if (this->" << field << ") this->" << field << "->parent=this;" << '\n';
+      }
+    }
+    out << "}" << '\n';
+    out << "inline void " << name << "::link() {" << '\n';
+    out << "  adopt();" << '\n';
+    for (auto& a : node.attributes) {
+      auto& field=a->name->id;
+      if (simpleType(a->type->id->id)) continue;
+      if (a->type->collection) {
+        out << "  for (auto& item : this->" << field << ") if (item) item->link();" << '\n';
+      } else if (a->type->inlined) {
+        out << "  this->" << field << ".link();" << '\n';
+      } else {
+        out << "  if (this->" << field << ") this->" << field << "->link();" << '\n';
+      }
+    }
+    out << "}" << '\n';
+    for (auto& a : node.attributes) {
+      if (simpleType(a->type->id->id)) continue;
+      std::string field=a->name->id,setter="set"+field;
+      setter[3]=toupper(setter[3]);
+      out << "inline void " << name << "::" << setter << "(" << memberType(*a) << " " << field << ") {" << '\n';
+      out << "  this->" << field << "=std::move(" << field << ");" << '\n';
+      if (a->type->collection) {
+        out << "  for (auto& item : this->" << field << ") if (item) item->parent=this;" << '\n';
+      } else if (a->type->inlined) {
+        out << "  this->" << field << ".parent=this;" << '\n';
+        out << "  this->" << field << ".adopt();" << '\n';
+      } else {
+        out << "  if (this->" << field << ") this->" << field << "->parent=this;" << '\n';
+      }
+      out << "  invalidate();" << '\n';
+      out << "}" << '\n';
+    }
+    out << '\n';
+  }
+}
+
+void generateCompact(const std::vector<std::unique_ptr<Node>>& nodes) {
+  out << "#ifdef ASTGEN_ARENA" << '\n';
+  out << "// Moves the node in slot into the arena, after which its children follow it" << '\n';
+  out << "template<class T> void astRelocate(std::unique_ptr<T>& slot,AstArena& arena) {" << '\n';
+  out << "  if (!slot) return;" << '\n';
+  out << "  std::unique_ptr<T> old(std::move(slot));" << '\n';
+  out << "  slot.reset(static_cast<T*>(old->relocate(arena)));" << '\n';
+  out << "}" << '\n' << '\n';
+  for (auto& nodePtr : nodes) {
+    Node& node=*nodePtr;
+    auto& name=node.name->id;
+    out << "inline Ast* " << name << "::relocate(AstArena& arena) {" << '\n';
+    out << "  auto moved=new (arena) " << name << "(std::move(*this));" << '\n';
+    out << "  moved->relocated(*this);" << '\n';
+    out << "  moved->relocateChildren(arena);" << '\n';
+    out << "  return moved;" << '\n';
+    out << "}" << '\n';
+    out << "inline void " << name << "::relocated(" << name << "& from) {" << '\n';
+    out << "  astMoved(from,*this);" << '\n';
+    for (auto& a : node.attributes) {
+      if (a->type->inlined) out << "  this->" << a->name->id << ".relocated(from." << a->name->id << ");" << '\n';
+    }
+    out << "}" << '\n';
+    out << "inline void " << name << "::relocateChildren(AstArena& arena) {" << '\n';
+    for (auto& a : node.attributes) {
+      auto& field=a->name->id;
+      if (simpleType(a->type->id->id)) continue;
+      if (a->type->collection) {
+        out << "  for (auto& item : this->" << field << ") astRelocate(item,arena);" << '\n';
+      } else if (a->type->inlined) {
+        out << "  this->" << field << ".relocateChildren(arena);" << '\n';
+      } else {
+        out << "  astRelocate(this->" << field << ",arena);" << '\n';
+      }
+    }
+    if (derivedAttributes) out << "  adopt();" << '\n';
+    out << "}" << '\n' << '\n';
+  }
+
+  out << "// Arena bytes needed to hold a tree; inline children are counted on their own as well" << '\n';
+  out << "struct AstFootprint : public Walker {" << '\n';
+  out << "  std::size_t bytes;" << '\n';
+  out << "  AstFootprint() : bytes(0) {}" << '\n';
+  for (auto& nodePtr : nodes) {
+    out << "  Walk visitPre(const " << nodePtr->name->id << "&) { bytes+=AstArena::footprint(sizeof(" << nodePtr->name->id << ")); return Walk::Continue; }" << '\n';
+  }
+  out << "};" << '\n' << '\n';
+
+  out << "// Moves a tree into a single arena block in preorder, so that traversals read memory" << '\n';
+  out << "// sequentially. Returns the new root; the old nodes are freed. Collection fields keep" << '\n';
+  out << "// their item arrays on the heap." << '\n';
+  out << "template<class T> std::unique_ptr<T> compact(std::unique_ptr<T> root,AstArena& arena) {" << '\n';
+  out << "  if (!root) return root;" << '\n';
+  out << "  AstFootprint footprint;" << '\n';
+  out << "  root->walk(footprint);" << '\n';
+  out << "  arena.reserve(footprint.bytes);" << '\n';
+  out << "  astRelocate(root,arena);" << '\n';
+  out << "  return root;" << '\n';
+  out << "}" << '\n';
+  out << "#endif" << '\n' << '\n';
+}
+
+static std::string fusedVisitorTemplate = R"tpl(
+// Runs several visitors in a single traversal. Every event is forwarded to each
+// sub-visitor in order. A sub-visitor that declares the event's exact overload is called
+// through its own type, so declaring it final lets the compiler devirtualize the call;
+// events it does not declare go through Visitor.
+{{#EVENT_NAMES}}
+template<class V,class... A> auto astFan{{NAME}}(V& v,int,A&... args) -> decltype(static_cast<void (V::*)(A&...)>(&V::{{EVENT}}),void()) { v.{{EVENT}}(args...); }
+template<class V,class... A> void astFan{{NAME}}(V& v,long,A&... args) { static_cast<Visitor&>(v).{{EVENT}}(args...); }
+struct AstFan{{NAME}} { template<class V,class... A> void operator()(V& v,A&... args) const { astFan{{NAME}}(v,0,args...); } };
+{{/EVENT_NAMES}}
+
+template<class... V>
+struct FusedVisitor : public Visitor {
+  std::tuple<V&...> visitors;
+
+  FusedVisitor(V&... visitors) : visitors(visitors...) {}
+
+  template<class F,class... A> void fan(const F& f,A&... args) { fanFrom<0>(f,args...); }
+  template<std::size_t I,class F,class... A> typename std::enable_if<I==sizeof...(V)>::type fanFrom(const F&,A&...) {}
+  template<std::size_t I,class F,class... A> typename std::enable_if<(I<sizeof...(V))>::type fanFrom(const F& f,A&... args) {
+    f(std::get<I>(visitors),args...);
+    fanFrom<I+1>(f,args...);
+  }
+
+{{#EVENTS}}  void {{EVENT}}({{PARAMS}}) { fan(AstFan{{NAME}}(){{ARGS}}); }
+{{/EVENTS}}};
+
+template<class... V> FusedVisitor<V...> fuse(V&... visitors) { return FusedVisitor<V...>(visitors...); }
+)tpl"; //"
+
+void generateFusedVisitor(const std::vector<std::unique_ptr<Node>>& nodes,const std::vector<std::unique_ptr<Enum>>& enums) {
+  ctemplate::StringToTemplateCache("ast_fused_visitor",fusedVisitorTemplate.c_str(),ctemplate::DO_NOT_STRIP);
+
+  ctemplate::TemplateDictionary dict("fused visitor");
+  std::set<std::string> names;
+  auto addEvent=[&](const std::string& event,const std::string& params,const std::string& args) {
+    std::string name=event;
+    name[0]=toupper(name[0]);
+    if (names.insert(event).second) {
+      auto nameDict=dict.AddSectionDictionary("EVENT_NAMES");
+      nameDict->SetValue("EVENT",event);
+      nameDict->SetValue("NAME",name);
+    }
+    auto eventDict=dict.AddSectionDictionary("EVENTS");
+    eventDict->SetValue("EVENT",event);
+    eventDict->SetValue("NAME",name);
+    eventDict->SetValue("PARAMS",params);
+    eventDict->SetValue("ARGS",args.empty()?"":","+args);
+  };
+  std::vector<std::string> visited;
+  if (!options.values&&!options.persistent) { visited.push_back("Ast"); visited.push_back("Collection"); }
+  for (auto& nodePtr : nodes) visited.push_back(nodePtr->name->id);
+  for (auto& type : visited) {
+    addEvent("visitPre","const std::string& name,const "+type+"& node","name,node");
+    addEvent("visitPost","const std::string& name,const "+type+"& node","name,node");
+  }
+  std::vector<std::string> scalars={"int64_t","std::string","double","bool"};
+  for (auto integer : integerTypes) scalars.push_back(integer);
+  for (auto& e : enums) scalars.push_back(e->name->id);
+  for (auto& type : scalars) addEvent("visit","const std::string& name,const "+type+"& value","name,value");
+  addEvent("collectionPre","","");
+  addEvent("collectionPost","","");
+  addEvent("emptyElement","","");
+
+  string output;
+  ctemplate::ExpandTemplate("ast_fused_visitor",ctemplate::DO_NOT_STRIP,&dict,&output);
+  out << output << '\n';
+}
+
+void generate(Node& node) {
+  // Alternatives of a sum type derive from it and are final
+  std::string baseInit;
+  if (sumOf.count(node.name->id)) {
+    std::string sum=sumOf[node.name->id]->name->id;
+    baseInit=sum+"("+sum+"::Kind::"+node.name->id+")";
+  }
+
+  // Derived attributes are computed by functions the user defines
+  for (auto& d : node.derived) {
+    std::string compute="compute"+d->name->id;
+    compute[7]=toupper(compute[7]);
+    out << d->type->id->id << " " << compute << "(const " << node.name->id << "& node);" << '\n';
+  }
+  if (!node.derived.empty()) out << '\n';
+
+  // Struct
+  if (baseInit.empty()) out << "struct " << node.name->id << " : public Ast {" << '\n';
+  else out << "struct " << node.name->id << " final : public " << sumOf[node.name->id]->name->id << " {" << '\n';
+  for (auto& a : node.attributes) {
+    out << "  " << memberType(*a) << " " << a->name->id << ";" << '\n';
+  }
+
+  // Default constructor, needed when the node is embedded inline elsewhere
+  out << '\n';
+  if (!node.attributes.empty()) {
+    out << "  " << node.name->id << "()";
+    bool first=true;
+    if (!baseInit.empty()) { out << " : " << baseInit; first=false; }
+    for (auto& a : node.attributes) {
+      if (!simpleType(a->type->id->id)) continue;
+      out << (first?" : ":",") << a->name->id << "()"; first=false;
+    }
+    out << " {";
+    if (derivedAttributes) out << " adopt();";
+    out << " astConstructed(*this); }" << '\n';
+  }
+
+  // Constructor signature
+  out << "  " << node.name->id << "(";
+  bool first=true;
+  for (auto& a : node.attributes) {      
+    if (!first) out << ","; first=false;
+    if (simpleType(a->type->id->id)) {
+      out << "const "<< a->type->id->id << "& " << a->name->id;
+    } else if (!a->type->collection) {
+      out << "std::unique_ptr<Ast>&& " << a->name->id;
+    } else {
+      out << "std::unique_ptr<Ast>&& " << a->name->id;
+    }
+  }
+  out << ")";
+  if (!baseInit.empty()) out << " : " << baseInit;
+  out << " {" << '\n';
+
+  // Constructor body
+  for (auto& a : node.attributes) {      
+    if (simpleType(a->type->id->id)) {
+      out << "    " << "this->" << a->name->id << "=" << a->name->id << ";" << '\n';
+    } else if (a->type->inlined) {
+      out << "    " << "if (" << a->name->id << ".get()) this->" << a->name->id << "=std::move(*tryCast<" << a->type->id->id << "*>(" << a->name->id << ".get()));" << '\n';
+    } else if (!a->type->collection) {
+      out << "    " << "this->" << a->name->id << "=std::unique_ptr<" << a->type->id->id << ">(tryCast<" << a->type->id->id << "*>(" << a->name->id << ".get()));" << '\n';
+      out << "    " << a->name->id << ".release();" << '\n';
+      out << '\n';
+    } else {
+      out << "    " << "if (" << a->name->id << ".get())" << '\n';
+      out << "    " << "for (auto& item : tryCast<Collection*>(" << a->name->id << ".get())->get()) {" << '\n';
+      out << "      " << "this->" << a->name->id << ".push_back(std::unique_ptr<"<< a->type->id->id <<">(tryCast<"<< a->type->id->id << "*>(item.get())));" << '\n';
+      out << "      " << "item.release();"<<'\n';
+      out << "    " << "}"<<'\n';
+    }
+  }    
+  if (derivedAttributes) out << "    adopt();" << '\n';
+  out << "    astConstructed(*this);" << '\n';
+  out << "  }" << '\n';
+
+  // Copies and moves become the parent of the inline children and collections they take
+  if (derivedAttributes) {
+    std::string base=baseInit.empty()?"Ast":sumOf[node.name->id]->name->id;
+    for (bool copy : {false,true}) {
+      if (copy&&!copyable(node)) continue;
+      std::string other=copy?"other":"std::move(other)";
+      out << "  " << node.name->id << "(" << (copy?"const ":"") << node.name->id << (copy?"&":"&&") << " other) : " << base << "(" << other << ")";
+      for (auto& a : node.attributes) {
+        std::string field=copy?"other."+a->name->id:"std::move(other."+a->name->id+")";
+        out << "," << a->name->id << "(" << field << ")";
+      }
+      out << " { adopt(); }" << '\n';
+      out << "  " << node.name->id << "& operator=(" << (copy?"const ":"") << node.name->id << (copy?"&":"&&") << " other) {" << '\n';
+      out << "    " << base << "::operator=(other);" << '\n';
+      for (auto& a : node.attributes) {
+        std::string field=copy?"other."+a->name->id:"std::move(other."+a->name->id+")";
+        out << "    this->" << a->name->id << "=" << field << ";" << '\n';
+      }
+      out << "    adopt();" << '\n';
+      out << "    return *this;" << '\n';
+      out << "  }" << '\n';
+    }
+  }
+  out << '\n';
+  
+  // Visitor accept
+  out << "  " << "void accept(const std::string& name,Visitor& visitor) {" << '\n';
+  out << "    " << "ASTGEN_VISIT(" << node.name->id << ",true,visitor.visitPre(name,*this));" << '\n';
+  for (auto& a : node.attributes) {      
+    if (simpleType(a->type->id->id)) {
+      // We don't visit those right now
+      out << "    " << "visitor.visit(\""<< a->name->id <<"\",this->" << a->name->id << ");" << '\n';
+    } else if (a->type->inlined) {
+      out << "    " << "this->" << a->name->id << ".accept(\""<< a->name->id <<"\",visitor);" << '\n';
+    } else if (!a->type->collection) {
+      out << "    " << "if (this->"<<a->name->id<<".get()) this->" << a->name->id << "->accept(\""<< a->name->id <<"\",visitor);" << '\n';
+		out << "    " << "else visitor.emptyElement();";
+    } else {
+      out << "    " << "visitor.collectionPre();" << '\n';
+      out << "    " << "for (auto& item : " << a->name->id << ") {" << '\n';
+      out << "      " << "if (item.get()) item->accept(\""<< a->name->id <<"\",visitor);"<<'\n';
+      out << "    " << "}"<<'\n';
+      out << "    " << "visitor.collectionPost();" << '\n';
+    }
+  }
+  out << "    " << "ASTGEN_VISIT(" << node.name->id << ",false,visitor.visitPost(name,*this));" << '\n';
+  out << "  " << "}" << '\n' << '\n';
+
+  // Deep copy, defined with generateClone
+  out << "  Ast* cloneAst(const CloneOptions& options) const;" << '\n';
+  out << "  void copyInto(" << node.name->id << "& copy,const CloneOptions& options) const;" << '\n';
+  out << "  std::unique_ptr<" << node.name->id << "> clone(const CloneOptions& options=CloneOptions()) const { return std::unique_ptr<" << node.name->id << ">(static_cast<" << node.name->id << "*>(cloneAst(options))); }" << '\n';
+  out << "  std::unique_ptr<Ast> transformWith(Transformer& transformer);" << '\n';
+  out << "  bool walk(Walker& walker) const;" << '\n';
+  out << "  void print(std::ostream& out) const;" << '\n';
+  out << "#ifdef ASTGEN_ARENA" << '\n';
+  out << "  Ast* relocate(AstArena& arena);" << '\n';
+  out << "  void relocateChildren(AstArena& arena);" << '\n';
+  out << "  void relocated(" << node.name->id << "& from);" << '\n';
+  out << "#endif" << '\n';
+  out << "#ifdef ASTGEN_POOL" << '\n';
+  out << "  static void* operator new(std::size_t size) { return AstPool::allocate(KindId<" << node.name->id << ">::value,size); }" << '\n';
+  out << "  static void operator delete(void* p,std::size_t size) { AstPool::release(KindId<" << node.name->id << ">::value,p,size); }" << '\n';
+  out << "#ifdef ASTGEN_ARENA" << '\n';
+  out << "  static void* operator new(std::size_t size,AstArena& arena) { return Ast::operator new(size,arena); }" << '\n';
+  out << "  static void operator delete(void*,AstArena&) {}" << '\n';
+  out << "#endif" << '\n';
+  out << "#endif" << '\n';
+
+  // Parent links, setters that invalidate, and cached derived attributes
+  if (derivedAttributes) {
+    out << '\n';
+    out << "  void adopt();" << '\n';
+    out << "  void link();" << '\n';
+    for (auto& a : node.attributes) {
+      std::string field=a->name->id,setter="set"+field;
+      setter[3]=toupper(setter[3]);
+      if (simpleType(a->type->id->id)) {
+        out << "  void " << setter << "(const " << a->type->id->id << "& " << field << ") { this->" << field << "=" << field << "; invalidate(); }" << '\n';
+      } else {
+        out << "  void " << setter << "(" << memberType(*a) << " " << field << ");" << '\n';
+      }
+    }
+    for (size_t bit=0;bit<node.derived.size();++bit) {
+      auto& d=node.derived[bit];
+      std::string field=d->name->id,compute="compute"+field;
+      compute[7]=toupper(compute[7]);
+      out << "  mutable " << d->type->id->id << " " << field << "Cache;" << '\n';
+      out << "  const " << d->type->id->id << "& " << field << "() const {" << '\n';
+      out << "    if (dirty&" << (1u<<bit) << "u) { " << field << "Cache=" << compute << "(*this); dirty&=~" << (1u<<bit) << "u; }" << '\n';
+      out << "    return " << field << "Cache;" << '\n';
+      out << "  }" << '\n';
+    }
+  }
+  
+  // Struct close
+  out << "};" << '\n' << '\n';
+  
+  // ostream operator
+  out << "std::ostream& operator<< (std::ostream& out,const " << node.name->id << "& node) {" << '\n';
+  out << "  " << "out << \"(" << node.name->id << ": \";" << '\n';
+  // Scalars after the first field are separated by a space, missing children print as ()
+  bool firstField=true;
+  for (auto& a : node.attributes) {
+    if (a->type->collection) {
+      out << "  out << \"[\";" << '\n';
+      out << "  " << "for (auto& item : node." << a->name->id << ") {" << '\n';
+      out << "    " << "if (item) out << *item; else out << \"()\";" << '\n';
+      out << "  " << "}" << '\n';
+      out << "  out << \"]\";" << '\n';
+    } else {
+      if (simpleType(a->type->id->id)) {
+        out << "  " << (firstField?"":"out << ' '; ") << "printValue(out,node." << a->name->id << ");" << '\n';
+      } else if (a->type->inlined) {
+        out << "  " << "out << node." << a->name->id << ";" << '\n';
+      } else {
+        out << "  " << "if (node." << a->name->id << ") out << *node." << a->name->id << "; else out << \"()\";" << '\n';
+      }
+    }
+    firstField=false;
+  }
+  out << "  " << "return out << \")\";" << '\n';
+  out << "}" << '\n';
+  out << "inline void " << node.name->id << "::print(std::ostream& out) const { out << *this; }" << '\n' << '\n' << '\n';
+}
+
+// Orders nodes so that every embedded member is complete before its owner. In value mode,
+// edges that would close a cycle are recorded in boxedAttributes; inline members can not.
+static void orderNode(Node& node,std::map<std::string,Node*>& byName,std::map<std::string,int>& state,std::vector<Node*>& order) {
+  state[node.name->id]=1;
+  for (auto& a : node.attributes) {
+    if (options.values&&sumTypes.count(a->type->id->id)) {
+      for (auto& alt : sumTypes[a->type->id->id]->alternatives) {
+        Node& child=*byName[alt->id];
+        if (leafNode(child)&&state[child.name->id]==0) orderNode(child,byName,state,order);
+      }
+      continue;
+    }
+    if (!embedded(*a)) continue;
+    if (!byName.count(a->type->id->id)) {
+      if (options.values) continue;
+      cerr << "Inline attribute " << node.name->id << "." << a->name->id << " must name a node type." << endl;
+      exit(1);
+    }
+    Node& child=*byName[a->type->id->id];
+    if (state[child.name->id]==1) {
+      if (!options.values) {
+        cerr << "Inline attribute " << node.name->id << "." << a->name->id << " makes " << child.name->id << " contain itself." << endl;
+        exit(1);
+      }
+      boxedAttributes.insert(a.get());
+    } else if (state[child.name->id]==0) {
+      orderNode(child,byName,state,order);
+    }
+  }
+  state[node.name->id]=2;
+  order.push_back(&node);
+}
+
+static std::vector<Node*> orderNodes(const std::vector<std::unique_ptr<Node>>& nodes) {
+  std::map<std::string,Node*> byName;
+  for (auto& nodePtr : nodes) byName[nodePtr->name->id]=nodePtr.get();
+  std::map<std::string,int> state;
+  std::vector<Node*> order;
+  for (auto& nodePtr : nodes) {
+    if (!state[nodePtr->name->id]) orderNode(*nodePtr,byName,state,order);
+  }
+  return order;
+}
+
+void generateValue(Node& node) {
+  // Struct
+  out << "struct " << node.name->id << " {" << '\n';
+  for (auto& a : node.attributes) {
+    out << "  " << memberType(*a) << " " << a->name->id << (simpleType(a->type->id->id)?"{}":"") << ";" << '\n';
+  }
+  out << '\n';
+  out << "  " << node.name->id << "()=default;" << '\n';
+  if (!node.attributes.empty()) {
+    out << "  " << node.name->id << "(";
+    bool first=true;
+    for (auto& a : node.attributes) {
+      if (!first) out << ",";
+      first=false;
+      out << memberType(*a) << " " << a->name->id;
+    }
+    out << ");" << '\n';
+  }
+  out << '\n';
+  out << "  void accept(const std::string& name,Visitor& visitor) const;" << '\n';
+  out << "};" << '\n' << '\n';
+}
+
+// Persistent mode: children are shared, immutable Ref<T>, inline children stay by value
+static std::string persistentType(const Attribute& a) {
+  auto& type=a.type->id->id;
+  if (simpleType(type)||a.type->inlined) return type;
+  if (a.type->collection) return "std::vector<Ref<"+type+">>";
+  return "Ref<"+type+">";
+}
+
+void generatePersistentNode(Node& node) {
+  auto& name=node.name->id;
+  std::string base="Ast",baseInit;
+  if (sumOf.count(name)) {
+    base=sumOf[name]->name->id;
+    baseInit=base+"("+base+"::Kind::"+name+")";
+  }
+  out << "struct " << name << (sumOf.count(name)?" final":"") << " : public " << base << " {" << '\n';
+  for (auto& a : node.attributes) out << "  " << persistentType(*a) << " " << a->name->id << ";" << '\n';
+  if (!node.attributes.empty()) out << '\n';
+
+  out << "  " << name << "()";
+  bool first=true;
+  if (!baseInit.empty()) { out << " : " << baseInit; first=false; }
+  for (auto& a : node.attributes) {
+    if (!simpleType(a->type->id->id)) continue;
+    out << (first?" : ":",") << a->name->id << "()"; first=false;
+  }
+  out << " {}" << '\n';
+  if (!node.attributes.empty()) {
+    out << "  " << name << "(";
+    first=true;
+    for (auto& a : node.attributes) {
+      out << (first?"":",") << persistentType(*a) << " " << a->name->id; first=false;
+    }
+    out << ")";
+    first=true;
+    if (!baseInit.empty()) { out << " : " << baseInit; first=false; }
+    for (auto& a : node.attributes) {
+      out << (first?" : ":",") << a->name->id << "(std::move(" << a->name->id << "))"; first=false;
+    }
+    out << " {}" << '\n' << '\n';
+    out << "  // Updaters return a new node sharing every other field with this one" << '\n';
+    for (auto& a : node.attributes) {
+      std::string field=a->name->id,type=persistentType(*a);
+      std::string updater="with"+field;
+      updater[4]=toupper(updater[4]);
+      out << "  Ref<" << name << "> " << updater << "(" << type << " " << field << ") const { auto copy=std::make_shared<" << name << ">(*this); copy->" << field << "=std::move(" << field << "); return copy; }" << '\n';
+    }
+  }
+  out << '\n';
+  out << "  void accept(const std::string& name,Visitor& visitor) const;" << '\n';
+  out << "  void print(std::ostream& out) const;" << '\n';
+  out << "};" << '\n' << '\n';
+}
+
+void generatePersistentDefinitions(Node& node) {
+  auto& name=node.name->id;
+  out << "inline void " << name << "::accept(const std::string& name,Visitor& visitor) const {" << '\n';
+  out << "  visitor.visitPre(name,*this);" << '\n';
+  for (auto& a : node.attributes) {
+    auto& field=a->name->id;
+    if (simpleType(a->type->id->id)) {
+      out << "  visitor.visit(\"" << field << "\",this->" << field << ");" << '\n';
+    } else if (a->type->inlined) {
+      out << "  this->" << field << ".accept(\"" << field << "\",visitor);" << '\n';
+    } else if (a->type->collection) {
+      out << "  visitor.collectionPre();" << '\n';
+      out << "  for (auto& item : this->" << field << ") if (item) item->accept(\"" << field << "\",visitor);" << '\n';
+      out << "  visitor.collectionPost();" << '\n';
+    } else {
+      out << "  if (this->" << field << ") this->" << field << "->accept(\"" << field << "\",visitor);" << '\n';
+      out << "  else visitor.emptyElement();" << '\n';
+    }
+  }
+  out << "  visitor.visitPost(name,*this);" << '\n';
+  out << "}" << '\n' << '\n';
+
+  out << "inline void " << name << "::print(std::ostream& out) const {" << '\n';
+  out << "  out << \"(" << name << ": \";" << '\n';
+  for (auto& a : node.attributes) {
+    auto& field=a->name->id;
+    if (a->type->collection) {
+      out << "  out << \"[\";" << '\n';
+      out << "  for (auto& item : " << field << ") if (item) out << *item;" << '\n';
+      out << "  out << \"]\";" << '\n';
+    } else if (byteType(a->type->id->id)) {
+      out << "  out << int(" << field << ");" << '\n';
+    } else if (simpleType(a->type->id->id)||a->type->inlined) {
+      out << "  out << " << field << ";" << '\n';
+    } else {
+      out << "  if (" << field << ") out << *" << field << ";" << '\n';
+    }
+  }
+  out << "  out << \")\";" << '\n';
+  out << "}" << '\n' << '\n';
+}
+
+void generatePersistent(const std::vector<std::unique_ptr<Node>>& nodes,const std::vector<std::unique_ptr<Sum>>& sums,const std::vector<std::unique_ptr<Enum>>& enums) {
+  out << "#include <cstdint>" << '\n';
+  out << "#include <iostream>" << '\n';
+  out << "#include <memory>" << '\n';
+  out << "#include <stack>" << '\n';
+  out << "#include <string>" << '\n';
+  out << "#include <tuple>" << '\n';
+  out << "#include <vector>" << '\n' << '\n';
+  out << "using std::string;" << '\n' << '\n';
+  out << "// Nodes are immutable and shared between versions of a tree" << '\n';
+  out << "template<class T> using Ref=std::shared_ptr<const T>;" << '\n' << '\n';
+  out << "struct Visitor;" << '\n';
+  out << "struct Ast {" << '\n';
+  out << "  int64_t line;" << '\n';
+  out << "  int64_t col;" << '\n';
+  out << "  Ast() : line(0),col(0) {}" << '\n';
+  out << "  virtual ~Ast() {}" << '\n';
+  out << "  virtual void accept(const std::string& name,Visitor& visitor) const=0;" << '\n';
+  out << "  virtual void print(std::ostream& out) const=0;" << '\n';
+  out << "};" << '\n';
+  out << "inline std::ostream& operator<< (std::ostream& out,const Ast& node) { node.print(out); return out; }" << '\n' << '\n';
+
+  generateForwards(nodes);
+  generateEnums(enums);
+  generateVisitor(nodes,enums);
+  generateSums(sums);
+  auto order=orderNodes(nodes);
+  for (auto node : order) generatePersistentNode(*node);
+  generateSumDispatch(sums);
+  for (auto node : order) generatePersistentDefinitions(*node);
+}
+
+void generateValueDefinitions(Node& node) {
+  // Constructor, defined out of line so that collection element types are complete
+  if (!node.attributes.empty()) {
+    out << "inline " << node.name->id << "::" << node.name->id << "(";
+    bool first=true;
+    for (auto& a : node.attributes) {
+      if (!first) out << ",";
+      first=false;
+      out << memberType(*a) << " " << a->name->id;
+    }
+    out << ")" << '\n' << "  : ";
+    first=true;
+    for (auto& a : node.attributes) {
+      if (!first) out << ",";
+      first=false;
+      out << a->name->id << "(std::move(" << a->name->id << "))";
+    }
+    out << " {}" << '\n' << '\n';
+  }
+
+  // Visitor accept
+  out << "inline void " << node.name->id << "::accept(const std::string& name,Visitor& visitor) const {" << '\n';
+  out << "  " << "visitor.visitPre(name,*this);" << '\n';
+  for (auto& a : node.attributes) {
+    if (simpleType(a->type->id->id)) {
+      out << "  " << "visitor.visit(\""<< a->name->id <<"\",this->" << a->name->id << ");" << '\n';
+    } else if (!a->type->collection) {
+      out << "  " << "acceptValue(this->" << a->name->id << ",\"" << a->name->id << "\",visitor);" << '\n';
+    } else {
+      out << "  " << "visitor.collectionPre();" << '\n';
+      out << "  " << "for (auto& item : this->" << a->name->id << ") acceptValue(item,\"" << a->name->id << "\",visitor);" << '\n';
+      out << "  " << "visitor.collectionPost();" << '\n';
+    }
+  }
+  out << "  " << "visitor.visitPost(name,*this);" << '\n';
+  out << "}" << '\n' << '\n';
+
+  // ostream operator
+  out << "inline std::ostream& operator<< (std::ostream& out,const " << node.name->id << "& node) {" << '\n';
+  out << "  " << "out << \"(" << node.name->id << ": \";" << '\n';
+  for (auto& a : node.attributes) {
+    if (a->type->collection) {
+      out << "  out << \"[\";" << '\n';
+      out << "  " << "for (auto& item : node." << a->name->id << ") printValue(out,item);" << '\n';
+      out << "  out << \"]\";" << '\n';
+    } else {
+      out << "  " << "printValue(out,node." << a->name->id << ");" << '\n';
+    }
+  }
+  out << "  " << "return out << \")\";" << '\n';
+  out << "}" << '\n' << '\n' << '\n';
+}
+
+void generateValues(const std::vector<std::unique_ptr<Node>>& nodes,const std::vector<std::unique_ptr<Enum>>& enums) {
+  std::map<std::string,Node*> byName;
+  for (auto& nodePtr : nodes) byName[nodePtr->name->id]=nodePtr.get();
+  auto order=orderNodes(nodes);
+
+  out << "#include <cstdint>" << '\n';
+  out << "#include <iostream>" << '\n';
+  out << "#include <memory>" << '\n';
+  out << "#include <stack>" << '\n';
+  out << "#include <string>" << '\n';
+  out << "#include <tuple>" << '\n';
+  out << "#include <variant>" << '\n';
+  out << "#include <vector>" << '\n' << '\n';
+  out << "using std::string;" << '\n' << '\n';
+  out << "// Owning, copyable indirection for children that would otherwise form a by-value cycle" << '\n';
+  out << "template<class T>" << '\n';
+  out << "struct Box {" << '\n';
+  out << "  std::unique_ptr<T> ptr;" << '\n';
+  out << "  Box() {}" << '\n';
+  out << "  Box(T&& value) : ptr(new T(std::move(value))) {}" << '\n';
+  out << "  Box(const T& value) : ptr(new T(value)) {}" << '\n';
+  out << "  Box(const Box& other) : ptr(other.ptr?new T(*other.ptr):nullptr) {}" << '\n';
+  out << "  Box(Box&&)=default;" << '\n';
+  out << "  Box& operator=(Box other) { ptr=std::move(other.ptr); return *this; }" << '\n';
+  out << "  T& operator*() const { return *ptr; }" << '\n';
+  out << "  T* operator->() const { return ptr.get(); }" << '\n';
+  out << "  T* get() const { return ptr.get(); }" << '\n';
+  out << "  explicit operator bool() const { return ptr!=nullptr; }" << '\n';
+  out << "};" << '\n' << '\n';
+
+  generateForwards(nodes);
+  out << "// Children of type Ast hold any node kind" << '\n';
+  out << "typedef std::variant<std::monostate";
+  for (auto& nodePtr : nodes) out << ",Box<" << nodePtr->name->id << ">";
+  out << "> AnyNode;" << '\n' << '\n';
+  for (auto& sum : sumTypes) {
+    out << "typedef std::variant<std::monostate";
+    for (auto& alt : sum.second->alternatives) {
+      if (leafNode(*byName[alt->id])) out << "," << alt->id;
+      else out << ",Box<" << alt->id << ">";
+    }
+    out << "> " << sum.first << ";" << '\n';
+  }
+  if (!sumTypes.empty()) out << '\n';
+  generateEnums(enums);
+  generateVisitor(nodes,enums);
+
+  out << "template<class T> void acceptValue(const T& value,const std::string& name,Visitor& visitor) { value.accept(name,visitor); }" << '\n';
+  out << "template<class T> void acceptValue(const Box<T>& value,const std::string& name,Visitor& visitor) { if (value) value->accept(name,visitor); else visitor.emptyElement(); }" << '\n';
+  out << "inline void acceptValue(const std::monostate&,const std::string&,Visitor& visitor) { visitor.emptyElement(); }" << '\n';
+  out << "template<class... T> void acceptValue(const std::variant<T...>& value,const std::string& name,Visitor& visitor) { std::visit([&](const auto& v) { acceptValue(v,name,visitor); },value); }" << '\n' << '\n';
+  out << "template<class T> void printValue(std::ostream& out,const T& value) { out << value; }" << '\n';
+  out << "inline void printValue(std::ostream& out,const int8_t& value) { out << int(value); }" << '\n';
+  out << "inline void printValue(std::ostream& out,const uint8_t& value) { out << int(value); }" << '\n';
+  out << "template<class T> void printValue(std::ostream& out,const Box<T>& value) { if (value) out << *value; }" << '\n';
+  out << "inline void printValue(std::ostream&,const std::monostate&) {}" << '\n';
+  out << "template<class... T> void printValue(std::ostream& out,const std::variant<T...>& value) { std::visit([&](const auto& v) { printValue(out,v); },value); }" << '\n' << '\n';
+
+  for (auto node : order) generateValue(*node);
+  for (auto node : order) generateValueDefinitions(*node);
+}
+
+struct CompileVisitor : public Visitor {
+  void visitPost(const std::string& name,const Nodes& node) {
+    auto& n=node.nodes;
+    std::set<std::string> typeNames;
+    auto declare=[&](const std::string& name) {
+      if (!typeNames.insert(name).second) {
+        cerr << "Type " << name << " is declared more than once." << endl;
+        exit(1);
+      }
+    };
+    for (auto& e : node.enums) {
+      declare(e->name->id);
+      enumTypes.insert(e->name->id);
+      std::set<std::string> values;
+      for (auto& v : e->values) {
+        if (!values.insert(v->id).second) {
+          cerr << "Enum " << e->name->id << " lists the value " << v->id << " more than once." << endl;
+          exit(1);
+        }
+      }
+    }
+    std::set<std::string> nodeNames;
+    for (auto& item : n) {
+      declare(item->name->id);
+      nodeNames.insert(item->name->id);
+      nodeTypes[item->name->id]=item.get();
+    }
+    for (auto& sum : node.sums) {
+      declare(sum->name->id);
+      sumTypes[sum->name->id]=sum.get();
+      std::set<std::string> alternatives;
+      for (auto& alt : sum->alternatives) {
+        if (!alternatives.insert(alt->id).second) {
+          cerr << "Alternative " << alt->id << " is listed more than once in " << sum->name->id << "." << endl;
+          exit(1);
+        }
+        if (!nodeNames.count(alt->id)) {
+          cerr << "Alternative " << alt->id << " of " << sum->name->id << " must name a node type." << endl;
+          exit(1);
+        }
+        if (sumOf.count(alt->id)) {
+          cerr << "Alternative " << alt->id << " can not belong to both " << sumOf[alt->id]->name->id << " and " << sum->name->id << "." << endl;
+          exit(1);
+        }
+        sumOf[alt->id]=sum.get();
+      }
+    }
+    for (auto& item : n) {
+      std::set<std::string> fields;
+      for (auto& a : item->attributes) {
+        if (!fields.insert(a->name->id).second) {
+          cerr << "Field " << item->name->id << "." << a->name->id << " is declared more than once." << endl;
+          exit(1);
+        }
+      }
+      if (item->derived.size()>32) {
+        cerr << "Node " << item->name->id << " can not declare more than 32 derived attributes." << endl;
+        exit(1);
+      }
+      std::set<std::string> derivedNames;
+      for (auto& d : item->derived) {
+        if (!simpleType(d->type->id->id)||d->type->collection||d->type->inlined) {
+          cerr << "Derived attribute " << item->name->id << "." << d->name->id << " must have a scalar, string or enum type." << endl;
+          exit(1);
+        }
+        if (fields.count(d->name->id)) {
+          cerr << "Derived attribute " << item->name->id << "." << d->name->id << " has the name of a field." << endl;
+          exit(1);
+        }
+        if (!derivedNames.insert(d->name->id).second) {
+          cerr << "Derived attribute " << item->name->id << "." << d->name->id << " is declared more than once." << endl;
+          exit(1);
+        }
+        derivedAttributes=true;
+      }
+    }
+    if (derivedAttributes) {
+      if (options.values||options.persistent) {
+        cerr << "Derived attributes are only supported without --values and --persistent." << endl;
+        exit(1);
+      }
+      for (auto& item : n) {
+        for (auto& a : item->attributes) {
+          if (a->name->id=="parent"||a->name->id=="dirty") {
+            cerr << "Field " << item->name->id << "." << a->name->id << " is reserved when derived attributes are declared." << endl;
+            exit(1);
+          }
+        }
+      }
+    }
+
+    if (options.values) {
+      generateValues(n,node.enums);
+      generateReflection(n);
+      generateFusedVisitor(n,node.enums);
+      generatePrettyPrintVisitor(n);
+      generateRubyAstVisitor(n);
+      return;
+    }
+    if (options.persistent) {
+      generatePersistent(n,node.sums,node.enums);
+      generateFusedVisitor(n,node.enums);
+      generatePrettyPrintVisitor(n);
+      generateRubyAstVisitor(n);
+      return;
+    }
+
+    out << "struct Visitor; struct Transformer; struct Walker; struct Ast; struct AstIndex; struct AstArena;" << '\n';
+    out << "template<class T> void astConstructed(T& node);" << '\n';
+    out << "inline void astDestroyed(Ast& node);" << '\n';
+    out << "inline void astMoved(Ast& from,Ast& to);" << '\n';
+    out << "inline void astCast(bool ok);" << '\n' << '\n';
+    out << "// How clone() copies: into an arena (with ASTGEN_ARENA), and collections of at least" << '\n';
+    out << "// parallelThreshold items split across threads (0 copies on the calling thread)" << '\n';
+    out << "struct CloneOptions {" << '\n';
+    out << "  AstArena* arena;" << '\n';
+    out << "  std::size_t parallelThreshold;" << '\n';
+    out << "  std::size_t threads; // for parallelThreshold, 0 for one per core" << '\n';
+    out << "  CloneOptions() : arena(nullptr),parallelThreshold(0),threads(0) {}" << '\n';
+    out << "};" << '\n' << '\n';
+    out << "struct Ast {" << '\n';
+    out << "  int64_t line;" << '\n';
+    out << "  int64_t col;" << '\n';
+    out << "#ifdef ASTGEN_INDEX" << '\n';
+    out << "  // Registration in an AstIndex; copies of a node are not registered" << '\n';
+    out << "  struct IndexSlot {" << '\n';
+    out << "    AstIndex* index; uint32_t kind; uint32_t slot;" << '\n';
+    out << "    IndexSlot() : index(nullptr),kind(0),slot(0) {}" << '\n';
+    out << "    IndexSlot(const IndexSlot&) : index(nullptr),kind(0),slot(0) {}" << '\n';
+    out << "    IndexSlot& operator=(const IndexSlot&) { return *this; }" << '\n';
+    out << "  } indexSlot;" << '\n';
+    out << "#endif" << '\n';
+    out << "#ifdef ASTGEN_STATS" << '\n';
+    out << "  // Kind for AstStats; copies of a node are not counted" << '\n';
+    out << "  struct StatsKind {" << '\n';
+    out << "    uint32_t value;" << '\n';
+    out << "    StatsKind() : value(~0u) {}" << '\n';
+    out << "    StatsKind(const StatsKind&) : value(~0u) {}" << '\n';
+    out << "    StatsKind& operator=(const StatsKind&) { return *this; }" << '\n';
+    out << "  } statsKind;" << '\n';
+    out << "#endif" << '\n';
+    out << "#ifdef ASTGEN_IDS" << '\n';
+    out << "  uint32_t nodeId; // dense per kind, see AstIdSpace" << '\n';
+    out << "#endif" << '\n';
+    if (derivedAttributes) {
+      out << "  // Derived attributes: the owning node, set by constructors, setters and link(), and one" << '\n';
+      out << "  // bit per cached attribute that must be recomputed" << '\n';
+      out << "  Ast* parent;" << '\n';
+      out << "  mutable uint32_t dirty;" << '\n';
+      out << "  Ast() : line(0),col(0),parent(nullptr),dirty(~0u) {" << '\n';
+      out << "#ifdef ASTGEN_IDS" << '\n';
+      out << "    nodeId=0;" << '\n';
+      out << "#endif" << '\n';
+      out << "  }" << '\n';
+      out << "  // A copy or move belongs to no node until its new owner adopts it, and computes its" << '\n';
+      out << "  // derived attributes afresh; assigning keeps the owner and invalidates it" << '\n';
+      out << "  Ast(const Ast& other) : line(other.line),col(other.col),parent(nullptr),dirty(~0u) {" << '\n';
+      out << "#ifdef ASTGEN_IDS" << '\n';
+      out << "    nodeId=other.nodeId;" << '\n';
+      out << "#endif" << '\n';
+      out << "  }" << '\n';
+      out << "  Ast& operator=(const Ast& other) {" << '\n';
+      out << "    line=other.line; col=other.col;" << '\n';
+      out << "#ifdef ASTGEN_IDS" << '\n';
+      out << "    nodeId=other.nodeId;" << '\n';
+      out << "#endif" << '\n';
+      out << "    invalidate();" << '\n';
+      out << "    return *this;" << '\n';
+      out << "  }" << '\n';
+      out << "  // Call after changing a field directly: recomputes this node and its ancestors on access" << '\n';
+      out << "  void invalidate() { for (Ast* node=this;node;node=node->parent) node->dirty=~0u; }" << '\n';
+      out << "  virtual void link()=0;" << '\n';
+    } else {
+      out << "  Ast() : line(0),col(0) {" << '\n';
+      out << "#ifdef ASTGEN_IDS" << '\n';
+      out << "    nodeId=0;" << '\n';
+      out << "#endif" << '\n';
+      out << "  }" << '\n';
+    }
+    out << "  virtual ~Ast() { astDestroyed(*this); }" << '\n';
+    out << "  virtual void can_dynamic_cast() {}" << '\n';
+    out << "  virtual void accept(const std::string&,Visitor&)=0;" << '\n';
+    out << "  virtual Ast* cloneAst(const CloneOptions& options) const=0;" << '\n';
+    out << "  virtual std::unique_ptr<Ast> transformWith(Transformer& transformer)=0;" << '\n';
+    out << "  virtual bool walk(Walker& walker) const=0;" << '\n';
+    out << "  virtual void print(std::ostream& out) const=0;" << '\n';
+    out << "#ifdef ASTGEN_ARENA" << '\n';
+    out << "  static void* operator new(std::size_t size);" << '\n';
+    out << "  static void* operator new(std::size_t size,AstArena& arena);" << '\n';
+    out << "  static void operator delete(void* p);" << '\n';
+    out << "  static void operator delete(void* p,AstArena& arena);" << '\n';
+    out << "  virtual Ast* relocate(AstArena& arena)=0;" << '\n';
+    out << "#endif" << '\n';
+    out << "};" << '\n';
+    out << "inline std::ostream& operator<< (std::ostream& out,const Ast& node) { node.print(out); return out; }" << '\n';
+    out << "using std::string;" << '\n' << '\n';
+    out << "struct Collection : Ast {" <<'\n';
+    out << "  void accept(const string&, Visitor&) {};" << '\n';
+    out << "  Ast* cloneAst(const CloneOptions&) const { return nullptr; }" << '\n';
+    out << "  std::unique_ptr<Ast> transformWith(Transformer&) { return nullptr; }" << '\n';
+    out << "  bool walk(Walker&) const { return true; }" << '\n';
+    out << "  void print(std::ostream&) const {}" << '\n';
+    if (derivedAttributes) out << "  void link() {}" << '\n';
+    out << "#ifdef ASTGEN_ARENA" << '\n';
+    out << "  Ast* relocate(AstArena&) { return nullptr; }" << '\n';
+    out << "#endif" << '\n';
+    out << "  std::vector<std::unique_ptr<Ast>> items; " << '\n';
+    out << "  void push_back(std::unique_ptr<Ast>&& item) { items.push_back(std::move(item)); } " << '\n';
+    out << "  std::vector<std::unique_ptr<Ast>>& get() { return items; }" << '\n';
+    out << "};" << '\n' << '\n';
+    out << "template<class T,class S>" << '\n';
+    out << "T tryCast(S s) {" << '\n';
+    out << "  if (!s) return 0;" << '\n';
+    out << "  T t=dynamic_cast<T>(s);" << '\n';
+    out << "  astCast(t);" << '\n';
+    out << "  if (!t) {" << '\n';
+    out << "    std::cerr << \"AST type mismatch.\" << std::endl;" << endl;
+    out << "    throw;" << '\n';
+    out << "  }" << '\n';
+    out << "  return t;" << '\n';
+    out << "}" << '\n' << '\n';
+    out << "#include <cstdio>" << '\n' << '\n';
+    out << "// Scalars in operator<< dumps: strings are quoted and doubles keep every digit, so that" << '\n';
+    out << "// AstReader rebuilds exactly the tree that was printed" << '\n';
+    out << "template<class T> void printValue(std::ostream& out,const T& value) { out << value; }" << '\n';
+    out << "inline void printValue(std::ostream& out,const int8_t& value) { out << int(value); }" << '\n';
+    out << "inline void printValue(std::ostream& out,const uint8_t& value) { out << int(value); }" << '\n';
+    out << "inline void printValue(std::ostream& out,const double& value) {" << '\n';
+    out << "  char text[32];" << '\n';
+    out << "  snprintf(text,sizeof(text),\"%.17g\",value);" << '\n';
+    out << "  out << text;" << '\n';
+    out << "}" << '\n';
+    out << "inline void printValue(std::ostream& out,const std::string& value) {" << '\n';
+    out << "  out << '\"';" << '\n';
+    out << "  for (char c : value) {" << '\n';
+    out << "    if (c=='\"'||c=='\\\\') out << '\\\\' << c;" << '\n';
+    out << "    else if (c=='\\n') out << \"\\\\n\";" << '\n';
+    out << "    else out << c;" << '\n';
+    out << "  }" << '\n';
+    out << "  out << '\"';" << '\n';
+    out << "}" << '\n' << '\n';
+
+    generateForwards(n); 
+    generateKindIds(n);
+    generateStats(n);
+    generatePool();
+    generateEnums(node.enums);
+    generateVisitor(n,node.enums); 
+    generateTransformerBase(n);
+    generateSums(node.sums);
+    for (auto item : orderNodes(n)) { 
+      generate(*item); 
+    }
+    generateSumDispatch(node.sums);
+    generateClone(n);
+    generateTransformer(n);
+    generateWalker(n);
+    if (derivedAttributes) generateDerived(n);
+    generateCompact(n);
+    generateReachability(n);
+    generateIndex(n);
+    generateIds();
+    generateCloneItems();
+    generateHooks(n);
+    generateReader(n,node.enums);
+    generateEventStream(n,node.enums);
+    generateBuilder();
+    generateFusedVisitor(n,node.enums);
+    generateReflection(n);
+    generatePrettyPrintVisitor(n);
+		generateRubyDefinition(n);
+    generateRubyAstVisitor(n);
+  }
+};
+
+
+// Parser runtime, in place of the one greg emits under #ifndef YY_PART: 64-bit offsets, input
+// parsed in place or read in blocks, scanning of 'class*' runs and profile hooks. greg.awk
+// adapts the rules greg emits to it.
+#define YY_PART
+#ifndef YY_ALLOC
+#define YY_ALLOC(N, D) malloc(N)
+#endif
+#ifndef YY_CALLOC
+#define YY_CALLOC(N, S, D) calloc(N, S)
+#endif
+#ifndef YY_REALLOC
+#define YY_REALLOC(B, N, D) realloc(B, N)
+#endif
+#ifndef YY_FREE
+#define YY_FREE free
+#endif
+#ifndef YY_LOCAL
+#define YY_LOCAL(T)     static T
+#endif
+#ifndef YY_ACTION
+#define YY_ACTION(T)    static T
+#endif
+#ifndef YY_RULE
+#define YY_RULE(T)      static T
+#endif
+#ifndef YY_PARSE
+#define YY_PARSE(T)     T
+#endif
+#ifndef YY_NAME
+#define YY_NAME(N) yy##N
+#endif
+#ifndef YY_BEGIN
+#define YY_BEGIN        ( G->begin= G->pos, 1)
+#endif
+#ifndef YY_END
+#define YY_END          ( G->end= G->pos, 1)
+#endif
+#ifdef YY_DEBUG
+# define yyprintf(args) fprintf args
+#else
+# define yyprintf(args)
+#endif
+#ifdef YY_PROFILE
+struct yyprofile { const char *name; unsigned long calls, successes, backtracks, rescanned; };
+static yyprofile yyprofiles[YYRULECOUNT + 1];
+static unsigned long yyprofileThunks, yyprofileRefills;
+# define yyprofileEnter(N, NAME) (yyprofiles[N].name= NAME, ++yyprofiles[N].calls)
+# define yyprofileOk(N)          (++yyprofiles[N].successes)
+/* Restoring G->pos to P, on a failed rule, alternative, option or loop iteration, backtracks
+ * when it gives back input, to be scanned again */
+# define yyprofileBacktrack(N, P) (G->pos > (P) ? (++yyprofiles[N].backtracks, yyprofiles[N].rescanned += G->pos - (P)) : 0)
+# define yyprofileThunk()        (++yyprofileThunks)
+# define yyprofileRefill()       (++yyprofileRefills)
+YY_LOCAL(void) yyprofileReport(FILE *out)
+{
+  fprintf(out, "%-20s %10s %10s %10s %10s\n", "rule", "calls", "ok", "backtrack", "rescanned");
+  for (int n= 1; n <= YYRULECOUNT; ++n)
+    if (yyprofiles[n].calls)
+      fprintf(out, "%-20s %10lu %10lu %10lu %10lu\n", yyprofiles[n].name, yyprofiles[n].calls,
+              yyprofiles[n].successes, yyprofiles[n].backtracks, yyprofiles[n].rescanned);
+  fprintf(out, "thunks %lu, refills %lu\n", yyprofileThunks, yyprofileRefills);
+}
+#else
+# define yyprofileEnter(N, NAME)
+# define yyprofileOk(N)
+# define yyprofileBacktrack(N, P)
+# define yyprofileThunk()
+# define yyprofileRefill()
+#endif
+#ifndef YY_XTYPE
+#define YY_XTYPE void *
+#endif
+#ifndef YY_XVAR
+#define YY_XVAR yyxvar
+#endif
+
+#ifndef YY_STACK_SIZE
+#define YY_STACK_SIZE 128
+#endif
+
+#ifndef YY_BUFFER_START_SIZE
+#define YY_BUFFER_START_SIZE 1024
+#endif
+
+#define yydata G->data
+#define yy G->ss
+
+/* Offsets into the input and lengths of text, 64-bit so inputs past 2 GiB parse */
+typedef int64_t yyoff;
+
+struct _yythunk; // forward declaration
+typedef void (*yyaction)(GREG *G, char *yytext, yyoff yyleng, struct _yythunk *thunkpos, YY_XTYPE YY_XVAR);
+typedef struct _yythunk { yyoff begin, end;  yyoff line,col; yyaction  action;  struct _yythunk *next; } yythunk;
+
+struct GREG {
+  char *buf;
+  yyoff buflen;
+  yyoff offset;
+  yyoff pos;
+  yyoff limit;
+  char *text;
+  yyoff textlen;
+  yyoff begin;
+  yyoff end;
+  yythunk *thunks;
+  yyoff thunkslen;
+  yyoff thunkpos;
+  YYSTYPE ss;
+  YYSTYPE *val;
+  YYSTYPE *vals;
+  int valslen;
+  YY_XTYPE data;
+  yyoff maxPos;
+  yyoff located; /* buffer offset whose line and col (from 0) are known */
+  yyoff line;
+  yyoff col;
+  int mapped; /* buf belongs to the caller (see yyinput): never grown, refilled or freed */
+  std::stack<std::unordered_map<int,std::unique_ptr<YY_CTYPE>>> collectionStack;
+  GREG() : buf(0),buflen(0),offset(0),pos(0),limit(0),text(0),textlen(0),begin(0),end(0),thunks(0),thunkslen(0),thunkpos(0),val(0),vals(0),valslen(0),data(0),maxPos(0),located(0),line(0),col(0),mapped(0) {}
+};
+
+/* Moves line and col forward to buffer offset pos, counting lines only for input that an
+ * action asks the position of (see yyDone) */
+YY_LOCAL(void) yylocate(GREG *G, yyoff pos)
+{
+  for (;  G->located < pos;  ++G->located)
+    if ('\n' == G->buf[G->located] || '\r' == G->buf[G->located])
+      {
+        ++G->line;
+        G->col= 0;
+      }
+    else
+      ++G->col;
+}
+
+YY_LOCAL(int) yyrefill(GREG *G)
+{
+  yyoff yyn;
+  if (G->mapped) return 0;
+  while (G->buflen - G->pos < 512)
+    {
+      G->buflen *= 2;
+      G->buf= (char*)YY_REALLOC(G->buf, G->buflen, G->data);
+    }
+  YY_INPUT((G->buf + G->pos), yyn, (G->buflen - G->pos), G->data,G);
+  if (!yyn) return 0;
+  yyprofileRefill();
+  G->limit += yyn;
+  return 1;
+}
+
+YY_LOCAL(int) yymatchDot(GREG *G)
+{
+  if (G->pos >= G->limit && !yyrefill(G)) return 0;
+  ++G->pos;
+  return 1;
+}
+
+YY_LOCAL(int) yymatchChar(GREG *G, int c)
+{
+  if (G->pos >= G->limit && !yyrefill(G)) return 0;
+  if ((unsigned char)G->buf[G->pos] == c)
+    {
+      ++G->pos;
+      yyprintf((stderr, "  ok   yymatchChar(%c) @ %s\n", c, G->buf+G->pos));
+      return 1;
+    }
+  yyprintf((stderr, "  fail yymatchChar(%c) @ %s\n", c, G->buf+G->pos));
+  return 0;
+}
+
+YY_LOCAL(int) yymatchString(GREG *G, const char *s)
+{
+  yyoff yysav= G->pos;
+  while (*s)
+    {
+      if (G->pos >= G->limit && !yyrefill(G)) return 0;
+      if (G->buf[G->pos] != *s)
+        {
+          G->pos= yysav;
+          return 0;
+        }
+      ++s;
+      ++G->pos;
+    }
+  return 1;
+}
+
+YY_LOCAL(int) yymatchClass(GREG *G, unsigned char *bits)
+{
+  int c;
+  if (G->pos >= G->limit && !yyrefill(G)) return 0;
+  c= (unsigned char)G->buf[G->pos];
+  if (bits[c >> 3] & (1 << (c & 7)))
+    {
+      ++G->pos;
+      yyprintf((stderr, "  ok   yymatchClass @ %s\n", G->buf+G->pos));
+      return 1;
+    }
+  yyprintf((stderr, "  fail yymatchClass @ %s\n", G->buf+G->pos));
+  return 0;
+}
+
+/* Runs of a character class, for 'class*' loops. The class is described by at most
+ * YY_RUN_RANGES byte ranges, of either its members or the bytes that end the run, and
+ * tested 32 (AVX2) or 16 (SSE2) bytes at a time. Define YY_SCALAR_SCAN to scan byte by byte.
+ */
+#if !defined(YY_SCALAR_SCAN) && defined(__AVX2__)
+# include <immintrin.h>
+# define YY_SCAN_AVX2
+#elif !defined(YY_SCALAR_SCAN) && defined(__SSE2__)
+# include <emmintrin.h>
+# define YY_SCAN_SSE2
+#endif
+#define YY_RUN_RANGES 4
+
+typedef struct _yyrun {
+  const unsigned char *bits;
+  int stop;       /* whether the ranges hold the bytes that end the run */
+  int nranges;    /* above YY_RUN_RANGES when the class has too many to vectorize */
+  unsigned char lo[YY_RUN_RANGES], span[YY_RUN_RANGES];
+} yyrun;
+
+YY_LOCAL(yyrun) yyrunInit(const unsigned char *bits)
+{
+  yyrun run;
+  int member, ranges[2]= { 0, 0 }, c;
+  run.bits= bits;
+  for (c= 0;  c < 256;  ++c)
+    {
+      member= (bits[c >> 3] >> (c & 7)) & 1;
+      if (!c || member != ((bits[(c - 1) >> 3] >> ((c - 1) & 7)) & 1)) ++ranges[member];
+    }
+  run.stop= ranges[0] < ranges[1];
+  run.nranges= 0;
+  for (c= 0;  c < 256;  ++c)
+    {
+      member= (bits[c >> 3] >> (c & 7)) & 1;
+      if (member == run.stop) continue;
+      if (!c || member != ((bits[(c - 1) >> 3] >> ((c - 1) & 7)) & 1))
+        {
+          if (run.nranges < YY_RUN_RANGES) run.lo[run.nranges]= c;
+          ++run.nranges;
+        }
+      if (run.nranges <= YY_RUN_RANGES) run.span[run.nranges - 1]= c - run.lo[run.nranges - 1];
+    }
+  return run;
 }
 
-void generate(Node& node) {
-  // Struct
-  out << "struct " << node.name->id << " : public Ast {" << endl;
-  for (auto& a : node.attributes) {
-    if (simpleType(a->type->id->id)) {
-      out << "  " << a->type->id->id << " " << a->name->id << ";" << endl;
-    } else if (a->type->collection) {
-      out << "  std::vector<std::unique_ptr<" << a->type->id->id << ">> " << a->name->id << ";" << endl;
-    } else {
-      out << "  std::unique_ptr<" << a->type->id->id << "> " << a->name->id << ";" << endl;
+/* Returns the end of the run starting at p, or end */
+YY_LOCAL(char *) yyscan(const yyrun *run, char *p, char *end)
+{
+  int r;
+  if (run->nranges <= YY_RUN_RANGES)
+    {
+#if defined(YY_SCAN_AVX2)
+      while (end - p >= 32)
+        {
+          __m256i v= _mm256_loadu_si256((const __m256i *)p), hit= _mm256_setzero_si256();
+          unsigned mask;
+          for (r= 0;  r < run->nranges;  ++r)
+            {
+              __m256i d= _mm256_sub_epi8(v, _mm256_set1_epi8((char)run->lo[r]));
+              hit= _mm256_or_si256(hit, _mm256_cmpeq_epi8(_mm256_min_epu8(d, _mm256_set1_epi8((char)run->span[r])), d));
+            }
+          mask= (unsigned)_mm256_movemask_epi8(hit);
+          if (!run->stop) mask= ~mask;
+          if (mask) return p + __builtin_ctz(mask);
+          p += 32;
+        }
+#elif defined(YY_SCAN_SSE2)
+      while (end - p >= 16)
+        {
+          __m128i v= _mm_loadu_si128((const __m128i *)p), hit= _mm_setzero_si128();
+          unsigned mask;
+          for (r= 0;  r < run->nranges;  ++r)
+            {
+              __m128i d= _mm_sub_epi8(v, _mm_set1_epi8((char)run->lo[r]));
+              hit= _mm_or_si128(hit, _mm_cmpeq_epi8(_mm_min_epu8(d, _mm_set1_epi8((char)run->span[r])), d));
+            }
+          mask= (unsigned)_mm_movemask_epi8(hit);
+          if (!run->stop) mask= ~mask & 0xffff;
+          if (mask) return p + __builtin_ctz(mask);
+          p += 16;
+        }
+#endif
     }
-  }
+  (void)r;
+  while (p < end && (run->bits[(unsigned char)*p >> 3] & (1 << (*p & 7)))) ++p;
+  return p;
+}
 
-  // Constructor signature
-  out << endl;
-  out << "  " << node.name->id << "(";
-  bool first=true;
-  for (auto& a : node.attributes) {      
-    if (!first) out << ","; first=false;
-    if (simpleType(a->type->id->id)) {
-      out << "const "<< a->type->id->id << "& " << a->name->id;
-    } else if (!a->type->collection) {
-      out << "std::unique_ptr<Ast>&& " << a->name->id;
-    } else {
-      out << "std::unique_ptr<Ast>&& " << a->name->id;
+/* Matches the longest run of the class, refilling the buffer as needed; never fails */
+YY_LOCAL(void) yymatchRun(GREG *G, const yyrun *run)
+{
+  for (;;)
+    {
+      if (G->pos >= G->limit && !yyrefill(G)) break;
+      G->pos= yyscan(run, G->buf + G->pos, G->buf + G->limit) - G->buf;
+      if (G->pos < G->limit) break;
     }
-  }
-  out << ") {" << endl;
+  G->maxPos= G->maxPos > G->pos ? G->maxPos : G->pos;
+  yyprintf((stderr, "  ok   yymatchRun @ %s\n", G->buf+G->pos));
+}
 
-  // Constructor body
-  for (auto& a : node.attributes) {      
-    if (simpleType(a->type->id->id)) {
-      out << "    " << "this->" << a->name->id << "=" << a->name->id << ";" << endl;
-    } else if (!a->type->collection) {
-      out << "    " << "this->" << a->name->id << "=std::unique_ptr<" << a->type->id->id << ">(tryCast<" << a->type->id->id << "*>(" << a->name->id << ".get()));" << endl;
-      out << "    " << a->name->id << ".release();" << endl;
-      out << endl;
-    } else {
-      out << "    " << "if (" << a->name->id << ".get())" << endl;
-      out << "    " << "for (auto& item : tryCast<Collection*>(" << a->name->id << ".get())->get()) {" << endl;
-      out << "      " << "this->" << a->name->id << ".push_back(std::unique_ptr<"<< a->type->id->id <<">(tryCast<"<< a->type->id->id << "*>(item.get())));" << endl;
-      out << "      " << "item.release();"<<endl;
-      out << "    " << "}"<<endl;
+YY_LOCAL(void) yyDo(GREG *G, yyaction action, yyoff begin, yyoff end)
+{
+  while (G->thunkpos >= G->thunkslen)
+    {
+      G->thunkslen *= 2;
+      G->thunks= (yythunk*)YY_REALLOC(G->thunks, sizeof(yythunk) * G->thunkslen, G->data);
     }
-  }    
-  out << "  }" << endl << endl;
-  
-  // Visitor accept
-  out << "  " << "void accept(const std::string& name,Visitor& visitor) {" << endl;
-  out << "    " << "visitor.visitPre(name,*this);" << endl;
-  for (auto& a : node.attributes) {      
-    if (simpleType(a->type->id->id)) {
-      // We don't visit those right now
-      out << "    " << "visitor.visit(\""<< a->name->id <<"\",this->" << a->name->id << ");" << endl;
-    } else if (!a->type->collection) {
-      out << "    " << "if (this->"<<a->name->id<<".get()) this->" << a->name->id << "->accept(\""<< a->name->id <<"\",visitor);" << endl;
-		out << "    " << "else visitor.emptyElement();";
-    } else {
-      out << "    " << "visitor.collectionPre();" << endl;
-      out << "    " << "for (auto& item : " << a->name->id << ") {" << endl;
-      out << "      " << "if (item.get()) item->accept(\""<< a->name->id <<"\",visitor);"<<endl;
-      out << "    " << "}"<<endl;
-      out << "    " << "visitor.collectionPost();" << endl;
+  G->thunks[G->thunkpos].begin=  begin;
+  G->thunks[G->thunkpos].end=    end;
+  G->thunks[G->thunkpos].action= action;
+  ++G->thunkpos;
+  yyprofileThunk();
+}
+
+YY_LOCAL(yyoff) yyText(GREG *G, yyoff begin, yyoff end)
+{
+  yyoff yyleng= end - begin;
+  if (yyleng <= 0)
+    yyleng= 0;
+  else
+    {
+      while (G->textlen < (yyleng + 1))
+        {
+          G->textlen *= 2;
+          G->text= (char*)YY_REALLOC(G->text, G->textlen, G->data);
+        }
+      memcpy(G->text, G->buf + begin, yyleng);
     }
-  }
-  out << "    " << "visitor.visitPost(name,*this);" << endl;
-  out << "  " << "}" << endl;
-  
-  // Struct close
-  out << "};" << endl << endl;
-  
-  // ostream operator
-  out << "std::ostream& operator<< (std::ostream& out,const " << node.name->id << "& node) {" << endl;
-  out << "  " << "out << \"(" << node.name->id << ": \";" << endl;
-  for (auto& a : node.attributes) {      
-    if (a->type->collection) {
-      out << "  out << \"[\";" << endl;
-      out << "  " << "for (auto& item : node." << a->name->id << ") {" << endl;
-      out << "    " << "out << *item;" << endl;
-      out << "  " << "}" << endl;
-      out << "  out << \"]\";" << endl;
-    } else {
-      if (simpleType(a->type->id->id)) {
-        out << "  " << "out << node." << a->name->id << ";" << endl;
-      } else {
-        out << "  " << "out << *node." << a->name->id << ";" << endl;
-      }
+  G->text[yyleng]= '\0';
+  return yyleng;
+}
+
+YY_LOCAL(void) yyDone(GREG *G)
+{
+  yyoff pos;
+  for (pos= 0; pos < G->thunkpos; ++pos)
+    {
+      yythunk *thunk= &G->thunks[pos];
+      yyoff yyleng= thunk->end ? yyText(G, thunk->begin, thunk->end) : thunk->begin;
+      if (thunk->end) yylocate(G, thunk->begin);
+      thunk->line= G->line;
+      thunk->col= G->col;
+      yyprintf((stderr, "DO [%lld] %p %s\n", (long long)pos, thunk->action, G->text));
+      thunk->action(G, G->text, yyleng, thunk, G->data);
     }
-  }  
-  out << "  " << "out << \")\";" << endl;
-  out << "}" << endl << endl << endl;
+  G->thunkpos= 0;
 }
 
-struct CompileVisitor : public Visitor {
-  void visitPost(const std::string& name,const Nodes& node) {
-    auto& n=node.nodes;
+YY_LOCAL(void) yyCommit(GREG *G)
+{
+  yylocate(G, G->pos);
+  G->located -= G->pos;
+  if ((G->limit -= G->pos))
+    {
+      memmove(G->buf, G->buf + G->pos, G->limit);
+    }
+  G->offset += G->pos;
+  G->begin -= G->pos;
+  G->end -= G->pos;
+  G->pos= G->thunkpos= 0;
+}
 
-    out << "struct Visitor; struct Ast { int64_t line; int64_t col; virtual void can_dynamic_cast() {} virtual void accept(const std::string&,Visitor&)=0; };" << endl;
-    out << "std::ostream& operator<< (std::ostream& out,const Ast& node) { out << \"(Ast)\"; }" << endl;
-    out << "using std::string;" << endl << endl;
-    out << "struct Collection : Ast {" <<endl;
-    out << "  void accept(const string&, Visitor&) {};" << endl;
-    out << "  std::vector<std::unique_ptr<Ast>> items; " << endl;
-    out << "  void push_back(std::unique_ptr<Ast>&& item) { items.push_back(std::move(item)); } " << endl;
-    out << "  std::vector<std::unique_ptr<Ast>>& get() { return items; }" << endl;
-    out << "};" << endl << endl;
-    out << "template<class T,class S>" << endl;
-    out << "T tryCast(S s) {" << endl;
-    out << "  if (!s) return 0;" << endl;
-    out << "  T t=dynamic_cast<T>(s);" << endl;
-    out << "  if (!t) {" << endl;
-    out << "    std::cerr << \"AST type mismatch.\" << std::endl;" << endl;
-    out << "    throw;" << endl;
-    out << "  }" << endl;
-    out << "  return t;" << endl;
-    out << "}" << endl << endl;
+YY_LOCAL(int) yyAccept(GREG *G, yyoff tp0)
+{
+  if (tp0)
+    {
+      fprintf(stderr, "accept denied at %lld\n", (long long)tp0);
+      return 0;
+    }
+  else
+    {
+      yyDone(G);
+      yyCommit(G);
+    }
+  return 1;
+}
 
-    generateForwards(n); 
-    generateVisitor(n); 
-    for (auto& item : n) { 
-      generate(*reinterpret_cast<Node*>(item.get())); 
+YY_LOCAL(void) yyPush(GREG *G, char *text, yyoff count, yythunk *thunk, YY_XTYPE YY_XVAR) { while(count--) { new (&G->val[0]) YYSTYPE(); G->val++; } }
+YY_LOCAL(void) yyPop(GREG *G, char *text, yyoff count, yythunk *thunk, YY_XTYPE YY_XVAR)  { G->val -= count; }
+YY_LOCAL(void) yySet(GREG *G, char *text, yyoff count, yythunk *thunk, YY_XTYPE YY_XVAR)  { G->val[count]= std::move(G->ss); }
+YY_LOCAL(void) yyResetSS(GREG *G, char *text, yyoff count, yythunk *thunk, YY_XTYPE YY_XVAR)  { new (&G->ss) YYSTYPE(); }
+
+YY_LOCAL(void) yyPushCollection(GREG *G, char *text, yyoff count, yythunk *thunk, YY_XTYPE YY_XVAR) { G->collectionStack.push(std::unordered_map<int,std::unique_ptr<YY_CTYPE>>()); }
+YY_LOCAL(void) yyPopCollection(GREG *G, char *text, yyoff count, yythunk *thunk, YY_XTYPE YY_XVAR) { G->collectionStack.pop(); }
+YY_LOCAL(void) yyAddToCollection(GREG *G, char *text, yyoff count, yythunk *thunk, YY_XTYPE YY_XVAR) { if (!G->collectionStack.top()[count].get()) G->collectionStack.top()[count]=std::unique_ptr<YY_CTYPE>(new YY_CTYPE()); G->collectionStack.top()[count]->push_back(std::move(G->ss)); }
+
+YY_RULE(int) yy_grammar(GREG *G);
+
+typedef int (*yyrule)(GREG *G);
+
+YY_PARSE(int) YY_NAME(parse_from)(GREG *G, yyrule yystart)
+{
+  int yyok;
+  if (!G->buf)
+    {
+      G->buflen= YY_BUFFER_START_SIZE;
+      G->buf= (char*)YY_ALLOC(G->buflen, G->data);
+      G->limit= 0;
     }
-    generatePrettyPrintVisitor(n);
-		generateRubyDefinition(n);
-    generateRubyAstVisitor(n);
-  }
-};
+  if (!G->text)
+    {
+      G->textlen= YY_BUFFER_START_SIZE;
+      G->text= (char*)YY_ALLOC(G->textlen, G->data);
+      G->thunkslen= YY_STACK_SIZE;
+      G->thunks= (yythunk*)YY_ALLOC(sizeof(yythunk) * G->thunkslen, G->data);
+      G->valslen= YY_STACK_SIZE;
+      G->vals= (YYSTYPE*)YY_ALLOC(sizeof(YYSTYPE) * G->valslen, G->data);
+      G->begin= G->end= G->pos= G->thunkpos= 0;
+    }
+  G->pos = 0;
+  G->begin= G->end= G->pos;
+  G->thunkpos= 0;
+  G->val= G->vals;
+  yyok= yystart(G);
+  if (yyok) yyDone(G);
+  yyCommit(G);
+  return yyok;
+  (void)yyrefill;
+  (void)yymatchDot;
+  (void)yymatchChar;
+  (void)yymatchString;
+  (void)yymatchClass;
+  (void)yymatchRun;
+  (void)yyDo;
+  (void)yyText;
+  (void)yyDone;
+  (void)yyCommit;
+  (void)yyAccept;
+  (void)yyPush;
+  (void)yyPop;
+  (void)yySet;
+}
+
+YY_PARSE(int) YY_NAME(parse)(GREG *G)
+{
+  return YY_NAME(parse_from)(G, yy_grammar);
+}
+
+YY_PARSE(void) YY_NAME(init)(GREG *G)
+{
+    //memset(G, 0, sizeof(GREG));
+}
+/* Parses buf[0..len) in place instead of reading YY_INPUT, e.g. a memory-mapped file.
+ * Call before parsing; the buffer must stay valid and writable until deinit. */
+YY_PARSE(void) YY_NAME(input)(GREG *G, char *buf, yyoff len)
+{
+    G->buf= buf;
+    G->buflen= G->limit= len;
+    G->mapped= 1;
+}
+YY_PARSE(void) YY_NAME(deinit)(GREG *G)
+{
+    if (G->buf && !G->mapped) YY_FREE(G->buf);
+    if (G->text) YY_FREE(G->text);
+    if (G->thunks) YY_FREE(G->thunks);
+    if (G->vals) YY_FREE(G->vals);
+}
+YY_PARSE(GREG *) YY_NAME(parse_new)(YY_XTYPE data)
+{
+  GREG *G = (GREG *)YY_CALLOC(1, sizeof(GREG), G->data);
+  G->data = data;
+  return G;
+}
+
+YY_PARSE(void) YY_NAME(parse_free)(GREG *G)
+{
+  YY_NAME(deinit)(G);
+  YY_FREE(G);
+}
 
 
 #ifndef YY_ALLOC
@@ -463,7 +3305,7 @@ YY_CTYPE_DEFINITION()
 #define yy G->ss
 
 struct _yythunk; // forward declaration
-typedef void (*yyaction)(GREG *G, char *yytext, int yyleng, struct _yythunk *thunkpos, YY_XTYPE YY_XVAR);
+typedef void (*yyaction)(GREG *G, char *yytext, yyoff yyleng, struct _yythunk *thunkpos, YY_XTYPE YY_XVAR);
 typedef struct _yythunk { int begin, end;  int line,col; yyaction  action;  struct _yythunk *next; } yythunk;
 
 struct GREG {
@@ -574,7 +3416,7 @@ YY_LOCAL(void) yyDo(GREG *G, yyaction action, int begin, int end)
 
 YY_LOCAL(int) yyText(GREG *G, int begin, int end)
 {
-  int yyleng= end - begin;
+  yyoff yyleng= end - begin;
   if (yyleng <= 0)
     yyleng= 0;
   else
@@ -596,7 +3438,7 @@ YY_LOCAL(void) yyDone(GREG *G)
   for (pos= 0; pos < G->thunkpos; ++pos)
     {
       yythunk *thunk= &G->thunks[pos];
-      int yyleng= thunk->end ? yyText(G, thunk->begin, thunk->end) : thunk->begin;
+      yyoff yyleng= thunk->end ? yyText(G, thunk->begin, thunk->end) : thunk->begin;
       yyprintf((stderr, "DO [%d] %p %s\n", pos, thunk->action, G->text));
       thunk->action(G, G->text, yyleng, thunk, G->data);
     }
@@ -644,182 +3486,239 @@ YY_LOCAL(void) yyAddToCollection(GREG *G, char *text, int count, yythunk *thunk,
 
 #define YYACCEPT        yyAccept(G, yythunkpos0)
 
-YY_RULE(int) yy_space(GREG *G); /* 9 */
-YY_RULE(int) yy_comment(GREG *G); /* 8 */
-YY_RULE(int) yy_attribute_list(GREG *G); /* 7 */
-YY_RULE(int) yy_attribute(GREG *G); /* 6 */
-YY_RULE(int) yy_type(GREG *G); /* 5 */
-YY_RULE(int) yy_id(GREG *G); /* 4 */
+YY_RULE(int) yy_space(GREG *G); /* 11 */
+YY_RULE(int) yy_comment(GREG *G); /* 10 */
+YY_RULE(int) yy_attribute_list(GREG *G); /* 9 */
+YY_RULE(int) yy_attribute(GREG *G); /* 8 */
+YY_RULE(int) yy_type(GREG *G); /* 7 */
+YY_RULE(int) yy_id(GREG *G); /* 6 */
+YY_RULE(int) yy_sumdef(GREG *G); /* 5 */
+YY_RULE(int) yy_enumdef(GREG *G); /* 4 */
 YY_RULE(int) yy_astnode(GREG *G); /* 3 */
 YY_RULE(int) yy__(GREG *G); /* 2 */
 YY_RULE(int) yy_grammar(GREG *G); /* 1 */
 
-YY_ACTION(void) yy_1_astnode(GREG *G, char *yytext, int yyleng, yythunk *thunk, YY_XTYPE YY_XVAR)
+YY_ACTION(void) yy_1_sumdef(GREG *G, char *yytext, yyoff yyleng, yythunk *thunk, YY_XTYPE YY_XVAR)
+{
+#define a (G->collectionStack.top()[-1])
+#define i G->val[-2]
+  yyprintf((stderr, "do yy_1_sumdef\n"));
+   yy = located<Sum>(i,move(a)); ;
+#undef a
+#undef i
+}
+YY_ACTION(void) yy_1_enumdef(GREG *G, char *yytext, yyoff yyleng, yythunk *thunk, YY_XTYPE YY_XVAR)
 {
-#define a G->val[-1]
+#define v (G->collectionStack.top()[-1])
 #define i G->val[-2]
+  yyprintf((stderr, "do yy_1_enumdef\n"));
+   yy = located<Enum>(i,move(v)); ;
+#undef v
+#undef i
+}
+YY_ACTION(void) yy_1_astnode(GREG *G, char *yytext, yyoff yyleng, yythunk *thunk, YY_XTYPE YY_XVAR)
+{
+#define d G->val[-1]
+#define a G->val[-2]
+#define i G->val[-3]
   yyprintf((stderr, "do yy_1_astnode\n"));
-   yy = make_unique<Node>(move(i),move(a)); ;
+   yy = located<Node>(i,move(a),move(d)); ;
+#undef d
 #undef a
 #undef i
 }
-YY_ACTION(void) yy_1_attribute_list(GREG *G, char *yytext, int yyleng, yythunk *thunk, YY_XTYPE YY_XVAR)
+YY_ACTION(void) yy_1_attribute_list(GREG *G, char *yytext, yyoff yyleng, yythunk *thunk, YY_XTYPE YY_XVAR)
 {
 #define a (G->collectionStack.top()[-1])
   yyprintf((stderr, "do yy_1_attribute_list\n"));
    yy=move(a); ;
 #undef a
 }
-YY_ACTION(void) yy_1_attribute(GREG *G, char *yytext, int yyleng, yythunk *thunk, YY_XTYPE YY_XVAR)
+YY_ACTION(void) yy_1_attribute(GREG *G, char *yytext, yyoff yyleng, yythunk *thunk, YY_XTYPE YY_XVAR)
 {
 #define t G->val[-1]
 #define i G->val[-2]
   yyprintf((stderr, "do yy_1_attribute\n"));
-   yy = make_unique<Attribute>(move(i),move(t)); ;
+   yy = located<Attribute>(i,move(t)); ;
 #undef t
 #undef i
 }
-YY_ACTION(void) yy_2_type(GREG *G, char *yytext, int yyleng, yythunk *thunk, YY_XTYPE YY_XVAR)
+YY_ACTION(void) yy_3_type(GREG *G, char *yytext, yyoff yyleng, yythunk *thunk, YY_XTYPE YY_XVAR)
+{
+#define i G->val[-1]
+  yyprintf((stderr, "do yy_3_type\n"));
+   yy = located<Type>(i,false,false); ;
+#undef i
+}
+YY_ACTION(void) yy_2_type(GREG *G, char *yytext, yyoff yyleng, yythunk *thunk, YY_XTYPE YY_XVAR)
 {
 #define i G->val[-1]
   yyprintf((stderr, "do yy_2_type\n"));
-   yy = make_unique<Type>(move(i),false); ;
+   yy = located<Type>(i,false,true); ;
 #undef i
 }
-YY_ACTION(void) yy_1_type(GREG *G, char *yytext, int yyleng, yythunk *thunk, YY_XTYPE YY_XVAR)
+YY_ACTION(void) yy_1_type(GREG *G, char *yytext, yyoff yyleng, yythunk *thunk, YY_XTYPE YY_XVAR)
 {
 #define i G->val[-1]
   yyprintf((stderr, "do yy_1_type\n"));
-   yy = make_unique<Type>(move(i),true); ;
+   yy = located<Type>(i,true,false); ;
 #undef i
 }
-YY_ACTION(void) yy_1_id(GREG *G, char *yytext, int yyleng, yythunk *thunk, YY_XTYPE YY_XVAR)
+YY_ACTION(void) yy_1_id(GREG *G, char *yytext, yyoff yyleng, yythunk *thunk, YY_XTYPE YY_XVAR)
 {
   yyprintf((stderr, "do yy_1_id\n"));
-   yy = make_unique<Id>(yytext); ;
+   yy = make_unique<Id>(yytext); yy->line=thunk->line; yy->col=thunk->col; ;
 }
-YY_ACTION(void) yy_1_grammar(GREG *G, char *yytext, int yyleng, yythunk *thunk, YY_XTYPE YY_XVAR)
+YY_ACTION(void) yy_1_grammar(GREG *G, char *yytext, yyoff yyleng, yythunk *thunk, YY_XTYPE YY_XVAR)
 {
-#define n (G->collectionStack.top()[-1])
+#define s (G->collectionStack.top()[-1])
+#define e (G->collectionStack.top()[-2])
+#define n (G->collectionStack.top()[-3])
   yyprintf((stderr, "do yy_1_grammar\n"));
-   yy = make_unique<Nodes>(move(n)); ;
+   yy = make_unique<Nodes>(move(n),move(e),move(s)); ;
+#undef s
+#undef e
 #undef n
 }
 
 YY_RULE(int) yy_space(GREG *G)
 {
-  yyprintf((stderr, "%s\n", "space"));
-  l2:;	
-  {  G->maxPos=G->maxPos>G->pos?G->maxPos:G->pos; int yypos3= G->pos, yythunkpos3= G->thunkpos;  if (!yymatchClass(G, (unsigned char *)"\000\046\000\000\001\000\000\000\000\000\000\000\000\000\000\000\000\000\000\000\000\000\000\000\000\000\000\000\000\000\000\000")) goto l3;  goto l2;
-  l3:;	  G->pos= yypos3; G->thunkpos= yythunkpos3;
-  }
-  yyprintf((stderr, "  ok   %s @ %s\n", "space", G->buf+G->pos));
+  yyprintf((stderr, "%s\n", "space")); yyprofileEnter(11, "space");
+  static const yyrun yyrun2= yyrunInit((unsigned char *)"\000\046\000\000\001\000\000\000\000\000\000\000\000\000\000\000\000\000\000\000\000\000\000\000\000\000\000\000\000\000\000\000");  yymatchRun(G, &yyrun2);
+  yyprintf((stderr, "  ok   %s @ %s\n", "space", G->buf+G->pos)); yyprofileOk(11);
   return 1;
 }
 YY_RULE(int) yy_comment(GREG *G)
-{  G->maxPos=G->maxPos>G->pos?G->maxPos:G->pos; int yypos0= G->pos, yythunkpos0= G->thunkpos;
-  yyprintf((stderr, "%s\n", "comment")); if (!yy_space(G)) { goto l4; }  if (!yymatchString(G, "--")) goto l4;
-  l5:;	
-  {  G->maxPos=G->maxPos>G->pos?G->maxPos:G->pos; int yypos6= G->pos, yythunkpos6= G->thunkpos;  if (!yymatchClass(G, (unsigned char *)"\377\333\377\377\377\377\377\377\377\377\377\377\377\377\377\377\377\377\377\377\377\377\377\377\377\377\377\377\377\377\377\377")) goto l6;  goto l5;
-  l6:;	  G->pos= yypos6; G->thunkpos= yythunkpos6;
-  }
-  l7:;	
-  {  G->maxPos=G->maxPos>G->pos?G->maxPos:G->pos; int yypos8= G->pos, yythunkpos8= G->thunkpos;  if (!yymatchClass(G, (unsigned char *)"\000\044\000\000\000\000\000\000\000\000\000\000\000\000\000\000\000\000\000\000\000\000\000\000\000\000\000\000\000\000\000\000")) goto l8;  goto l7;
-  l8:;	  G->pos= yypos8; G->thunkpos= yythunkpos8;
-  } if (!yy_space(G)) { goto l4; }
-  yyprintf((stderr, "  ok   %s @ %s\n", "comment", G->buf+G->pos));
+{  G->maxPos=G->maxPos>G->pos?G->maxPos:G->pos; yyoff yypos0= G->pos, yythunkpos0= G->thunkpos;
+  yyprintf((stderr, "%s\n", "comment")); yyprofileEnter(10, "comment"); if (!yy_space(G)) { goto l4; }  if (!yymatchString(G, "--")) goto l4;
+  static const yyrun yyrun5= yyrunInit((unsigned char *)"\377\333\377\377\377\377\377\377\377\377\377\377\377\377\377\377\377\377\377\377\377\377\377\377\377\377\377\377\377\377\377\377");  yymatchRun(G, &yyrun5);
+  static const yyrun yyrun7= yyrunInit((unsigned char *)"\000\044\000\000\000\000\000\000\000\000\000\000\000\000\000\000\000\000\000\000\000\000\000\000\000\000\000\000\000\000\000\000");  yymatchRun(G, &yyrun7); if (!yy_space(G)) { goto l4; }
+  yyprintf((stderr, "  ok   %s @ %s\n", "comment", G->buf+G->pos)); yyprofileOk(10);
   return 1;
-  l4:;	  G->pos= yypos0; G->thunkpos= yythunkpos0;
+  l4:;	  yyprofileBacktrack(10, yypos0);  G->pos= yypos0; G->thunkpos= yythunkpos0;
   yyprintf((stderr, "  fail %s @ %s\n", "comment", G->buf+G->pos));
   return 0;
 }
 YY_RULE(int) yy_attribute_list(GREG *G)
-{  G->maxPos=G->maxPos>G->pos?G->maxPos:G->pos; int yypos0= G->pos, yythunkpos0= G->thunkpos;  yyDo(G, yyPushCollection, 0, 0);  yyDo(G, yyPush, 1, 0);
-  yyprintf((stderr, "%s\n", "attribute_list"));  if (!yymatchChar(G, '(')) goto l9; if (!yy__(G)) { goto l9; }
-  {  G->maxPos=G->maxPos>G->pos?G->maxPos:G->pos; int yypos10= G->pos, yythunkpos10= G->thunkpos; yyDo(G,yyResetSS,0,0);  if (!yy_attribute(G)) { goto l10; }  yyDo(G, yyAddToCollection, -1, 0);  goto l11;
-  l10:;	  G->pos= yypos10; G->thunkpos= yythunkpos10;
+{  G->maxPos=G->maxPos>G->pos?G->maxPos:G->pos; yyoff yypos0= G->pos, yythunkpos0= G->thunkpos;  yyDo(G, yyPushCollection, 0, 0);  yyDo(G, yyPush, 1, 0);
+  yyprintf((stderr, "%s\n", "attribute_list")); yyprofileEnter(9, "attribute_list");  if (!yymatchChar(G, '(')) goto l9; if (!yy__(G)) { goto l9; }
+  {  G->maxPos=G->maxPos>G->pos?G->maxPos:G->pos; yyoff yypos10= G->pos, yythunkpos10= G->thunkpos; yyDo(G,yyResetSS,0,0);  if (!yy_attribute(G)) { goto l10; }  yyDo(G, yyAddToCollection, -1, 0);  goto l11;
+  l10:;	  yyprofileBacktrack(9, yypos10);  G->pos= yypos10; G->thunkpos= yythunkpos10;
   }
   l11:;	 if (!yy__(G)) { goto l9; }
   l12:;	
-  {  G->maxPos=G->maxPos>G->pos?G->maxPos:G->pos; int yypos13= G->pos, yythunkpos13= G->thunkpos;  if (!yymatchChar(G, ',')) goto l13; if (!yy__(G)) { goto l13; } yyDo(G,yyResetSS,0,0);  if (!yy_attribute(G)) { goto l13; }  yyDo(G, yyAddToCollection, -1, 0); if (!yy__(G)) { goto l13; }  goto l12;
-  l13:;	  G->pos= yypos13; G->thunkpos= yythunkpos13;
+  {  G->maxPos=G->maxPos>G->pos?G->maxPos:G->pos; yyoff yypos13= G->pos, yythunkpos13= G->thunkpos;  if (!yymatchChar(G, ',')) goto l13; if (!yy__(G)) { goto l13; } yyDo(G,yyResetSS,0,0);  if (!yy_attribute(G)) { goto l13; }  yyDo(G, yyAddToCollection, -1, 0); if (!yy__(G)) { goto l13; }  goto l12;
+  l13:;	  yyprofileBacktrack(9, yypos13);  G->pos= yypos13; G->thunkpos= yythunkpos13;
   } if (!yy__(G)) { goto l9; }  if (!yymatchChar(G, ')')) goto l9;  yyDo(G, yy_1_attribute_list, G->begin, G->end);
-  yyprintf((stderr, "  ok   %s @ %s\n", "attribute_list", G->buf+G->pos));  yyDo(G, yyPop, 1, 0);  yyDo(G, yyPopCollection, 0, 0);
+  yyprintf((stderr, "  ok   %s @ %s\n", "attribute_list", G->buf+G->pos)); yyprofileOk(9);  yyDo(G, yyPop, 1, 0);  yyDo(G, yyPopCollection, 0, 0);
   return 1;
-  l9:;	  G->pos= yypos0; G->thunkpos= yythunkpos0;
+  l9:;	  yyprofileBacktrack(9, yypos0);  G->pos= yypos0; G->thunkpos= yythunkpos0;
   yyprintf((stderr, "  fail %s @ %s\n", "attribute_list", G->buf+G->pos));
   return 0;
 }
 YY_RULE(int) yy_attribute(GREG *G)
-{  G->maxPos=G->maxPos>G->pos?G->maxPos:G->pos; int yypos0= G->pos, yythunkpos0= G->thunkpos;  yyDo(G, yyPush, 2, 0);
-  yyprintf((stderr, "%s\n", "attribute")); if (!yy__(G)) { goto l14; } yyDo(G,yyResetSS,0,0);   yyDo(G, yySet, -2, 0); if (!yy_id(G)) { goto l14; }  yyDo(G, yySet, -2, 0); if (!yy__(G)) { goto l14; }  if (!yymatchChar(G, ':')) goto l14; if (!yy__(G)) { goto l14; } yyDo(G,yyResetSS,0,0);   yyDo(G, yySet, -1, 0); if (!yy_type(G)) { goto l14; }  yyDo(G, yySet, -1, 0); if (!yy__(G)) { goto l14; }  yyDo(G, yy_1_attribute, G->begin, G->end);
-  yyprintf((stderr, "  ok   %s @ %s\n", "attribute", G->buf+G->pos));  yyDo(G, yyPop, 2, 0);
+{  G->maxPos=G->maxPos>G->pos?G->maxPos:G->pos; yyoff yypos0= G->pos, yythunkpos0= G->thunkpos;  yyDo(G, yyPush, 2, 0);
+  yyprintf((stderr, "%s\n", "attribute")); yyprofileEnter(8, "attribute"); if (!yy__(G)) { goto l14; } yyDo(G,yyResetSS,0,0);   yyDo(G, yySet, -2, 0); if (!yy_id(G)) { goto l14; }  yyDo(G, yySet, -2, 0); if (!yy__(G)) { goto l14; }  if (!yymatchChar(G, ':')) goto l14; if (!yy__(G)) { goto l14; } yyDo(G,yyResetSS,0,0);   yyDo(G, yySet, -1, 0); if (!yy_type(G)) { goto l14; }  yyDo(G, yySet, -1, 0); if (!yy__(G)) { goto l14; }  yyDo(G, yy_1_attribute, G->begin, G->end);
+  yyprintf((stderr, "  ok   %s @ %s\n", "attribute", G->buf+G->pos)); yyprofileOk(8);  yyDo(G, yyPop, 2, 0);
   return 1;
-  l14:;	  G->pos= yypos0; G->thunkpos= yythunkpos0;
+  l14:;	  yyprofileBacktrack(8, yypos0);  G->pos= yypos0; G->thunkpos= yythunkpos0;
   yyprintf((stderr, "  fail %s @ %s\n", "attribute", G->buf+G->pos));
   return 0;
 }
 YY_RULE(int) yy_type(GREG *G)
-{  G->maxPos=G->maxPos>G->pos?G->maxPos:G->pos; int yypos0= G->pos, yythunkpos0= G->thunkpos;  yyDo(G, yyPush, 1, 0);
-  yyprintf((stderr, "%s\n", "type"));
-  {  G->maxPos=G->maxPos>G->pos?G->maxPos:G->pos; int yypos16= G->pos, yythunkpos16= G->thunkpos;  if (!yymatchChar(G, '[')) goto l17; if (!yy__(G)) { goto l17; } yyDo(G,yyResetSS,0,0);   yyDo(G, yySet, -1, 0); if (!yy_id(G)) { goto l17; }  yyDo(G, yySet, -1, 0); if (!yy__(G)) { goto l17; }  if (!yymatchChar(G, ']')) goto l17;  yyDo(G, yy_1_type, G->begin, G->end);  goto l16;
-  l17:;	  G->pos= yypos16; G->thunkpos= yythunkpos16; yyDo(G,yyResetSS,0,0);   yyDo(G, yySet, -1, 0); if (!yy_id(G)) { goto l15; }  yyDo(G, yySet, -1, 0);  yyDo(G, yy_2_type, G->begin, G->end);
+{  G->maxPos=G->maxPos>G->pos?G->maxPos:G->pos; yyoff yypos0= G->pos, yythunkpos0= G->thunkpos;  yyDo(G, yyPush, 1, 0);
+  yyprintf((stderr, "%s\n", "type")); yyprofileEnter(7, "type");
+  {  G->maxPos=G->maxPos>G->pos?G->maxPos:G->pos; yyoff yypos16= G->pos, yythunkpos16= G->thunkpos;  if (!yymatchChar(G, '[')) goto l17; if (!yy__(G)) { goto l17; } yyDo(G,yyResetSS,0,0);   yyDo(G, yySet, -1, 0); if (!yy_id(G)) { goto l17; }  yyDo(G, yySet, -1, 0); if (!yy__(G)) { goto l17; }  if (!yymatchChar(G, ']')) goto l17;  yyDo(G, yy_1_type, G->begin, G->end);  goto l16;
+  l17:;	  yyprofileBacktrack(7, yypos16);  G->pos= yypos16; G->thunkpos= yythunkpos16; yyDo(G,yyResetSS,0,0);   yyDo(G, yySet, -1, 0); if (!yy_id(G)) { goto l18; }  yyDo(G, yySet, -1, 0);  if (!yymatchChar(G, '!')) goto l18;  yyDo(G, yy_2_type, G->begin, G->end);  goto l16;
+  l18:;	  yyprofileBacktrack(7, yypos16);  G->pos= yypos16; G->thunkpos= yythunkpos16; yyDo(G,yyResetSS,0,0);   yyDo(G, yySet, -1, 0); if (!yy_id(G)) { goto l15; }  yyDo(G, yySet, -1, 0);  yyDo(G, yy_3_type, G->begin, G->end);
   }
   l16:;	
-  yyprintf((stderr, "  ok   %s @ %s\n", "type", G->buf+G->pos));  yyDo(G, yyPop, 1, 0);
+  yyprintf((stderr, "  ok   %s @ %s\n", "type", G->buf+G->pos)); yyprofileOk(7);  yyDo(G, yyPop, 1, 0);
   return 1;
-  l15:;	  G->pos= yypos0; G->thunkpos= yythunkpos0;
+  l15:;	  yyprofileBacktrack(7, yypos0);  G->pos= yypos0; G->thunkpos= yythunkpos0;
   yyprintf((stderr, "  fail %s @ %s\n", "type", G->buf+G->pos));
   return 0;
 }
 YY_RULE(int) yy_id(GREG *G)
-{  G->maxPos=G->maxPos>G->pos?G->maxPos:G->pos; int yypos0= G->pos, yythunkpos0= G->thunkpos;
-  yyprintf((stderr, "%s\n", "id"));  yyText(G, G->begin, G->end);  if (!(YY_BEGIN)) goto l18;  if (!yymatchClass(G, (unsigned char *)"\000\000\000\000\000\000\377\003\376\377\377\207\376\377\377\007\000\000\000\000\000\000\000\000\000\000\000\000\000\000\000\000")) goto l18;
-  l19:;	
-  {  G->maxPos=G->maxPos>G->pos?G->maxPos:G->pos; int yypos20= G->pos, yythunkpos20= G->thunkpos;  if (!yymatchClass(G, (unsigned char *)"\000\000\000\000\000\000\377\003\376\377\377\207\376\377\377\007\000\000\000\000\000\000\000\000\000\000\000\000\000\000\000\000")) goto l20;  goto l19;
-  l20:;	  G->pos= yypos20; G->thunkpos= yythunkpos20;
-  }  yyText(G, G->begin, G->end);  if (!(YY_END)) goto l18;  yyDo(G, yy_1_id, G->begin, G->end);
-  yyprintf((stderr, "  ok   %s @ %s\n", "id", G->buf+G->pos));
+{  G->maxPos=G->maxPos>G->pos?G->maxPos:G->pos; yyoff yypos0= G->pos, yythunkpos0= G->thunkpos;
+  yyprintf((stderr, "%s\n", "id")); yyprofileEnter(6, "id");  yyText(G, G->begin, G->end);  if (!(YY_BEGIN)) goto l19;  if (!yymatchClass(G, (unsigned char *)"\000\000\000\000\000\000\377\003\376\377\377\207\376\377\377\007\000\000\000\000\000\000\000\000\000\000\000\000\000\000\000\000")) goto l19;
+  static const yyrun yyrun20= yyrunInit((unsigned char *)"\000\000\000\000\000\000\377\003\376\377\377\207\376\377\377\007\000\000\000\000\000\000\000\000\000\000\000\000\000\000\000\000");  yymatchRun(G, &yyrun20);  yyText(G, G->begin, G->end);  if (!(YY_END)) goto l19;  yyDo(G, yy_1_id, G->begin, G->end);
+  yyprintf((stderr, "  ok   %s @ %s\n", "id", G->buf+G->pos)); yyprofileOk(6);
   return 1;
-  l18:;	  G->pos= yypos0; G->thunkpos= yythunkpos0;
+  l19:;	  yyprofileBacktrack(6, yypos0);  G->pos= yypos0; G->thunkpos= yythunkpos0;
   yyprintf((stderr, "  fail %s @ %s\n", "id", G->buf+G->pos));
   return 0;
 }
+YY_RULE(int) yy_sumdef(GREG *G)
+{  G->maxPos=G->maxPos>G->pos?G->maxPos:G->pos; yyoff yypos0= G->pos, yythunkpos0= G->thunkpos;  yyDo(G, yyPushCollection, 0, 0);  yyDo(G, yyPush, 2, 0);
+  yyprintf((stderr, "%s\n", "sumdef")); yyprofileEnter(5, "sumdef"); yyDo(G,yyResetSS,0,0);   yyDo(G, yySet, -2, 0); if (!yy_id(G)) { goto l22; }  yyDo(G, yySet, -2, 0); if (!yy__(G)) { goto l22; }  if (!yymatchChar(G, '=')) goto l22; if (!yy__(G)) { goto l22; } yyDo(G,yyResetSS,0,0);  if (!yy_id(G)) { goto l22; }  yyDo(G, yyAddToCollection, -1, 0); if (!yy__(G)) { goto l22; }
+  l23:;	
+  {  G->maxPos=G->maxPos>G->pos?G->maxPos:G->pos; yyoff yypos24= G->pos, yythunkpos24= G->thunkpos;  if (!yymatchChar(G, '|')) goto l24; if (!yy__(G)) { goto l24; } yyDo(G,yyResetSS,0,0);  if (!yy_id(G)) { goto l24; }  yyDo(G, yyAddToCollection, -1, 0); if (!yy__(G)) { goto l24; }  goto l23;
+  l24:;	  yyprofileBacktrack(5, yypos24);  G->pos= yypos24; G->thunkpos= yythunkpos24;
+  }  yyDo(G, yy_1_sumdef, G->begin, G->end);
+  yyprintf((stderr, "  ok   %s @ %s\n", "sumdef", G->buf+G->pos)); yyprofileOk(5);  yyDo(G, yyPop, 2, 0);  yyDo(G, yyPopCollection, 0, 0);
+  return 1;
+  l22:;	  yyprofileBacktrack(5, yypos0);  G->pos= yypos0; G->thunkpos= yythunkpos0;
+  yyprintf((stderr, "  fail %s @ %s\n", "sumdef", G->buf+G->pos));
+  return 0;
+}
+YY_RULE(int) yy_enumdef(GREG *G)
+{  G->maxPos=G->maxPos>G->pos?G->maxPos:G->pos; yyoff yypos0= G->pos, yythunkpos0= G->thunkpos;  yyDo(G, yyPushCollection, 0, 0);  yyDo(G, yyPush, 2, 0);
+  yyprintf((stderr, "%s\n", "enumdef")); yyprofileEnter(4, "enumdef");  if (!yymatchString(G, "enum")) goto l25; if (!yy__(G)) { goto l25; } yyDo(G,yyResetSS,0,0);   yyDo(G, yySet, -2, 0); if (!yy_id(G)) { goto l25; }  yyDo(G, yySet, -2, 0); if (!yy__(G)) { goto l25; }  if (!yymatchChar(G, '{')) goto l25; if (!yy__(G)) { goto l25; } yyDo(G,yyResetSS,0,0);  if (!yy_id(G)) { goto l25; }  yyDo(G, yyAddToCollection, -1, 0); if (!yy__(G)) { goto l25; }
+  l26:;	
+  {  G->maxPos=G->maxPos>G->pos?G->maxPos:G->pos; yyoff yypos27= G->pos, yythunkpos27= G->thunkpos;  if (!yymatchChar(G, ',')) goto l27; if (!yy__(G)) { goto l27; } yyDo(G,yyResetSS,0,0);  if (!yy_id(G)) { goto l27; }  yyDo(G, yyAddToCollection, -1, 0); if (!yy__(G)) { goto l27; }  goto l26;
+  l27:;	  yyprofileBacktrack(4, yypos27);  G->pos= yypos27; G->thunkpos= yythunkpos27;
+  }  if (!yymatchChar(G, '}')) goto l25;  yyDo(G, yy_1_enumdef, G->begin, G->end);
+  yyprintf((stderr, "  ok   %s @ %s\n", "enumdef", G->buf+G->pos)); yyprofileOk(4);  yyDo(G, yyPop, 2, 0);  yyDo(G, yyPopCollection, 0, 0);
+  return 1;
+  l25:;	  yyprofileBacktrack(4, yypos0);  G->pos= yypos0; G->thunkpos= yythunkpos0;
+  yyprintf((stderr, "  fail %s @ %s\n", "enumdef", G->buf+G->pos));
+  return 0;
+}
 YY_RULE(int) yy_astnode(GREG *G)
-{  G->maxPos=G->maxPos>G->pos?G->maxPos:G->pos; int yypos0= G->pos, yythunkpos0= G->thunkpos;  yyDo(G, yyPush, 2, 0);
-  yyprintf((stderr, "%s\n", "astnode")); yyDo(G,yyResetSS,0,0);   yyDo(G, yySet, -2, 0); if (!yy_id(G)) { goto l21; }  yyDo(G, yySet, -2, 0); if (!yy__(G)) { goto l21; } yyDo(G,yyResetSS,0,0);   yyDo(G, yySet, -1, 0); if (!yy_attribute_list(G)) { goto l21; }  yyDo(G, yySet, -1, 0);  yyDo(G, yy_1_astnode, G->begin, G->end);
-  yyprintf((stderr, "  ok   %s @ %s\n", "astnode", G->buf+G->pos));  yyDo(G, yyPop, 2, 0);
+{  G->maxPos=G->maxPos>G->pos?G->maxPos:G->pos; yyoff yypos0= G->pos, yythunkpos0= G->thunkpos;  yyDo(G, yyPush, 3, 0);
+  yyprintf((stderr, "%s\n", "astnode")); yyprofileEnter(3, "astnode"); yyDo(G,yyResetSS,0,0);   yyDo(G, yySet, -3, 0); if (!yy_id(G)) { goto l28; }  yyDo(G, yySet, -3, 0); if (!yy__(G)) { goto l28; } yyDo(G,yyResetSS,0,0);   yyDo(G, yySet, -2, 0); if (!yy_attribute_list(G)) { goto l28; }  yyDo(G, yySet, -2, 0);
+  {  G->maxPos=G->maxPos>G->pos?G->maxPos:G->pos; yyoff yypos29= G->pos, yythunkpos29= G->thunkpos; if (!yy__(G)) { goto l29; }  if (!yymatchString(G, "=>")) goto l29; if (!yy__(G)) { goto l29; } yyDo(G,yyResetSS,0,0);   yyDo(G, yySet, -1, 0); if (!yy_attribute_list(G)) { goto l29; }  yyDo(G, yySet, -1, 0);  goto l30;
+  l29:;	  yyprofileBacktrack(3, yypos29);  G->pos= yypos29; G->thunkpos= yythunkpos29;
+  }
+  l30:;	  yyDo(G, yy_1_astnode, G->begin, G->end);
+  yyprintf((stderr, "  ok   %s @ %s\n", "astnode", G->buf+G->pos)); yyprofileOk(3);  yyDo(G, yyPop, 3, 0);
   return 1;
-  l21:;	  G->pos= yypos0; G->thunkpos= yythunkpos0;
+  l28:;	  yyprofileBacktrack(3, yypos0);  G->pos= yypos0; G->thunkpos= yythunkpos0;
   yyprintf((stderr, "  fail %s @ %s\n", "astnode", G->buf+G->pos));
   return 0;
 }
 YY_RULE(int) yy__(GREG *G)
-{  G->maxPos=G->maxPos>G->pos?G->maxPos:G->pos; int yypos0= G->pos, yythunkpos0= G->thunkpos;
-  yyprintf((stderr, "%s\n", "_"));
-  {  G->maxPos=G->maxPos>G->pos?G->maxPos:G->pos; int yypos23= G->pos, yythunkpos23= G->thunkpos; if (!yy_comment(G)) { goto l24; }  goto l23;
-  l24:;	  G->pos= yypos23; G->thunkpos= yythunkpos23; if (!yy_space(G)) { goto l22; }
+{  G->maxPos=G->maxPos>G->pos?G->maxPos:G->pos; yyoff yypos0= G->pos, yythunkpos0= G->thunkpos;
+  yyprintf((stderr, "%s\n", "_")); yyprofileEnter(2, "_");
+  {  G->maxPos=G->maxPos>G->pos?G->maxPos:G->pos; yyoff yypos32= G->pos, yythunkpos32= G->thunkpos; if (!yy_comment(G)) { goto l33; }  goto l32;
+  l33:;	  yyprofileBacktrack(2, yypos32);  G->pos= yypos32; G->thunkpos= yythunkpos32; if (!yy_space(G)) { goto l31; }
   }
-  l23:;	
-  yyprintf((stderr, "  ok   %s @ %s\n", "_", G->buf+G->pos));
+  l32:;	
+  yyprintf((stderr, "  ok   %s @ %s\n", "_", G->buf+G->pos)); yyprofileOk(2);
   return 1;
-  l22:;	  G->pos= yypos0; G->thunkpos= yythunkpos0;
+  l31:;	  yyprofileBacktrack(2, yypos0);  G->pos= yypos0; G->thunkpos= yythunkpos0;
   yyprintf((stderr, "  fail %s @ %s\n", "_", G->buf+G->pos));
   return 0;
 }
 YY_RULE(int) yy_grammar(GREG *G)
-{  G->maxPos=G->maxPos>G->pos?G->maxPos:G->pos; int yypos0= G->pos, yythunkpos0= G->thunkpos;  yyDo(G, yyPushCollection, 0, 0);  yyDo(G, yyPush, 1, 0);
-  yyprintf((stderr, "%s\n", "grammar"));
-  l26:;	
-  {  G->maxPos=G->maxPos>G->pos?G->maxPos:G->pos; int yypos27= G->pos, yythunkpos27= G->thunkpos; if (!yy__(G)) { goto l27; } yyDo(G,yyResetSS,0,0);  if (!yy_astnode(G)) { goto l27; }  yyDo(G, yyAddToCollection, -1, 0); if (!yy__(G)) { goto l27; }  goto l26;
-  l27:;	  G->pos= yypos27; G->thunkpos= yythunkpos27;
+{  G->maxPos=G->maxPos>G->pos?G->maxPos:G->pos; yyoff yypos0= G->pos, yythunkpos0= G->thunkpos;  yyDo(G, yyPushCollection, 0, 0);  yyDo(G, yyPush, 3, 0);
+  yyprintf((stderr, "%s\n", "grammar")); yyprofileEnter(1, "grammar");
+  l35:;	
+  {  G->maxPos=G->maxPos>G->pos?G->maxPos:G->pos; yyoff yypos36= G->pos, yythunkpos36= G->thunkpos; if (!yy__(G)) { goto l36; }
+  {  G->maxPos=G->maxPos>G->pos?G->maxPos:G->pos; yyoff yypos37= G->pos, yythunkpos37= G->thunkpos; yyDo(G,yyResetSS,0,0);  if (!yy_astnode(G)) { goto l38; }  yyDo(G, yyAddToCollection, -3, 0);  goto l37;
+  l38:;	  yyprofileBacktrack(1, yypos37);  G->pos= yypos37; G->thunkpos= yythunkpos37; yyDo(G,yyResetSS,0,0);  if (!yy_enumdef(G)) { goto l39; }  yyDo(G, yyAddToCollection, -2, 0);  goto l37;
+  l39:;	  yyprofileBacktrack(1, yypos37);  G->pos= yypos37; G->thunkpos= yythunkpos37; yyDo(G,yyResetSS,0,0);  if (!yy_sumdef(G)) { goto l36; }  yyDo(G, yyAddToCollection, -1, 0);
   }
-  {  G->maxPos=G->maxPos>G->pos?G->maxPos:G->pos; int yypos28= G->pos, yythunkpos28= G->thunkpos;  if (!yymatchDot(G)) goto l28;  goto l25;
-  l28:;	  G->pos= yypos28; G->thunkpos= yythunkpos28;
+  l37:;	 if (!yy__(G)) { goto l36; }  goto l35;
+  l36:;	  yyprofileBacktrack(1, yypos36);  G->pos= yypos36; G->thunkpos= yythunkpos36;
+  }
+  {  G->maxPos=G->maxPos>G->pos?G->maxPos:G->pos; yyoff yypos40= G->pos, yythunkpos40= G->thunkpos;  if (!yymatchDot(G)) goto l40;  goto l34;
+  l40:;	  yyprofileBacktrack(1, yypos40);  G->pos= yypos40; G->thunkpos= yythunkpos40;
   }  yyDo(G, yy_1_grammar, G->begin, G->end);
-  yyprintf((stderr, "  ok   %s @ %s\n", "grammar", G->buf+G->pos));  yyDo(G, yyPop, 1, 0);  yyDo(G, yyPopCollection, 0, 0);
+  yyprintf((stderr, "  ok   %s @ %s\n", "grammar", G->buf+G->pos)); yyprofileOk(1);  yyDo(G, yyPop, 3, 0);  yyDo(G, yyPopCollection, 0, 0);
   return 1;
-  l25:;	  G->pos= yypos0; G->thunkpos= yythunkpos0;
+  l34:;	  yyprofileBacktrack(1, yypos0);  G->pos= yypos0; G->thunkpos= yythunkpos0;
   yyprintf((stderr, "  fail %s @ %s\n", "grammar", G->buf+G->pos));
   return 0;
 }
@@ -898,13 +3797,38 @@ YY_PARSE(void) YY_NAME(parse_free)(GREG *G)
 #endif
 
 
-int main()
+int main(int argc,char** argv)
 {
+  for (int arg=1;arg<argc;++arg) {
+    std::string option=argv[arg];
+    if (option=="--values") options.values=true;
+    else if (option=="--persistent") options.persistent=true;
+    else if (option=="--timing") options.timing=true;
+    else {
+      cerr << "Usage: " << argv[0] << " [--values|--persistent] [--timing] < schema.ast > ast.hpp" << endl;
+      return 1;
+    }
+  }
+  if (options.values&&options.persistent) {
+    cerr << "--values and --persistent can not be combined." << endl;
+    return 1;
+  }
+
+  std::ios::sync_with_stdio(false);
   GREG g;
   GREG *G=&g;
   
+  auto start=std::chrono::steady_clock::now();
   yyinit(G);
-  if (!yyparse(G)) {
+  // Parse a schema file in place rather than copying it in through YY_INPUT
+  struct stat input;
+  if (fstat(0,&input)==0&&S_ISREG(input.st_mode)&&input.st_size>0) {
+    void* mapped=mmap(nullptr,input.st_size,PROT_READ|PROT_WRITE,MAP_PRIVATE,0,0);
+    if (mapped!=MAP_FAILED) yyinput(G,static_cast<char*>(mapped),input.st_size);
+  }
+  int parsed=yyparse(G);
+  auto generating=std::chrono::steady_clock::now();
+  if (!parsed) {
     // Find current line
     uint64_t line=1;
     for (uint64_t index=0;index<G->maxPos;++index) if (G->buf[index]=='\n') ++line;
@@ -913,22 +3837,31 @@ int main()
     uint64_t col=1;
     for (uint64_t index=G->maxPos;index>0&&G->buf[index]!='\n';++col,--index);
     
-    // Delimit text with \0 at first newline after error
-    for (uint64_t index=G->maxPos;;++index) {
+    // Find the end of the line with the error
+    uint64_t index=G->maxPos;
+    for (;;++index) {
       if (index>=G->limit&&(G->pos=index,!yyrefill(G))) break;
-      if (!G->buf[index] || G->buf[index]=='\r' || G->buf[index]=='\n') {
-        G->buf[index]=0;
-        break;
-      }
+      if (!G->buf[index] || G->buf[index]=='\r' || G->buf[index]=='\n') break;
     }
 
     // Report error
     cerr << "Line " << line << ", column " << col << " ";
-    cerr << "Can not parse: \"" << &G->buf[G->maxPos] << "\"" << endl;
+    cerr << "Can not parse: \"" << std::string(G->buf+G->maxPos,index-G->maxPos) << "\"" << endl;
   }
 
+#ifdef YY_PROFILE
+  yyprofileReport(stderr);
+#endif
+
   CompileVisitor c;
   G->ss->accept("root",c);
+  out.flush();
+
+  if (options.timing) {
+    auto done=std::chrono::steady_clock::now();
+    cerr << "parse_ns " << std::chrono::duration_cast<std::chrono::nanoseconds>(generating-start).count();
+    cerr << " generate_ns " << std::chrono::duration_cast<std::chrono::nanoseconds>(done-generating).count() << endl;
+  }
   
   //PrettyPrintVisitor p; G->ss->accept("root",p); cerr << endl << endl << endl;
 	
@@ -0,0 +1,91 @@
+// Measures the code astgen generates for one synthetic schema (see synth.cpp): building,
+// accept() with an empty visitor, operator<<, PrettyPrintVisitor and destruction.
+// Prints one JSON object per phase and tree size:
+//
+//   {"schema":"wide","nodes":1000,"phase":"construct","ns_per_node":41.2,"bytes_per_node":48.0}
+//
+// Usage: bench [nodes...], default 1000 10000 100000 1000000.
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+#include <new>
+#include <stack>
+#include <streambuf>
+#include <string>
+#include <tuple>
+#include <vector>
+
+#include "bench_ast.hpp"
+#include "bench_build.hpp"
+
+#ifndef BENCH_SCHEMA
+#define BENCH_SCHEMA "unknown"
+#endif
+
+// Bytes requested from operator new, to report memory per node
+static uint64_t allocated=0;
+
+void* operator new(std::size_t size) {
+  allocated+=size;
+  void* p=std::malloc(size);
+  if (!p) throw std::bad_alloc();
+  return p;
+}
+
+void operator delete(void* p) noexcept { std::free(p); }
+void operator delete(void* p,std::size_t) noexcept { std::free(p); }
+
+struct NullBuffer : std::streambuf {
+  int overflow(int c) { return c; }
+  std::streamsize xsputn(const char*,std::streamsize n) { return n; }
+};
+
+typedef std::chrono::steady_clock Clock;
+
+static void report(const char* phase,uint64_t nodes,Clock::time_point start,uint64_t bytes) {
+  double ns=std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now()-start).count();
+  std::cout << "{\"schema\":\"" << BENCH_SCHEMA << "\",\"nodes\":" << nodes << ",\"phase\":\"" << phase << "\""
+            << ",\"ns_per_node\":" << ns/nodes << ",\"bytes_per_node\":" << double(bytes)/nodes << "}" << std::endl;
+}
+
+int main(int argc,char** argv) {
+  std::vector<uint64_t> sizes;
+  for (int arg=1;arg<argc;++arg) sizes.push_back(std::strtoull(argv[arg],nullptr,10));
+  if (sizes.empty()) sizes={1000,10000,100000,1000000};
+
+  NullBuffer nullBuffer;
+  std::ostream null(&nullBuffer);
+
+  for (auto requested : sizes) {
+    uint64_t nodes=0;
+    uint64_t before=allocated;
+    auto start=Clock::now();
+    auto root=build(requested,nodes);
+    report("construct",nodes,start,allocated-before);
+
+    Visitor visitor;
+    before=allocated; start=Clock::now();
+    root->accept("root",visitor);
+    report("accept",nodes,start,allocated-before);
+
+    before=allocated; start=Clock::now();
+    null << *root;
+    report("operator<<",nodes,start,allocated-before);
+
+    auto cerrBuffer=std::cerr.rdbuf(&nullBuffer);
+    before=allocated; start=Clock::now();
+    {
+      PrettyPrintVisitor printer;
+      root->accept("root",printer);
+    }
+    report("pretty_print",nodes,start,allocated-before);
+    std::cerr.rdbuf(cerrBuffer);
+
+    start=Clock::now();
+    root.reset();
+    report("destroy",nodes,start,0);
+  }
+  return 0;
+}
@@ -0,0 +1,78 @@
+// Measures astgen itself on synthetic schemas of growing size (synth kinds N). For every
+// size it prints one JSON object with the parse and generation time astgen reports with
+// --timing, its peak resident set and the size of the generated header:
+//
+//   {"kinds":10000,"schema_bytes":...,"parse_ms":...,"generate_ms":...,"peak_rss_kb":...,"output_bytes":...}
+//
+// Usage: scale astgen synth workdir [kinds...], default 100 1000 10000.
+#include <cstdint>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+using namespace std;
+
+static uint64_t fileSize(const string& path) {
+  struct stat info;
+  return stat(path.c_str(),&info)==0?info.st_size:0;
+}
+
+// Runs program with stdin, stdout and stderr redirected to files, returns its peak RSS in KB
+static long run(const vector<string>& command,const string& in,const string& out,const string& err) {
+  pid_t pid=fork();
+  if (pid==0) {
+    dup2(open(in.c_str(),O_RDONLY),0);
+    dup2(open(out.c_str(),O_WRONLY|O_CREAT|O_TRUNC,0644),1);
+    dup2(open(err.c_str(),O_WRONLY|O_CREAT|O_TRUNC,0644),2);
+    vector<char*> args;
+    for (auto& arg : command) args.push_back(const_cast<char*>(arg.c_str()));
+    args.push_back(nullptr);
+    execv(args[0],args.data());
+    _exit(127);
+  }
+  int status=0;
+  struct rusage usage;
+  if (pid<0||wait4(pid,&status,0,&usage)<0||!WIFEXITED(status)||WEXITSTATUS(status)!=0) {
+    cerr << command[0] << " failed, see " << err << endl;
+    exit(1);
+  }
+  return usage.ru_maxrss;
+}
+
+int main(int argc,char** argv) {
+  if (argc<4) {
+    cerr << "Usage: " << argv[0] << " astgen synth workdir [kinds...]" << endl;
+    return 1;
+  }
+  string astgen=argv[1],synth=argv[2],dir=argv[3];
+  vector<string> sizes;
+  for (int arg=4;arg<argc;++arg) sizes.push_back(argv[arg]);
+  if (sizes.empty()) sizes={"100","1000","10000"};
+
+  for (auto& kinds : sizes) {
+    string schema=dir+"/kinds-"+kinds+".ast",header=dir+"/kinds-"+kinds+".hpp",log=dir+"/kinds-"+kinds+".log";
+    run({synth,"kinds",kinds},"/dev/null",schema,log);
+    long rss=run({astgen,"--timing"},schema,header,log);
+
+    // astgen --timing ends its stderr with "parse_ns P generate_ns G"
+    ifstream timing(log);
+    string line,last,label;
+    while (getline(timing,line)) last=line;
+    double parseNs=0,generateNs=0;
+    istringstream(last) >> label >> parseNs >> label >> generateNs;
+
+    cout << "{\"kinds\":" << kinds << ",\"schema_bytes\":" << fileSize(schema)
+         << ",\"parse_ms\":" << parseNs/1e6 << ",\"generate_ms\":" << generateNs/1e6
+         << ",\"peak_rss_kb\":" << rss << ",\"output_bytes\":" << fileSize(header) << "}" << endl;
+  }
+  return 0;
+}
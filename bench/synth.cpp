@@ -0,0 +1,114 @@
+// Writes synthetic astgen schemas for the benchmarks, and for each schema a builder
+// header that fills a Root with about the requested number of nodes.
+//
+//   synth wide|deep|list|kinds|padded [size]  schema on stdout
+//   synth --builder wide|deep|list [size]     builder on stdout
+//
+// wide: Wide nodes with size Leaf children, deep: chains of size distinct kinds,
+// list: List nodes with size Item elements, kinds: size node kinds and an enum per
+// hundred kinds, to measure astgen itself on large schemas. Kinds are declared children first, since the
+// generated code uses a child's members inline. padded: the list schema with size MiB of
+// spaces ending its declarations' lines, to test input beyond 2 GiB.
+#include <cstdlib>
+#include <iostream>
+#include <string>
+
+using namespace std;
+
+static void usage(const char* name) {
+  cerr << "Usage: " << name << " [--builder] wide|deep|list|kinds|padded [size]" << endl;
+  exit(1);
+}
+
+// Writes mebibytes of spaces, which keep the lines and columns of what follows the same as
+// without padding
+static void padding(int mebibytes) {
+  string block(1<<20,' ');
+  for (int i=0;i<mebibytes;++i) cout.write(block.data(),block.size());
+}
+
+static void schema(const string& shape,int size) {
+  if (shape=="padded") {
+    cout << "Item(value:int64_t)";
+    padding(size/2);
+    cout << "\nList(items:[Item])";
+    padding(size-size/2);
+    cout << "\nRoot(items:[List])\n";
+  } else if (shape=="wide") {
+    cout << "Leaf(value:int64_t,name:string)\n";
+    cout << "Wide(";
+    for (int i=0;i<size;++i) cout << (i?",":"") << "f" << i << ":Leaf";
+    cout << ")\n";
+    cout << "Root(items:[Wide])\n";
+  } else if (shape=="deep") {
+    for (int i=size-1;i>=0;--i) {
+      cout << "K" << i << "(value:int64_t";
+      if (i+1<size) cout << ",child:K" << i+1;
+      cout << ")\n";
+    }
+    cout << "Root(items:[K0])\n";
+  } else if (shape=="kinds") {
+    for (int i=0;i<size;++i) {
+      if (i%100==0) cout << "enum E" << i/100 << " { A, B, C }\n";
+      cout << "K" << i << "(value:int64_t,name:string,flag:E" << i/100;
+      if (i>0) cout << ",prev:K" << i-1 << ",items:[K" << i/2 << "]";
+      cout << ")\n";
+    }
+  } else {
+    cout << "Item(value:int64_t)\n";
+    cout << "List(items:[Item])\n";
+    cout << "Root(items:[List])\n";
+  }
+}
+
+static void builder(const string& shape,int size) {
+  string top=shape=="wide"?"Wide":shape=="deep"?"K0":"List";
+  int groupNodes=shape=="wide"?size+1:shape=="deep"?size:size+1;
+
+  cout << "// Generated by synth for the " << shape << " schema, size " << size << "\n";
+  cout << "static const uint64_t groupNodes=" << groupNodes << ";\n\n";
+  cout << "inline std::unique_ptr<" << top << "> group(int64_t value) {\n";
+  cout << "  std::unique_ptr<" << top << "> node(new " << top << "());\n";
+  if (shape=="wide") {
+    for (int i=0;i<size;++i) {
+      cout << "  node->f" << i << ".reset(new Leaf());\n";
+      cout << "  node->f" << i << "->value=value+" << i << ";\n";
+    }
+  } else if (shape=="deep") {
+    cout << "  node->value=value;\n";
+    string path="node";
+    for (int i=1;i<size;++i) {
+      cout << "  " << path << "->child.reset(new K" << i << "());\n";
+      path+="->child";
+      cout << "  " << path << "->value=value+" << i << ";\n";
+    }
+  } else {
+    cout << "  for (int64_t i=0;i<" << size << ";++i) {\n";
+    cout << "    node->items.push_back(std::unique_ptr<Item>(new Item()));\n";
+    cout << "    node->items.back()->value=value+i;\n";
+    cout << "  }\n";
+  }
+  cout << "  return node;\n";
+  cout << "}\n\n";
+  cout << "// Returns a tree of 1+groups*groupNodes nodes, at least the requested count\n";
+  cout << "inline std::unique_ptr<Root> build(uint64_t nodes,uint64_t& built) {\n";
+  cout << "  std::unique_ptr<Root> root(new Root());\n";
+  cout << "  for (built=1;built<nodes;built+=groupNodes) root->items.push_back(group(built));\n";
+  cout << "  return root;\n";
+  cout << "}\n";
+}
+
+int main(int argc,char** argv) {
+  int arg=1;
+  bool build=arg<argc&&string(argv[arg])=="--builder";
+  if (build) ++arg;
+  if (arg>=argc) usage(argv[0]);
+  string shape=argv[arg++];
+  if (shape!="wide"&&shape!="deep"&&shape!="list"&&(build||(shape!="kinds"&&shape!="padded"))) usage(argv[0]);
+  int size=arg<argc?atoi(argv[arg]):16;
+  if (size<(shape=="padded"?0:1)) usage(argv[0]);
+
+  if (build) builder(shape,size);
+  else schema(shape,size);
+  return 0;
+}
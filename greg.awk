@@ -0,0 +1,53 @@
+# Adapts greg's output for astgen.peg to the parser runtime in its prologue:
+#  - rule locals and action text lengths are yyoff, so inputs past 2 GiB parse
+#  - each rule reports entering, matching and backtracking to the YY_PROFILE hooks, and so
+#    does each alternative, option or loop iteration that fails after consuming input
+#  - 'class*' loops become a yymatchRun over the whole run
+# Usage: greg astgen.peg > astgen.greg.cpp && awk -f greg.awk astgen.greg.cpp > astgen.cpp
+
+{ lines[++n]= $0 }
+
+END {
+  for (i= 1; i <= n; ++i) {
+    line= lines[i]
+    if (match(line, /^YY_RULE\(int\) yy_[a-zA-Z0-9_]*\(GREG \*G\); \/\* [0-9]+ \*\/$/)) {
+      name= substr(line, 17, index(line, "(GREG") - 17)
+      split(line, words, " ")
+      rule[name]= words[5]
+    }
+    else if (match(line, /^YY_RULE\(int\) yy_[a-zA-Z0-9_]*\(GREG \*G\)$/))
+      current= rule[substr(line, 17, index(line, "(GREG") - 17)]
+    if (star(i)) { i += 3; continue }
+    gsub(/int yypos/, "yyoff yypos", line)
+    gsub(/int yyleng/, "yyoff yyleng", line)
+    if (match(line, /yyprintf\(\(stderr, "%s\\n", "[^"]*"\)\);/)) {
+      hook= substr(line, RSTART + 26, RLENGTH - 29)
+      line= substr(line, 1, RSTART + RLENGTH - 1) " yyprofileEnter(" current ", " hook ");" substr(line, RSTART + RLENGTH)
+    }
+    if (match(line, /yyprintf\(\(stderr, "  ok   %s @ %s\\n", "[^"]*", G->buf\+G->pos\)\);/))
+      line= substr(line, 1, RSTART + RLENGTH - 1) " yyprofileOk(" current ");" substr(line, RSTART + RLENGTH)
+    if (match(line, /^  l[0-9]+:;\t  G->pos= yypos[0-9]+;/)) {
+      pos= substr(line, index(line, "yypos"), RLENGTH - index(line, "yypos"))
+      line= substr(line, 1, index(line, "\t")) "  yyprofileBacktrack(" current ", " pos ");" substr(line, index(line, "\t") + 1)
+    }
+    print line
+  }
+}
+
+# Prints the loop greg emits for 'class*' at lines[i] as one yymatchRun, and skips past it
+function star(i,    head, label, next_label, bits, tail) {
+  if (!match(lines[i], /^  l[0-9]+:;\t$/)) return 0
+  label= substr(lines[i], 4, index(lines[i], ":") - 4)
+  head= lines[i + 1]
+  if (!match(head, /^  \{  G->maxPos=G->maxPos>G->pos\?G->maxPos:G->pos; int yypos[0-9]+= G->pos, yythunkpos[0-9]+= G->thunkpos;  if \(!yymatchClass\(G, \(unsigned char \*\)"[^"]*"\)\) goto l[0-9]+;  goto l[0-9]+;$/)) return 0
+  if (substr(head, length(head) - length(label) - 1) != "l" label ";") return 0
+  next_label= substr(head, index(head, "int yypos") + 9)
+  next_label= substr(next_label, 1, index(next_label, "=") - 1)
+  if (lines[i + 2] != "  l" next_label ":;\t  G->pos= yypos" next_label "; G->thunkpos= yythunkpos" next_label ";") return 0
+  if (substr(lines[i + 3], 1, 3) != "  }") return 0
+  bits= substr(head, index(head, "(unsigned char *)\"") + 17)
+  bits= substr(bits, 1, index(bits, ")) goto") - 1)
+  tail= substr(lines[i + 3], 4)
+  print "  static const yyrun yyrun" label "= yyrunInit((unsigned char *)" bits ");  yymatchRun(G, &yyrun" label ");" tail
+  return 1
+}
@@ -0,0 +1,124 @@
+// Checks that a parallel clone() takes ids from the caller's AstIdSpace and joins its
+// AstIndex like a serial one, inline children included, runs on options.threads threads and
+// rethrows what a thread throws. Built with -DASTGEN_IDS -DASTGEN_INDEX against compact.ast.
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+#include <new>
+#include <set>
+#include <stack>
+#include <string>
+#include <thread>
+#include <tuple>
+#include <vector>
+
+#include "compact_ast.hpp"
+
+static int failures=0;
+
+#define CHECK(condition) \
+  do { \
+    if (!(condition)) { \
+      std::cerr << __FILE__ << ":" << __LINE__ << ": " << #condition << std::endl; \
+      ++failures; \
+    } \
+  } while (0)
+
+// Allocations off the main thread fail once allocationsLeft counts down to 0, and all
+// record their thread while recording is set
+static std::thread::id mainThread;
+static std::atomic<long> allocationsLeft(-1);
+static std::atomic<bool> recording(false);
+static std::thread::id allocators[1<<16];
+static std::atomic<std::size_t> allocations(0);
+
+void* operator new(std::size_t size) {
+  if (std::this_thread::get_id()!=mainThread&&allocationsLeft.fetch_sub(1)==0) throw std::bad_alloc();
+  if (recording) {
+    std::size_t n=allocations++;
+    if (n<sizeof(allocators)/sizeof(allocators[0])) allocators[n]=std::this_thread::get_id();
+  }
+  if (void* p=std::malloc(size?size:1)) return p;
+  throw std::bad_alloc();
+}
+void operator delete(void* p) noexcept { std::free(p); }
+
+// Threads other than the caller that allocated during a clone with the given thread count
+static std::size_t cloneThreads(const List& list,std::size_t threads) {
+  CloneOptions options; options.parallelThreshold=10; options.threads=threads;
+  allocations=0;
+  recording=true;
+  auto copy=list.clone(options);
+  recording=false;
+  std::set<std::thread::id> seen;
+  for (std::size_t i=0;i<allocations&&i<sizeof(allocators)/sizeof(allocators[0]);++i) seen.insert(allocators[i]);
+  seen.erase(mainThread);
+  return seen.size();
+}
+
+int main() {
+  mainThread=std::this_thread::get_id();
+  const uint32_t items=1000;
+  AstIdSpace space;
+  AstIndex index;
+  std::unique_ptr<List> list,copy,serial;
+  {
+    AstIdSpace::Scope ids(space);
+    AstIndex::Scope scope(index);
+    list.reset(new List());
+    for (uint32_t i=0;i<items;++i) list->items.push_back(std::unique_ptr<Item>(new Item()));
+    CloneOptions options; options.parallelThreshold=10; options.threads=4;
+    copy=list->clone(options);
+  }
+  CHECK(space.count<List>()==2);
+  CHECK(space.count<Item>()==2*items);
+  CHECK(space.count<Pos>()==2*items);
+  CHECK(AstIdSpace::current().count<Item>()==0);
+
+  std::vector<bool> seen(2*items,false);
+  for (auto& item : copy->items) {
+    CHECK(item->nodeId>=items&&item->nodeId<2*items);
+    CHECK(item->pos.nodeId>=items&&item->pos.nodeId<2*items);
+    if (item->nodeId<2*items) {
+      CHECK(!seen[item->nodeId]);
+      seen[item->nodeId]=true;
+    }
+  }
+
+  // Parallel and serial copies are registered alike
+  CHECK(index.all<List>().size()==2);
+  CHECK(index.all<Item>().size()==2*items);
+  CHECK(index.all<Pos>().size()==2*items);
+  {
+    AstIndex::Scope scope(index);
+    serial=list->clone();
+  }
+  CHECK(index.all<Item>().size()==3*items);
+  CHECK(index.all<Pos>().size()==3*items);
+  for (auto& item : copy->items) CHECK(item->indexSlot.index==&index);
+  copy.reset();
+  serial.reset();
+  CHECK(index.all<List>().size()==1);
+  CHECK(index.all<Item>().size()==items);
+  CHECK(index.all<Pos>().size()==items);
+
+  CHECK(cloneThreads(*list,1)==0);
+  CHECK(cloneThreads(*list,3)==3);
+
+  // A copy that throws on another thread surfaces on the caller
+  bool threw=false;
+  try {
+    CloneOptions options; options.parallelThreshold=10; options.threads=4;
+    allocationsLeft=items/2;
+    list->clone(options);
+  } catch (const std::bad_alloc&) {
+    threw=true;
+  }
+  allocationsLeft=-1;
+  CHECK(threw);
+
+  if (failures) std::cerr << failures << " checks failed" << std::endl;
+  return failures?1:0;
+}
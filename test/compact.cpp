@@ -0,0 +1,58 @@
+// Checks that compact() keeps the AstIndex registrations of the nodes it moves, inline
+// children included. Built with -DASTGEN_INDEX -DASTGEN_ARENA against compact.ast.
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+#include <stack>
+#include <string>
+#include <tuple>
+#include <vector>
+
+#include "compact_ast.hpp"
+
+static int failures=0;
+
+#define CHECK(condition) \
+  do { \
+    if (!(condition)) { \
+      std::cerr << __FILE__ << ":" << __LINE__ << ": " << #condition << std::endl; \
+      ++failures; \
+    } \
+  } while (0)
+
+int main() {
+  AstIndex index;
+  AstArena arena;
+  std::unique_ptr<List> list;
+  {
+    AstIndex::Scope scope(index);
+    list.reset(new List());
+    list->name="list";
+    for (int i=0;i<3;++i) {
+      std::unique_ptr<Item> item(new Item());
+      item->name="item"+std::to_string(i);
+      item->pos.line=i;
+      list->items.push_back(std::move(item));
+    }
+  }
+  CHECK(index.all<List>().size()==1);
+  CHECK(index.all<Item>().size()==3);
+  CHECK(index.all<Pos>().size()==3);
+
+  list=compact(std::move(list),arena);
+  CHECK(index.all<List>().size()==1);
+  CHECK(index.all<Item>().size()==3);
+  CHECK(index.all<Pos>().size()==3);
+  CHECK(index.find<List>("list")==list.get());
+  CHECK(index.find<Item>("item1")==list->items[1].get());
+  for (auto& pos : index.all<Pos>()) CHECK(&pos==&list->items[pos.line]->pos);
+
+  list.reset();
+  CHECK(index.all<List>().size()==0);
+  CHECK(index.all<Item>().size()==0);
+  CHECK(index.all<Pos>().size()==0);
+
+  if (failures) std::cerr << failures << " checks failed" << std::endl;
+  return failures?1:0;
+}
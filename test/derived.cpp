@@ -0,0 +1,91 @@
+// Checks that derived attributes see changes to inline children whichever way the node was
+// made: default constructed, copied, moved or assigned. Built with -DASTGEN_ARENA against
+// derived.ast.
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+#include <stack>
+#include <string>
+#include <tuple>
+#include <vector>
+
+#include "derived_ast.hpp"
+
+int64_t computeSize(const Lit&) { return 1; }
+int64_t computeSize(const Add& node) { return 1+node.left->size()+node.right->size(); }
+int64_t computeSize(const Block& node) {
+  int64_t size=node.pos.line;
+  for (auto& item : node.items) size+=item->size();
+  return size;
+}
+
+static int failures=0;
+
+#define CHECK(condition) \
+  do { \
+    if (!(condition)) { \
+      std::cerr << __FILE__ << ":" << __LINE__ << ": " << #condition << std::endl; \
+      ++failures; \
+    } \
+  } while (0)
+
+int main() {
+  // Default constructed
+  Block block;
+  CHECK(block.pos.parent==&block);
+  CHECK(block.size()==0);
+  block.pos.line=2;
+  block.pos.invalidate();
+  CHECK(block.size()==2);
+  block.setItems(std::vector<std::unique_ptr<Expr>>());
+  block.items.push_back(std::unique_ptr<Expr>(new Lit(7)));
+  block.link();
+  block.invalidate();
+  CHECK(block.size()==3);
+
+  // Copies belong to no node and compute afresh
+  Pos pos(block.pos);
+  CHECK(pos.parent==nullptr);
+  CHECK(pos.dirty==~0u);
+  Lit lit(*static_cast<Lit*>(block.items[0].get()));
+  CHECK(lit.parent==nullptr);
+
+  // Moves take their children along
+  Block moved(std::move(block));
+  CHECK(moved.parent==nullptr);
+  CHECK(moved.pos.parent==&moved);
+  CHECK(moved.items[0]->parent==&moved);
+  CHECK(moved.size()==3);
+  moved.pos.line=5;
+  moved.pos.invalidate();
+  CHECK(moved.size()==6);
+
+  // Assigning keeps the owner
+  Block assigned;
+  assigned=std::move(moved);
+  CHECK(assigned.pos.parent==&assigned);
+  CHECK(assigned.items[0]->parent==&assigned);
+  CHECK(assigned.size()==6);
+  assigned.pos=pos;
+  CHECK(assigned.pos.parent==&assigned);
+  CHECK(assigned.size()==3);
+  assigned.pos.line=0;
+  assigned.pos.invalidate();
+  CHECK(assigned.size()==1);
+
+#ifdef ASTGEN_ARENA
+  // compact() moves inline children with their parents
+  AstArena arena;
+  std::unique_ptr<Block> root(new Block(std::move(assigned)));
+  root=compact(std::move(root),arena);
+  CHECK(root->pos.parent==root.get());
+  CHECK(root->items[0]->parent==root.get());
+  root->pos.line=4;
+  root->pos.invalidate();
+  CHECK(root->size()==5);
+#endif
+
+  if (failures) std::cerr << failures << " checks failed" << std::endl;
+  return failures?1:0;
+}
@@ -0,0 +1,86 @@
+// Checks that AstEventReader::replay() passes the visitor each node with its scalars, and
+// that its stand-in nodes get no ids and stay out of AstIndex and AstStats. Built with
+// -DASTGEN_IDS -DASTGEN_INDEX -DASTGEN_STATS against compact.ast.
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <stack>
+#include <string>
+#include <tuple>
+#include <vector>
+
+#include "compact_ast.hpp"
+
+static int failures=0;
+
+#define CHECK(condition) \
+  do { \
+    if (!(condition)) { \
+      std::cerr << __FILE__ << ":" << __LINE__ << ": " << #condition << std::endl; \
+      ++failures; \
+    } \
+  } while (0)
+
+struct Names : Visitor {
+  std::vector<std::string> names;
+  void visitPre(const std::string&,const Item& node) {
+    names.push_back(node.name);
+    CHECK(node.nodeId==0);
+    CHECK(node.indexSlot.index==nullptr);
+  }
+  void visitPre(const std::string&,const List& node) {
+    names.push_back(node.name);
+    CHECK(node.nodeId==0);
+    CHECK(node.indexSlot.index==nullptr);
+  }
+};
+
+int main() {
+  const uint32_t items=3;
+  std::stringstream stream;
+  {
+    std::unique_ptr<List> list(new List());
+    list->name="list";
+    for (uint32_t i=0;i<items;++i) {
+      list->items.push_back(std::unique_ptr<Item>(new Item()));
+      list->items.back()->name="item"+std::to_string(i);
+    }
+    AstEventWriter writer(stream);
+    writer.write(*list);
+    writer.write(*list);
+  }
+
+  AstStats::get().reset();
+  AstIdSpace space;
+  AstIndex index;
+  Names names;
+  {
+    AstIdSpace::Scope ids(space);
+    AstIndex::Scope scope(index);
+    AstEventReader reader(stream);
+    while (reader.replay(names)) {}
+  }
+  CHECK(names.names.size()==2*(items+1));
+  if (names.names.size()==2*(items+1)) {
+    CHECK(names.names[0]=="list");
+    CHECK(names.names[items]=="item2");
+    CHECK(names.names[items+1]=="list");
+  }
+  CHECK(space.count<List>()==0);
+  CHECK(space.count<Item>()==0);
+  CHECK(space.count<Pos>()==0);
+  CHECK(index.all<Item>().size()==0);
+  CHECK(index.all<Pos>().size()==0);
+  CHECK(AstStats::get().constructed[KindId<Item>::value]==0);
+  CHECK(AstStats::get().constructed[KindId<Pos>::value]==0);
+  CHECK(AstStats::get().bytes[KindId<Item>::value]==0);
+
+  // Nodes made after replay are counted again
+  Item item;
+  CHECK(AstStats::get().constructed[KindId<Item>::value]==1);
+
+  if (failures) std::cerr << failures << " checks failed" << std::endl;
+  return failures?1:0;
+}
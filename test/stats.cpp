@@ -0,0 +1,58 @@
+// Checks that AstStats counts each allocation's bytes once: inline children are part of
+// their owner's bytes. Built with -DASTGEN_STATS against compact.ast.
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <stack>
+#include <string>
+#include <tuple>
+#include <vector>
+
+#include "compact_ast.hpp"
+
+static int failures=0;
+
+#define CHECK(condition) \
+  do { \
+    if (!(condition)) { \
+      std::cerr << __FILE__ << ":" << __LINE__ << ": " << #condition << std::endl; \
+      ++failures; \
+    } \
+  } while (0)
+
+int main() {
+  const uint64_t items=10;
+  AstStats& stats=AstStats::get();
+  stats.reset();
+  {
+    std::unique_ptr<List> list(new List());
+    for (uint64_t i=0;i<items;++i) list->items.push_back(std::unique_ptr<Item>(new Item()));
+    std::unique_ptr<Pos> pos(new Pos());
+
+    CHECK(stats.constructed[KindId<List>::value]==1);
+    CHECK(stats.constructed[KindId<Item>::value]==items);
+    CHECK(stats.constructed[KindId<Pos>::value]==items+1);
+    CHECK(stats.bytes[KindId<List>::value]==sizeof(List));
+    CHECK(stats.bytes[KindId<Item>::value]==items*sizeof(Item));
+    CHECK(stats.bytes[KindId<Pos>::value]==sizeof(Pos));
+
+    // Copies are not counted
+    Item copy(*list->items[0]);
+    CHECK(stats.constructed[KindId<Item>::value]==items);
+    CHECK(stats.bytes[KindId<Pos>::value]==sizeof(Pos));
+  }
+  CHECK(stats.destroyed[KindId<List>::value]==1);
+  CHECK(stats.destroyed[KindId<Item>::value]==items);
+  CHECK(stats.destroyed[KindId<Pos>::value]==items+1);
+
+  std::ostringstream dump;
+  stats.dump(dump);
+  std::ostringstream line;
+  line << "Item " << items << ' ' << items << ' ' << items*sizeof(Item) << " 0 0\n";
+  CHECK(dump.str().find(line.str())!=std::string::npos);
+
+  if (failures) std::cerr << failures << " checks failed" << std::endl;
+  return failures?1:0;
+}